@@ -0,0 +1,179 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "binary_cache.hpp"
+#include "build_pipeline.hpp"
+#include "tree_cache.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuseless-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsuggest-attribute=pure"
+#endif
+
+#include <glib.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::string_view MANIFEST_NAME = "SHA256SUMS";
+
+// Options which make the kernel specific to the CPU it's built on.
+constexpr std::array MACHINE_SPECIFIC_OPTIONS{"_use_auto_optimization=y", "_processor_opt=native_amd", "_processor_opt=native_intel"};
+
+bool has_option(std::string_view options_set, std::string_view option) noexcept {
+    return std::ranges::any_of(utils::make_multiline_view(options_set, '\n'), [option](auto&& line) { return line == option; });
+}
+
+auto get_cpu_model() noexcept -> std::string {
+    const auto& cpuinfo = utils::read_whole_file("/proc/cpuinfo");
+    for (auto&& line : utils::make_multiline_view(cpuinfo, '\n')) {
+        if (line.starts_with("model name")) {
+            return std::string{line};
+        }
+    }
+    return {};
+}
+
+// Signature and fingerprint checks of the fetch command, on the store itself.
+bool has_trusted_manifest(const fs::path& entry_path, std::string_view fingerprint) noexcept {
+    using build_pipeline::shell_quote;
+
+    const auto& manifest_path = (entry_path / MANIFEST_NAME).string();
+    const auto& manifest      = utils::read_whole_file(manifest_path);
+    /* clang-format off */
+    if (manifest.substr(0, manifest.find('\n')) != fingerprint) { return false; }
+    /* clang-format on */
+
+    // gpg reports the trust of the signing key only for a good signature.
+    const auto& gpg_status = utils::exec(fmt::format(FMT_COMPILE("gpg --batch --status-fd 1 --verify -- {}.sig {} 2>/dev/null"),
+        shell_quote(manifest_path), shell_quote(manifest_path)));
+    return std::ranges::any_of(utils::make_multiline_view(gpg_status, '\n'),
+        [](auto&& line) { return line.starts_with("[GNUPG:] TRUST_FULLY") || line.starts_with("[GNUPG:] TRUST_ULTIMATE"); });
+}
+
+}  // namespace
+
+namespace binary_cache {
+
+auto get_default_store_path() noexcept -> const fs::path& {
+    static const fs::path store_path = utils::fix_path("~/.cache/cachyos-km/packages");
+    return store_path;
+}
+
+bool is_cacheable(std::string_view options_set) noexcept {
+    return tree_cache::is_reusable(options_set);
+}
+
+auto compute_fingerprint(std::string_view pkgbuild_path, std::string_view options_set,
+    const std::vector<std::string>& patches) noexcept -> std::string {
+    auto key_src = fmt::format(FMT_COMPILE("{}\n{}"), utils::git_blob_id(pkgbuild_path), options_set);
+    key_src += tree_cache::format_local_patches(patches);
+    if (std::ranges::any_of(MACHINE_SPECIFIC_OPTIONS, [options_set](auto&& option) { return has_option(options_set, option); })) {
+        key_src += get_cpu_model();
+    }
+
+    auto* checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key_src.c_str(), static_cast<gssize>(key_src.size()));
+    std::string result{checksum};
+    g_free(checksum);
+    return result;
+}
+
+auto get_entry_path(const fs::path& store_path, std::string_view fingerprint) noexcept -> fs::path {
+    return store_path / fingerprint;
+}
+
+auto lookup_packages(const fs::path& store_path, std::string_view fingerprint) noexcept -> std::vector<fs::path> {
+    std::vector<fs::path> packages{};
+
+    // Entries of older versions have no manifest, entries signed by an untrusted or expired key
+    // couldn't be installed, they are built again.
+    const auto& entry_path = get_entry_path(store_path, fingerprint);
+    std::error_code err_code{};
+    /* clang-format off */
+    if (!fs::exists(entry_path / fmt::format(FMT_COMPILE("{}.sig"), MANIFEST_NAME), err_code)) { return packages; }
+    if (!has_trusted_manifest(entry_path, fingerprint)) { return packages; }
+    /* clang-format on */
+    for (const auto& dir_entry : fs::directory_iterator(entry_path, err_code)) {
+        const auto& filename = dir_entry.path().filename().string();
+        if (dir_entry.is_regular_file(err_code) && filename.find(".pkg.tar") != std::string::npos && !filename.ends_with(".sig")) {
+            packages.emplace_back(dir_entry.path());
+        }
+    }
+    std::ranges::sort(packages);
+    return packages;
+}
+
+auto make_publish_command(std::string_view entry_path) noexcept -> std::string {
+    using build_pipeline::shell_quote;
+
+    // Copy into a temporary directory on the same filesystem and rename it,
+    // so other machines never see a partial entry. If another machine was faster, keep its entry.
+    // The fingerprint in the manifest binds the signed packages to this entry.
+    const auto& entry_dir   = shell_quote(entry_path);
+    const auto& tmp_dir     = fmt::format(FMT_COMPILE("{}.tmp.$$"), entry_dir);
+    const auto& fingerprint = shell_quote(fs::path{entry_path}.filename().string());
+    return fmt::format(FMT_COMPILE("{{ mkdir -p {0} && cp -- \"${{__km_pkgs[@]}}\" {0}/ "
+                                   "&& ( cd {0} && {{ echo {1}; sha256sum -- *.pkg.tar*; }} > {3} "
+                                   "&& gpg --batch --yes ${{GPGKEY:+-u \"$GPGKEY\"}} --detach-sign -- {3} ) "
+                                   "&& {{ mv -T {0} {2} 2>/dev/null || rm -rf {0}; }} "
+                                   "|| {{ rm -rf {0}; echo 'Failed to sign the packages, they are not stored'; }}; }}"),
+        tmp_dir, fingerprint, entry_dir, MANIFEST_NAME);
+}
+
+auto make_fetch_command(std::string_view entry_path) noexcept -> std::string {
+    using build_pipeline::shell_quote;
+
+    // The copies are checked, so the installed files can't be replaced in between.
+    // gpg reports the trust of the signing key, own keys are ultimately trusted.
+    const auto& entry_dir   = shell_quote(entry_path);
+    const auto& fingerprint = shell_quote(fs::path{entry_path}.filename().string());
+    return fmt::format(FMT_COMPILE("__km_fetch_dir=$(mktemp -d) && {{ "
+                                   "cp -- {0}/{2} {0}/{2}.sig \"$__km_fetch_dir\"/ "
+                                   "&& __km_gpg_status=$(gpg --batch --status-fd 1 --verify -- \"$__km_fetch_dir\"/{2}.sig \"$__km_fetch_dir\"/{2} 2>/dev/null) "
+                                   "&& grep -qE '^\\[GNUPG:\\] TRUST_(FULLY|ULTIMATE)' <<< \"$__km_gpg_status\" "
+                                   "&& [ \"$(head -n 1 \"$__km_fetch_dir\"/{2})\" = {1} ] "
+                                   "&& mapfile -t __km_pkgs < <(tail -n +2 \"$__km_fetch_dir\"/{2} | cut -c 67-) "
+                                   "&& ( cd {0} && cp -- \"${{__km_pkgs[@]}}\" \"$__km_fetch_dir\"/ ) "
+                                   "&& ( cd \"$__km_fetch_dir\" && tail -n +2 {2} | sha256sum -c --quiet --strict ) "
+                                   "&& __km_pkgs=(\"${{__km_pkgs[@]/#/$__km_fetch_dir/}}\") "
+                                   "|| {{ echo 'The stored build has no valid signature of a trusted key'; false; }}; }}"),
+        entry_dir, fingerprint, MANIFEST_NAME);
+}
+
+}  // namespace binary_cache
@@ -0,0 +1,61 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef BINARY_CACHE_HPP
+#define BINARY_CACHE_HPP
+
+#include <filesystem>   // for path
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Store of built packages, keyed by the fingerprint of the build inputs.
+///
+/// The store may be shared between machines (e.g NFS mount):
+///   <store>/<fingerprint>/*.pkg.tar.*        packages of one build, published atomically
+///   <store>/<fingerprint>/SHA256SUMS(.sig)  fingerprint and checksums of the packages, signed with gpg
+/// Packages are installed only if the manifest is signed by a fully trusted key.
+namespace binary_cache {
+
+[[nodiscard]] auto get_default_store_path() noexcept -> const std::filesystem::path&;
+
+/// Interactive config and localmodcfg depend on the user or the machine, such builds aren't stored.
+[[nodiscard]] bool is_cacheable(std::string_view options_set) noexcept;
+
+/// Fingerprint of the prepared PKGBUILD (revision, patch list, custom name), the options
+/// and content of local patches. CPU model is included for options which tune for the build machine.
+[[nodiscard]] auto compute_fingerprint(std::string_view pkgbuild_path, std::string_view options_set,
+    const std::vector<std::string>& patches) noexcept -> std::string;
+
+[[nodiscard]] auto get_entry_path(const std::filesystem::path& store_path, std::string_view fingerprint) noexcept -> std::filesystem::path;
+
+/// Returns the packages of the stored build, nothing if it's not in the store or its manifest isn't signed
+/// by a fully trusted key. The fetch command checks the copies again.
+[[nodiscard]] auto lookup_packages(const std::filesystem::path& store_path, std::string_view fingerprint) noexcept -> std::vector<std::filesystem::path>;
+
+/// Shell command which publishes the packages of "${__km_pkgs[@]}" to the entry with the signed manifest.
+/// GPGKEY selects the signing key like for makepkg. A failure to sign is reported, the build doesn't fail.
+[[nodiscard]] auto make_publish_command(std::string_view entry_path) noexcept -> std::string;
+
+/// Shell command which copies the stored build into a new "$__km_fetch_dir" and checks the copies
+/// against the signed manifest. Fills __km_pkgs with the checked packages, the caller removes the directory.
+[[nodiscard]] auto make_fetch_command(std::string_view entry_path) noexcept -> std::string;
+
+}  // namespace binary_cache
+
+#endif  // BINARY_CACHE_HPP
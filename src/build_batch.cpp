@@ -0,0 +1,257 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+
+#include "build_batch.hpp"
+#include "build_pipeline.hpp"
+#include "makepkg_conf.hpp"
+#include "tree_cache.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <set>
+#include <system_error>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Below that a build spends more time in its serial parts than it gains from sharing the cores.
+constexpr std::uint32_t MIN_JOBS_PER_BUILD = 4;
+
+auto get_worst_lto_mode(const std::vector<build_batch::BatchEntry>& entries) noexcept -> std::string_view {
+    const auto has_lto_mode = [&entries](std::string_view lto_mode) {
+        return std::ranges::any_of(entries, [lto_mode](auto&& entry) { return entry.lto_mode == lto_mode; });
+    };
+    if (has_lto_mode("full")) {
+        return "full";
+    }
+    return has_lto_mode("thin") ? "thin" : "none";
+}
+
+auto make_entry_exports(const build_batch::BatchEntry& entry, const fs::path& entry_path) noexcept -> std::string {
+    using build_pipeline::shell_quote;
+
+    std::string result = fmt::format(FMT_COMPILE("export BUILDDIR={} PKGDEST={}"), shell_quote((entry_path / "build").string()),
+        shell_quote((entry_path / "pkg").string()));
+    for (auto&& line : utils::make_multiline_view(entry.options_set, '\n')) {
+        const auto delim_pos = line.find('=');
+        /* clang-format off */
+        if (delim_pos == std::string_view::npos) { continue; }
+        /* clang-format on */
+        result += fmt::format(FMT_COMPILE(" {}={}"), line.substr(0, delim_pos), shell_quote(line.substr(delim_pos + 1)));
+    }
+    return result;
+}
+
+// Extract, patch and configure the tree of the entry, or copy the snapshot of an identical tree.
+auto make_prepare_command(const build_batch::BatchEntry& entry, const fs::path& entry_path, std::set<std::string>& prepared_keys) noexcept -> std::string {
+    // An earlier entry of the batch may save the snapshot of the same tree.
+    const bool use_snapshot = !entry.tree_key.empty() && (tree_cache::has_snapshot(entry.tree_key) || prepared_keys.contains(entry.tree_key));
+    if (!entry.tree_key.empty()) {
+        prepared_keys.insert(entry.tree_key);
+    }
+
+    std::vector<std::string> commands{};
+    if (use_snapshot) {
+        // makepkg only installs the dependencies here, the compile runs with --nodeps.
+        commands.emplace_back(fmt::format(FMT_COMPILE("makepkg -so --noextract {}"), build_pipeline::MAKEPKG_FLAGS));
+    }
+    build_pipeline::append_prepare_commands((entry_path / "build" / entry.pkgbase / "src").string(), entry.tree_key, use_snapshot, commands);
+    return build_pipeline::join_commands(commands);
+}
+
+}  // namespace
+
+namespace build_batch {
+
+auto get_batch_path() noexcept -> const fs::path& {
+    static const fs::path batch_path = utils::fix_path("~/.cache/cachyos-km/batch");
+    return batch_path;
+}
+
+auto get_pending_batch_path() noexcept -> const fs::path& {
+    static const fs::path pending_batch_path = utils::fix_path("~/.cache/cachyos-km/batch.new");
+    return pending_batch_path;
+}
+
+auto get_entry_path(const fs::path& batch_path, std::size_t index, const BatchEntry& entry) noexcept -> fs::path {
+    return batch_path / fmt::format(FMT_COMPILE("{}-{}"), index + 1, entry.label);
+}
+
+auto copy_pkgbuild(std::size_t index, const BatchEntry& entry) noexcept -> std::optional<fs::path> {
+    const auto& copy_path = get_entry_path(get_pending_batch_path(), index, entry) / "pkgbuild";
+    std::error_code err_code{};
+    fs::create_directories(copy_path, err_code);
+    for (const auto& dir_entry : fs::directory_iterator(entry.pkgbuild_dir, err_code)) {
+        /* clang-format off */
+        if (!dir_entry.is_regular_file(err_code)) { continue; }
+        /* clang-format on */
+        fs::copy_file(dir_entry.path(), copy_path / dir_entry.path().filename(), fs::copy_options::overwrite_existing, err_code);
+        if (err_code) {
+            fmt::print(stderr, "Failed to copy '{}': {}\n", dir_entry.path().string(), err_code.message());
+            return std::nullopt;
+        }
+    }
+    if (err_code || !fs::exists(copy_path / "PKGBUILD", err_code)) {
+        fmt::print(stderr, "Failed to copy the PKGBUILD of '{}'\n", entry.pkgbuild_dir);
+        return std::nullopt;
+    }
+    return copy_path;
+}
+
+auto plan_batch(const build_resources::SystemResources& resources, const std::vector<BatchEntry>& entries) noexcept -> BatchPlan {
+    const auto& lto_mode     = get_worst_lto_mode(entries);
+    const auto& single_plan  = build_resources::plan_jobs(resources, lto_mode);
+    const auto max_parallel  = std::min(static_cast<std::uint32_t>(entries.size()), resources.cpus / MIN_JOBS_PER_BUILD);
+    const auto reserved_mem  = build_resources::estimate_build_memory({.compile_jobs = 0}, "none");
+    const auto mem_available = resources.mem_available_kib;
+
+    // Prefer more builds at once, the reserve for the rest of the system is counted only once.
+    for (auto parallel_builds = max_parallel; parallel_builds >= 2; --parallel_builds) {
+        const auto compile_jobs = resources.cpus / parallel_builds;
+        const auto build_mem    = build_resources::estimate_build_memory({.compile_jobs = compile_jobs}, lto_mode) - reserved_mem;
+        if (reserved_mem + parallel_builds * build_mem <= mem_available) {
+            return BatchPlan{
+                .parallel_builds = parallel_builds,
+                .compile_jobs    = compile_jobs,
+                .reason          = fmt::format(FMT_COMPILE("{} builds at once, {} jobs each"), parallel_builds, compile_jobs),
+            };
+        }
+    }
+
+    std::string reason{};
+    if (entries.size() < 2) {
+        reason = fmt::format(FMT_COMPILE("one build, {} jobs"), single_plan.compile_jobs);
+    } else if (max_parallel < 2) {
+        reason = fmt::format(FMT_COMPILE("one build at a time, {} jobs: too few CPUs to share"), single_plan.compile_jobs);
+    } else {
+        reason = fmt::format(FMT_COMPILE("one build at a time, {} jobs: two builds don't fit into {:.1f} GiB available memory"),
+            single_plan.compile_jobs, static_cast<double>(mem_available) / (1024 * 1024));
+    }
+    return BatchPlan{.compile_jobs = single_plan.compile_jobs, .reason = std::move(reason)};
+}
+
+auto make_batch_command(const std::vector<BatchEntry>& entries, const BatchPlan& plan, std::string_view makepkg_conf_path,
+    const std::vector<std::string>& unset_names) noexcept -> std::string {
+    using build_pipeline::shell_quote;
+
+    // Every entry is tracked by its 'failed' file, a failed entry doesn't stop the others.
+    std::vector<std::string> commands{};
+    if (!unset_names.empty()) {
+        std::string unset_command{"unset"};
+        for (const auto& name : unset_names) {
+            unset_command += fmt::format(FMT_COMPILE(" {}"), name);
+        }
+        commands.emplace_back(std::move(unset_command));
+    }
+
+    // The pending batch already has the copies of the PKGBUILDs, the previous batch is kept until this one succeeds.
+    const auto& batch_path         = shell_quote(get_batch_path().string());
+    const auto& pending_batch_path = shell_quote(get_pending_batch_path().string());
+
+    std::set<std::string> prepared_keys{};
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        const auto& entry      = entries[i];
+        const auto& entry_path = get_entry_path(get_pending_batch_path(), i, entry);
+        commands.emplace_back(fmt::format(FMT_COMPILE("mkdir -p {}"), shell_quote(entry_path.string())));
+        commands.emplace_back(fmt::format(FMT_COMPILE("echo {}"), shell_quote(fmt::format(FMT_COMPILE("==> [{}/{}] {}: preparing"), i + 1, entries.size(), entry.label))));
+        commands.emplace_back(fmt::format(FMT_COMPILE("( cd {} && {} && {} ) || echo prepare > {}"), shell_quote(entry.pkgbuild_dir),
+            make_entry_exports(entry, entry_path), make_prepare_command(entry, entry_path, prepared_keys), shell_quote((entry_path / "failed").string())));
+    }
+
+    commands.emplace_back(fmt::format(FMT_COMPILE("echo {}"), shell_quote(fmt::format(FMT_COMPILE("==> Compiling: {}"), plan.reason))));
+    std::string makepkg_conf_export{};
+    if (!makepkg_conf_path.empty()) {
+        for (const auto& [name, value] : makepkg_conf::get_environment(makepkg_conf_path)) {
+            makepkg_conf_export += fmt::format(FMT_COMPILE(" {}={}"), name, shell_quote(value));
+        }
+    }
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        const auto& entry       = entries[i];
+        const auto& entry_path  = get_entry_path(get_pending_batch_path(), i, entry);
+        const auto& failed_path = shell_quote((entry_path / "failed").string());
+        const auto& log_path    = shell_quote((entry_path / "build.log").string());
+        const auto& label       = shell_quote(entry.label);
+
+        // Wait for a free slot, then compile in the background.
+        commands.emplace_back(fmt::format(FMT_COMPILE("if [ ! -e {0} ]; then "
+                                                      "while [ \"$(jobs -pr | wc -l)\" -ge {1} ]; do wait -n; done; "
+                                                      "echo \"==> \"{2}\": compiling, log in \"{3}; "
+                                                      "{{ if ( cd {4} && {5}{6} && makepkg -f --noextract --nodeps {7} ) > {3} 2>&1; "
+                                                      "then echo \"==> \"{2}\": done\"; else echo compile > {0}; echo \"==> \"{2}\": failed\"; fi; }} & fi"),
+            failed_path, plan.parallel_builds, label, log_path, shell_quote(entry.pkgbuild_dir), make_entry_exports(entry, entry_path),
+            makepkg_conf_export, build_pipeline::MAKEPKG_FLAGS));
+    }
+    commands.emplace_back("wait");
+
+    // Summary, the exit status is non-zero if any entry failed.
+    commands.emplace_back("__km_failed=0");
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        const auto& failed_path = shell_quote((get_entry_path(get_pending_batch_path(), i, entries[i]) / "failed").string());
+        commands.emplace_back(fmt::format(FMT_COMPILE("if [ -e {0} ]; then __km_failed=1; echo {1}\": $(cat {0}) failed\"; fi"), failed_path,
+            shell_quote(entries[i].label)));
+    }
+    commands.emplace_back(fmt::format(FMT_COMPILE("if [ $__km_failed = 0 ]; then rm -rf {0} && mv -T {1} {0} && __km_batch_dir={0}; "
+                                                  "else __km_batch_dir={1}; echo 'Some entries failed, the previous batch is kept in '{0}; fi"),
+        batch_path, pending_batch_path));
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        const auto& entry_name = shell_quote(get_entry_path({}, i, entries[i]).string());
+        commands.emplace_back(fmt::format(FMT_COMPILE("if [ ! -e \"$__km_batch_dir\"/{0}/failed ]; then echo {1}\": packages in $__km_batch_dir/\"{0}/pkg; fi"),
+            entry_name, shell_quote(entries[i].label)));
+    }
+    commands.emplace_back("(exit $__km_failed)");
+
+    std::string result{};
+    for (const auto& command : commands) {
+        if (!result.empty()) {
+            result += "; ";
+        }
+        result += command;
+    }
+    return result;
+}
+
+auto format_entries(const std::vector<BatchEntry>& entries) noexcept -> std::string {
+    // Options set in every entry aren't interesting.
+    std::vector<std::vector<std::string_view>> entry_options{};
+    for (const auto& entry : entries) {
+        entry_options.emplace_back(utils::make_multiline_view(entry.options_set, '\n'));
+    }
+    const auto is_common = [&entry_options](std::string_view option) {
+        return std::ranges::all_of(entry_options, [option](auto&& options) { return std::ranges::find(options, option) != options.end(); });
+    };
+
+    std::string result{};
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        std::string differing{};
+        for (const auto& option : entry_options[i]) {
+            if (entries.size() > 1 && !is_common(option)) {
+                differing += fmt::format(FMT_COMPILE(" {}"), option);
+            }
+        }
+        result += fmt::format(FMT_COMPILE("{}{}. {}{}"), result.empty() ? "" : "\n", i + 1, entries[i].label, differing.empty() ? "" : ":");
+        result += differing;
+    }
+    return result;
+}
+
+}  // namespace build_batch
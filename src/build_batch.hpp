@@ -0,0 +1,97 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+
+#ifndef BUILD_BATCH_HPP
+#define BUILD_BATCH_HPP
+
+#include "build_resources.hpp"
+
+#include <cstddef>      // for size_t
+#include <cstdint>      // for uint32_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Several variants and option sets built as one job, e.g bore, rt and the default scheduler side by side.
+///
+/// Sources are fetched once into the shared SRCDEST, then every entry is prepared in turn (extract, patch, config),
+/// so dependencies and interactive config tools still run in the terminal. Identical trees are extracted once
+/// through the tree cache. The compiles run afterwards in their own BUILDDIR, several at once if the cores
+/// and the memory allow it: serial parts of a kernel build (config, modpost, links, compression) leave cores idle.
+///
+/// A batch is built in ~/.cache/cachyos-km/batch.new and replaces the previous one in ~/.cache/cachyos-km/batch
+/// only if every entry succeeded, the packages of a successful batch aren't lost with a failed one.
+///
+/// Layout of <batch>/<n>-<label>:
+///   pkgbuild/   PKGBUILD with the patch list and the custom name of the entry, and its local files
+///   build/      BUILDDIR of the entry
+///   pkg/        PKGDEST, the built packages aren't installed
+///   build.log   output of the compile
+///   failed      stage which failed, missing if the entry succeeded
+namespace build_batch {
+
+struct BatchEntry {
+    // Kernel name of the variant, e.g "bore".
+    std::string label{};
+    // PKGBUILD directory of the variant, the batch command needs an absolute one.
+    std::string pkgbuild_dir{};
+    // Patch list (source array entries) and custom name of the entry, applied to its copy of the PKGBUILD.
+    std::vector<std::string> patches{};
+    std::string custom_name{};
+    std::string pkgbase{};
+    // VAR=value lines.
+    std::string options_set{};
+    // "none", "full" or "thin", used to estimate the memory of the compile.
+    std::string lto_mode{};
+    // Key of the tree snapshot (see tree_cache), empty if the tree must not be reused.
+    std::string tree_key{};
+};
+
+struct BatchPlan {
+    std::uint32_t parallel_builds{1};
+    // make -j of every build
+    std::uint32_t compile_jobs{1};
+    std::string reason{};
+};
+
+[[nodiscard]] auto get_batch_path() noexcept -> const std::filesystem::path&;
+/// Batch being built, it's removed by the next batch.
+[[nodiscard]] auto get_pending_batch_path() noexcept -> const std::filesystem::path&;
+[[nodiscard]] auto get_entry_path(const std::filesystem::path& batch_path, std::size_t index, const BatchEntry& entry) noexcept -> std::filesystem::path;
+
+/// Copies the files of the PKGBUILD directory (not the build directories in it) into the pkgbuild directory
+/// of the entry in the pending batch, returns the copy.
+[[nodiscard]] auto copy_pkgbuild(std::size_t index, const BatchEntry& entry) noexcept -> std::optional<std::filesystem::path>;
+
+/// Splits the cores between the builds, as long as every build keeps enough jobs and all of them fit into memory.
+[[nodiscard]] auto plan_batch(const build_resources::SystemResources& resources, const std::vector<BatchEntry>& entries) noexcept -> BatchPlan;
+
+/// Builds the shell command of the batch, the entries build their copies of the PKGBUILD in the pending batch.
+/// unset_names are dropped from the inherited environment, every entry exports only its own options. makepkg_conf_path may be empty.
+[[nodiscard]] auto make_batch_command(const std::vector<BatchEntry>& entries, const BatchPlan& plan, std::string_view makepkg_conf_path,
+    const std::vector<std::string>& unset_names) noexcept -> std::string;
+
+/// One line per entry with its label and the options, which differ between the entries.
+[[nodiscard]] auto format_entries(const std::vector<BatchEntry>& entries) noexcept -> std::string;
+
+}  // namespace build_batch
+
+#endif  // BUILD_BATCH_HPP
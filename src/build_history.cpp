@@ -0,0 +1,225 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "build_history.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <map>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Builds averaged by the prediction, older ones may be from a different kernel version.
+constexpr std::size_t PREDICTION_SAMPLES = 3;
+constexpr std::size_t RECORD_FIELDS      = 6 + build_progress::STAGE_COUNT - 2 + 1;
+
+auto parse_number(std::string_view value) noexcept -> std::int64_t {
+    std::int64_t result{};
+    std::from_chars(value.data(), value.data() + value.size(), result);
+    return result;
+}
+
+// Total memory differs slightly between kernels, same CPU count and about the same memory is the same host.
+bool is_same_host(const build_history::BuildRecord& record, std::uint32_t cpus, std::uint64_t mem_total_mib) noexcept {
+    const auto mem_diff = (record.mem_total_mib > mem_total_mib) ? (record.mem_total_mib - mem_total_mib) : (mem_total_mib - record.mem_total_mib);
+    return record.cpus == cpus && mem_diff <= std::max(record.mem_total_mib, mem_total_mib) / 16;
+}
+
+auto average(const std::vector<std::int64_t>& values) noexcept -> std::int64_t {
+    std::int64_t sum{};
+    for (const auto value : values) {
+        sum += value;
+    }
+    return values.empty() ? 0 : sum / static_cast<std::int64_t>(values.size());
+}
+
+// "VAR=value" -> "VAR"
+auto get_option_name(std::string_view option) noexcept -> std::string_view {
+    return option.substr(0, option.find('='));
+}
+
+}  // namespace
+
+namespace build_history {
+
+auto get_history_path() noexcept -> const fs::path& {
+    static const fs::path history_path = utils::fix_path("~/.cache/cachyos-km/build-history");
+    return history_path;
+}
+
+auto normalize_options(std::string_view options_set) noexcept -> std::string {
+    std::string result{};
+    for (auto&& option : utils::make_multiline_view(options_set, '\n')) {
+        if (!result.empty()) {
+            result += ' ';
+        }
+        result += option;
+    }
+    return result;
+}
+
+auto get_total_seconds(const BuildRecord& record) noexcept -> std::int64_t {
+    std::int64_t total{};
+    for (const auto stage_seconds : record.stage_seconds) {
+        total += stage_seconds;
+    }
+    return total;
+}
+
+auto format_host(std::uint32_t cpus, std::uint64_t mem_total_mib) noexcept -> std::string {
+    return fmt::format(FMT_COMPILE("{} CPUs, {:.0f} GiB"), cpus, static_cast<double>(mem_total_mib) / 1024.0);
+}
+
+bool append_record(const BuildRecord& record) noexcept {
+    auto history = utils::read_whole_file(get_history_path().string());
+    history += fmt::format(FMT_COMPILE("{}\t{}\t{}\t{}\t{}\t{}"), record.timestamp, record.cpus, record.mem_total_mib,
+        record.succeeded ? 1 : 0, record.peak_memory_mib, record.build_mode.empty() ? "clean" : record.build_mode);
+    for (auto i = static_cast<std::size_t>(build_progress::Stage::fetch); i < static_cast<std::size_t>(build_progress::Stage::done); ++i) {
+        history += fmt::format(FMT_COMPILE("\t{}"), record.stage_seconds[i]);
+    }
+    history += fmt::format(FMT_COMPILE("\t{}\n"), record.options.empty() ? "-" : record.options);
+    return utils::write_to_file(get_history_path().string(), history);
+}
+
+auto read_records() noexcept -> std::vector<BuildRecord> {
+    std::vector<BuildRecord> records{};
+
+    const auto& history = utils::read_whole_file(get_history_path().string());
+    for (auto&& line : utils::make_multiline_view(history, '\n')) {
+        const auto& fields = utils::make_multiline_view(line, '\t');
+        /* clang-format off */
+        if (fields.size() != RECORD_FIELDS) { continue; }
+        /* clang-format on */
+
+        BuildRecord record{
+            .timestamp       = parse_number(fields[0]),
+            .cpus            = static_cast<std::uint32_t>(parse_number(fields[1])),
+            .mem_total_mib   = static_cast<std::uint64_t>(parse_number(fields[2])),
+            .succeeded       = fields[3] == "1",
+            .peak_memory_mib = static_cast<std::uint64_t>(parse_number(fields[4])),
+            .build_mode      = std::string{fields[5]},
+            .options         = std::string{fields.back()},
+        };
+        for (auto i = static_cast<std::size_t>(build_progress::Stage::fetch); i < static_cast<std::size_t>(build_progress::Stage::done); ++i) {
+            record.stage_seconds[i] = parse_number(fields[5 + i]);
+        }
+        records.emplace_back(std::move(record));
+    }
+    return records;
+}
+
+auto predict(const std::vector<BuildRecord>& records, std::string_view options, std::string_view build_mode,
+    std::uint32_t cpus, std::uint64_t mem_total_mib) noexcept -> std::optional<Prediction> {
+    std::vector<std::int64_t> host_samples{};
+    std::vector<std::int64_t> other_samples{};
+    for (auto record_it = records.rbegin(); record_it != records.rend(); ++record_it) {
+        /* clang-format off */
+        if (!record_it->succeeded || record_it->options != options || record_it->build_mode != build_mode) { continue; }
+        /* clang-format on */
+
+        const auto total_seconds = get_total_seconds(*record_it);
+        if (is_same_host(*record_it, cpus, mem_total_mib)) {
+            if (host_samples.size() < PREDICTION_SAMPLES) {
+                host_samples.emplace_back(total_seconds);
+            }
+        } else if (other_samples.size() < PREDICTION_SAMPLES && cpus > 0) {
+            // Compile dominates the build, it scales with the CPU count.
+            other_samples.emplace_back(total_seconds * record_it->cpus / cpus);
+        }
+    }
+
+    if (!host_samples.empty()) {
+        return Prediction{.seconds = average(host_samples), .sample_count = host_samples.size()};
+    } else if (!other_samples.empty()) {
+        return Prediction{.seconds = average(other_samples), .sample_count = other_samples.size(), .is_scaled = true};
+    }
+    return std::nullopt;
+}
+
+auto make_comparison(const std::vector<BuildRecord>& records) noexcept -> std::vector<ComparisonRow> {
+    struct Group {
+        ComparisonRow row{};
+        std::string options{};
+        std::vector<std::int64_t> total_seconds{};
+        std::vector<std::int64_t> compile_seconds{};
+    };
+
+    std::vector<Group> groups{};
+    for (const auto& record : records) {
+        const auto& host = format_host(record.cpus, record.mem_total_mib);
+        auto group_it    = std::ranges::find_if(groups, [&](auto&& group) {
+            return group.row.host == host && group.row.build_mode == record.build_mode && group.options == record.options;
+        });
+        if (group_it == groups.end()) {
+            groups.emplace_back(Group{.row = {.host = host, .build_mode = record.build_mode}, .options = record.options});
+            group_it = std::prev(groups.end());
+        }
+
+        ++group_it->row.build_count;
+        group_it->row.peak_memory_mib = std::max(group_it->row.peak_memory_mib, record.peak_memory_mib);
+        // Failed builds stopped somewhere in the middle, their durations would skew the average.
+        if (!record.succeeded) {
+            ++group_it->row.failed_count;
+            continue;
+        }
+        group_it->total_seconds.emplace_back(get_total_seconds(record));
+        group_it->compile_seconds.emplace_back(record.stage_seconds[static_cast<std::size_t>(build_progress::Stage::compile)]
+            + record.stage_seconds[static_cast<std::size_t>(build_progress::Stage::modules)]);
+    }
+
+    // Options are compared only between the groups of the same host, a value missing in a group counts as different.
+    std::map<std::string, std::map<std::string, std::vector<std::string>>> host_option_values{};
+    for (const auto& group : groups) {
+        for (auto&& option : utils::make_multiline_view(group.options, ' ')) {
+            host_option_values[group.row.host][std::string{get_option_name(option)}].emplace_back(option);
+        }
+    }
+
+    std::map<std::string, std::size_t> host_group_counts{};
+    for (const auto& group : groups) {
+        ++host_group_counts[group.row.host];
+    }
+
+    std::vector<ComparisonRow> rows{};
+    for (auto& group : groups) {
+        const auto host_groups = host_group_counts[group.row.host];
+        for (auto&& option : utils::make_multiline_view(group.options, ' ')) {
+            const auto& values = host_option_values[group.row.host][std::string{get_option_name(option)}];
+            const bool is_same = values.size() == host_groups && std::ranges::all_of(values, [&](auto&& value) { return value == values.front(); });
+            if (!is_same) {
+                group.row.options += fmt::format(FMT_COMPILE("{}{}"), group.row.options.empty() ? "" : " ", option);
+            }
+        }
+        group.row.avg_seconds         = average(group.total_seconds);
+        group.row.avg_compile_seconds = average(group.compile_seconds);
+        rows.emplace_back(std::move(group.row));
+    }
+
+    std::ranges::sort(rows, [](auto&& lhs, auto&& rhs) {
+        return (lhs.host != rhs.host) ? (lhs.host < rhs.host) : (lhs.avg_seconds < rhs.avg_seconds);
+    });
+    return rows;
+}
+
+}  // namespace build_history
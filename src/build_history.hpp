@@ -0,0 +1,89 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef BUILD_HISTORY_HPP
+#define BUILD_HISTORY_HPP
+
+#include "build_progress.hpp"
+
+#include <array>        // for array
+#include <cstddef>      // for size_t
+#include <cstdint>      // for int64_t, uint32_t, uint64_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Every finished build with its options, host and stage durations, kept in ~/.cache/cachyos-km/build-history.
+/// Used to predict duration of the next build and to compare option sets on a host.
+namespace build_history {
+
+struct BuildRecord {
+    std::int64_t timestamp{};
+    std::uint32_t cpus{};
+    std::uint64_t mem_total_mib{};
+    bool succeeded{};
+    // Peak memory of the build scope, 0 if the build didn't run in a scope.
+    std::uint64_t peak_memory_mib{};
+    // Build page features, which change the duration (e.g "incremental,ccache"), "clean" if none.
+    std::string build_mode{};
+    std::array<std::int64_t, build_progress::STAGE_COUNT> stage_seconds{};
+    // VAR=value of the options, space separated.
+    std::string options{};
+};
+
+struct Prediction {
+    std::int64_t seconds{};
+    std::size_t sample_count{};
+    // No build on this host, predicted from other hosts scaled by their CPU count.
+    bool is_scaled{};
+};
+
+struct ComparisonRow {
+    std::string host{};
+    std::string build_mode{};
+    // Only the options, which differ between the rows of the host.
+    std::string options{};
+    std::size_t build_count{};
+    std::size_t failed_count{};
+    std::int64_t avg_seconds{};
+    std::int64_t avg_compile_seconds{};
+    std::uint64_t peak_memory_mib{};
+};
+
+[[nodiscard]] auto get_history_path() noexcept -> const std::filesystem::path&;
+
+/// Converts VAR=value lines into the space separated form of the records.
+[[nodiscard]] auto normalize_options(std::string_view options_set) noexcept -> std::string;
+[[nodiscard]] auto get_total_seconds(const BuildRecord& record) noexcept -> std::int64_t;
+[[nodiscard]] auto format_host(std::uint32_t cpus, std::uint64_t mem_total_mib) noexcept -> std::string;
+
+bool append_record(const BuildRecord& record) noexcept;
+[[nodiscard]] auto read_records() noexcept -> std::vector<BuildRecord>;
+
+/// Averages the last successful builds of the options and mode, preferably from this host.
+[[nodiscard]] auto predict(const std::vector<BuildRecord>& records, std::string_view options, std::string_view build_mode,
+    std::uint32_t cpus, std::uint64_t mem_total_mib) noexcept -> std::optional<Prediction>;
+
+/// Groups the records by host, build mode and options.
+[[nodiscard]] auto make_comparison(const std::vector<BuildRecord>& records) noexcept -> std::vector<ComparisonRow>;
+
+}  // namespace build_history
+
+#endif  // BUILD_HISTORY_HPP
@@ -0,0 +1,318 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "build_pipeline.hpp"
+#include "binary_cache.hpp"
+#include "build_queue.hpp"
+#include "kernel_pgo.hpp"
+#include "tmpfs_builddir.hpp"
+#include "tree_cache.hpp"
+
+#include <array>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using build_pipeline::MAKEPKG_FLAGS;
+
+// Kconfig output of the kept tree, relative to $srcdir (/* is the kernel directory). It's never synced,
+// so syncconfig sees the new .config and touches include/config/ for the changed symbols.
+constexpr std::array KCONFIG_OUTPUT_DIRS{"/*/include/config/", "/*/include/generated/"};
+
+// Lists the files of the tree sorted, NUL separated. The Kconfig output of a kept tree isn't listed.
+auto make_list_files_command(std::string_view dir_path, std::string_view list_path) noexcept -> std::string {
+    using build_pipeline::shell_quote;
+    return fmt::format(FMT_COMPILE("(cd {} && find . -path './*/include/config' -prune -o -path './*/include/generated' -prune -o ! -type d -print0 "
+                                   "| LC_ALL=C sort -z) > {}"),
+        shell_quote(dir_path), shell_quote(list_path));
+}
+
+void append_build_commands(const build_pipeline::BuildSettings& settings, std::vector<std::string>& commands) noexcept {
+    using build_pipeline::shell_quote;
+
+    const bool is_split_build = !settings.tree_key.empty() || settings.incremental || !settings.thinlto_cache_dir.empty() || !settings.job_id.empty()
+        || !settings.kconfig_symbols.empty() || settings.keep_vmlinux;
+    if (!is_split_build) {
+        commands.emplace_back(fmt::format(FMT_COMPILE("makepkg -sicf --cleanbuild {}"), MAKEPKG_FLAGS));
+        return;
+    }
+
+    const auto& state     = shell_quote(settings.state_path);
+    const auto& build_env = settings.incremental ? fmt::format(FMT_COMPILE("BUILDDIR={} "), shell_quote(settings.builddir)) : std::string{};
+    if (settings.resume) {
+        // Fetch, extract and prepare() were done by the interrupted run, its tree must still be there.
+        commands.emplace_back(fmt::format(FMT_COMPILE("test -d {}"), shell_quote(settings.srcdir)));
+    } else if (settings.incremental && settings.clean_build && settings.tree_key.empty()) {
+        // Nothing to sync, prepare directly in the kept location.
+        commands.emplace_back(fmt::format(FMT_COMPILE("rm -f {}"), state));
+        commands.emplace_back(fmt::format(FMT_COMPILE("{}makepkg -sof --cleanbuild {}"), build_env, MAKEPKG_FLAGS));
+    } else {
+        build_pipeline::append_prepare_commands(settings.srcdir, settings.tree_key, tree_cache::has_snapshot(settings.tree_key), commands);
+    }
+
+    const auto& srcdir      = shell_quote(settings.srcdir);
+    const auto& work_srcdir = shell_quote(settings.work_srcdir);
+    if (settings.incremental && settings.clean_build && !settings.tree_key.empty()) {
+        commands.emplace_back(fmt::format(FMT_COMPILE("rm -rf {} {} {}"), state, shell_quote(settings.files_path), work_srcdir));
+        commands.emplace_back(fmt::format(FMT_COMPILE("mkdir -p {}"), shell_quote(fs::path{settings.work_srcdir}.parent_path().string())));
+        commands.emplace_back(fmt::format(FMT_COMPILE("cp -a --reflink=auto {} {}"), srcdir, work_srcdir));
+        commands.emplace_back(make_list_files_command(settings.work_srcdir, settings.files_path));
+    } else if (settings.incremental && settings.clean_build) {
+        // Prepared directly in the kept location.
+        commands.emplace_back(make_list_files_command(settings.work_srcdir, settings.files_path));
+    } else if (settings.incremental) {
+        commands.emplace_back(build_pipeline::make_sync_command(settings.srcdir, settings.work_srcdir, settings.files_path));
+    }
+
+    if (!settings.job_id.empty() && !settings.resume) {
+        commands.emplace_back(fmt::format(FMT_COMPILE("echo prepared > {}"), shell_quote(build_queue::get_stage_path(settings.job_id).string())));
+    }
+
+    if (!settings.thinlto_cache_dir.empty()) {
+        // kbuild passes --thinlto-cache-dir=.thinlto-cache, which would be removed together with the tree.
+        const auto& build_srcdir = settings.incremental ? settings.work_srcdir : settings.srcdir;
+        const auto& cache_link   = (fs::path{build_srcdir} / settings.kernel_srcname / ".thinlto-cache").string();
+        commands.emplace_back(fmt::format(FMT_COMPILE("mkdir -p {}"), shell_quote(settings.thinlto_cache_dir)));
+        commands.emplace_back(fmt::format(FMT_COMPILE("rm -rf {}"), shell_quote(cache_link)));
+        commands.emplace_back(fmt::format(FMT_COMPILE("ln -s {} {}"), shell_quote(settings.thinlto_cache_dir), shell_quote(cache_link)));
+    }
+
+    if (!settings.kconfig_symbols.empty()) {
+        // .config is then newer than auto.conf, kbuild runs syncconfig with the compiler of build().
+        const auto& build_srcdir = settings.incremental ? settings.work_srcdir : settings.srcdir;
+        const auto& kernel_dir   = shell_quote((fs::path{build_srcdir} / settings.kernel_srcname).string());
+        std::string enable_args{};
+        for (const auto& symbol : settings.kconfig_symbols) {
+            // syncconfig would drop a symbol unknown to this kernel silently.
+            commands.emplace_back(fmt::format(FMT_COMPILE("{{ grep -rqx --include='Kconfig*' 'config {1}' {0}/arch {0}/init "
+                                                          "|| {{ echo 'CONFIG_{1} is not supported by this kernel'; false; }}; }}"),
+                kernel_dir, symbol));
+            enable_args += fmt::format(FMT_COMPILE(" -e {}"), symbol);
+        }
+        commands.emplace_back(fmt::format(FMT_COMPILE("{0}/scripts/config --file {0}/.config{1}"), kernel_dir, enable_args));
+    }
+
+    if (settings.incremental) {
+        // -c would remove $BUILDDIR/$pkgbase with the kept tree, only the package directory is dropped.
+        commands.emplace_back(fmt::format(FMT_COMPILE("{}makepkg -sif --noextract {}"), build_env, MAKEPKG_FLAGS));
+        commands.emplace_back(fmt::format(FMT_COMPILE("rm -rf {}"), shell_quote((fs::path{settings.work_srcdir}.parent_path() / "pkg").string())));
+        commands.emplace_back(fmt::format(FMT_COMPILE("mv {} {}"), shell_quote(settings.pending_state_path), state));
+    } else {
+        commands.emplace_back(fmt::format(FMT_COMPILE("makepkg -sicf --noextract {}"), MAKEPKG_FLAGS));
+    }
+
+    if (settings.keep_vmlinux) {
+        // package() strips vmlinux of the headers package, the one of the tree still has the debug info.
+        const auto& build_srcdir = settings.incremental ? settings.work_srcdir : settings.srcdir;
+        commands.emplace_back(kernel_pgo::make_keep_vmlinux_command((fs::path{build_srcdir} / settings.kernel_srcname).string()));
+    }
+}
+
+// Collects the packages listed by makepkg into __km_pkgs, the debug package may be missing.
+constexpr std::string_view COLLECT_PACKAGES_COMMAND = "__km_pkgs=(); while IFS= read -r __km_pkg; do "
+                                                      "if [ -f \"$__km_pkg\" ]; then __km_pkgs+=(\"$__km_pkg\"); fi; "
+                                                      "done < <(makepkg --packagelist)";
+
+void append_chroot_commands(const build_pipeline::BuildSettings& settings, std::vector<std::string>& commands) noexcept {
+    using build_pipeline::shell_quote;
+
+    // Keep the base chroot up to date, working copies are made from it.
+    const auto& root_path = shell_quote((fs::path{settings.chroot_dir} / "root").string());
+    commands.emplace_back(fmt::format(FMT_COMPILE("if [ -f {0}/.arch-chroot ]; then arch-nspawn {0} pacman -Syu --noconfirm; "
+                                                  "else mkdir -p {1} && mkarchroot {0} base-devel; fi"),
+        root_path, shell_quote(settings.chroot_dir)));
+
+    // -c recreates the working copy, makechrootpkg skips integrity checks itself.
+    commands.emplace_back(fmt::format(FMT_COMPILE("makechrootpkg -c -r {}"), shell_quote(settings.chroot_dir)));
+
+    // Install what has been built.
+    commands.emplace_back(fmt::format(FMT_COMPILE("{{ {}; sudo pacman -U -- \"${{__km_pkgs[@]}}\"; }}"), COLLECT_PACKAGES_COMMAND));
+}
+
+void append_publish_commands(const build_pipeline::BuildSettings& settings, std::vector<std::string>& commands) noexcept {
+    commands.emplace_back(fmt::format(FMT_COMPILE("{{ {}; {}; }}"), COLLECT_PACKAGES_COMMAND, binary_cache::make_publish_command(settings.publish_dir)));
+}
+
+void append_repo_commands(const build_pipeline::BuildSettings& settings, std::vector<std::string>& commands) noexcept {
+    using build_pipeline::shell_quote;
+
+    // -R drops the files of the replaced versions from the repository.
+    const auto& repo_dir = shell_quote(settings.repo_dir);
+    commands.emplace_back(fmt::format(FMT_COMPILE("{{ {0}; mkdir -p {1} && cp -- \"${{__km_pkgs[@]}}\" {1}/ && (cd {1} && repo-add -R {2} \"${{__km_pkgs[@]##*/}}\"); }}"),
+        COLLECT_PACKAGES_COMMAND, repo_dir, shell_quote(settings.repo_db_path)));
+}
+
+auto make_export_command(const build_pipeline::BuildSettings& settings) noexcept -> std::string {
+    /* clang-format off */
+    if (settings.environment.empty() && settings.path_prefixes.empty() && settings.ram_builddir.empty() && settings.job_id.empty()) { return {}; }
+    /* clang-format on */
+
+    std::string result{"export"};
+    for (const auto& [name, value] : settings.environment) {
+        result += fmt::format(FMT_COMPILE(" {}={}"), name, build_pipeline::shell_quote(value));
+    }
+    if (!settings.ram_builddir.empty()) {
+        result += fmt::format(FMT_COMPILE(" BUILDDIR={}"), build_pipeline::shell_quote(settings.ram_builddir));
+    } else if (!settings.job_id.empty()) {
+        result += fmt::format(FMT_COMPILE(" BUILDDIR={}"), build_pipeline::shell_quote(build_queue::get_builddir_path(settings.job_id).string()));
+    }
+    if (!settings.path_prefixes.empty()) {
+        result += " PATH=";
+        for (const auto& path_prefix : settings.path_prefixes) {
+            result += fmt::format(FMT_COMPILE("{}:"), build_pipeline::shell_quote(path_prefix));
+        }
+        result += "\"$PATH\"";
+    }
+    return result;
+}
+
+}  // namespace
+
+namespace build_pipeline {
+
+auto join_commands(const std::vector<std::string>& commands) noexcept -> std::string {
+    std::string result{};
+    for (const auto& command : commands) {
+        if (!result.empty()) {
+            result += " && ";
+        }
+        result += command;
+    }
+    return result;
+}
+
+void append_prepare_commands(std::string_view srcdir_path, std::string_view tree_key, bool use_snapshot, std::vector<std::string>& commands) noexcept {
+    if (tree_key.empty()) {
+        commands.emplace_back(fmt::format(FMT_COMPILE("makepkg -sof --cleanbuild {}"), MAKEPKG_FLAGS));
+        return;
+    }
+
+    const auto& srcdir        = shell_quote(srcdir_path);
+    const auto& snapshot_path = tree_cache::get_snapshot_path(tree_key).string();
+    const auto& snapshot      = shell_quote(snapshot_path);
+    if (use_snapshot) {
+        // Start from the pristine copy, --noextract skips extraction and prepare().
+        // With reflinks the copy is almost free, otherwise it's still cheaper than extract+patch.
+        commands.emplace_back(fmt::format(FMT_COMPILE("rm -rf {}"), srcdir));
+        commands.emplace_back(fmt::format(FMT_COMPILE("mkdir -p {}"), shell_quote(fs::path{srcdir_path}.parent_path().string())));
+        commands.emplace_back(fmt::format(FMT_COMPILE("cp -a --reflink=auto {} {}"), snapshot, srcdir));
+        return;
+    }
+
+    // Extract and prepare only, then save the tree before anything is built in it.
+    const auto& snapshot_tmp = shell_quote(snapshot_path + ".tmp");
+    commands.emplace_back(fmt::format(FMT_COMPILE("makepkg -sof --cleanbuild {}"), MAKEPKG_FLAGS));
+    commands.emplace_back(fmt::format(FMT_COMPILE("mkdir -p {}"), shell_quote(tree_cache::get_trees_path().string())));
+    commands.emplace_back(fmt::format(FMT_COMPILE("rm -rf {}"), snapshot_tmp));
+    commands.emplace_back(fmt::format(FMT_COMPILE("cp -a --reflink=auto {} {}"), srcdir, snapshot_tmp));
+    commands.emplace_back(fmt::format(FMT_COMPILE("mv {} {}"), snapshot_tmp, snapshot));
+}
+
+auto shell_quote(std::string_view value) noexcept -> std::string {
+    std::string result{"'"};
+    for (const char ch : value) {
+        if (ch == '\'') {
+            result += "'\\''";
+        } else {
+            result += ch;
+        }
+    }
+    result += '\'';
+    return result;
+}
+
+auto make_sync_command(std::string_view srcdir_path, std::string_view work_srcdir_path, std::string_view files_path) noexcept -> std::string {
+    const auto& files       = shell_quote(files_path);
+    const auto& new_files   = shell_quote(fmt::format(FMT_COMPILE("{}.new"), files_path));
+    const auto& work_srcdir = shell_quote(work_srcdir_path);
+
+    std::vector<std::string> commands{};
+    commands.emplace_back(make_list_files_command(srcdir_path, fmt::format(FMT_COMPILE("{}.new"), files_path)));
+    // Gone from the prepared tree, e.g added by a dropped patch. Without a list from the previous sync nothing is known to be stale.
+    commands.emplace_back(fmt::format(FMT_COMPILE("{{ ! test -f {0} || LC_ALL=C comm -z -23 {0} {1} | (cd {2} && xargs -0 -r rm -f --); }}"), files, new_files,
+        work_srcdir));
+
+    // Copy only files with different content, they get the current mtime and kbuild rebuilds their dependents.
+    // Without --delete, the build outputs in the kept tree aren't touched.
+    std::string exclude_args{};
+    for (const auto& dir : KCONFIG_OUTPUT_DIRS) {
+        exclude_args += fmt::format(FMT_COMPILE(" --exclude='{}'"), dir);
+    }
+    commands.emplace_back(fmt::format(FMT_COMPILE("rsync -rlpc{} {}/ {}/"), exclude_args, shell_quote(srcdir_path), work_srcdir));
+    commands.emplace_back(fmt::format(FMT_COMPILE("mv -f {} {}"), new_files, files));
+    return join_commands(commands);
+}
+
+auto make_build_command(const BuildSettings& settings) noexcept -> std::string {
+    std::vector<std::string> commands{};
+    if (auto&& export_command = make_export_command(settings); !export_command.empty()) {
+        commands.emplace_back(std::move(export_command));
+    }
+    if (!settings.notice.empty()) {
+        commands.emplace_back(fmt::format(FMT_COMPILE("echo {}"), shell_quote(settings.notice)));
+    }
+    if (!settings.cached_entry.empty()) {
+        commands.emplace_back(fmt::format(FMT_COMPILE("{{ {} && sudo pacman -U -- \"${{__km_pkgs[@]}}\"; }}; __km_status=$?; rm -rf \"$__km_fetch_dir\"; (exit $__km_status)"),
+            binary_cache::make_fetch_command(settings.cached_entry)));
+        return join_commands(commands);
+    }
+
+    if (!settings.ram_builddir.empty()) {
+        // Created only now, a build which doesn't start leaves nothing in memory. It's removed also when
+        // the shell is killed, e.g with the terminal. Stale ones of a crashed session are removed by tmpfs_builddir.
+        // The reused tree is copied into $BUILDDIR/$pkgbase/src, makepkg would create it only later.
+        commands.emplace_back(tmpfs_builddir::make_create_command(settings.ram_builddir));
+        commands.emplace_back(fmt::format(FMT_COMPILE("trap {} EXIT && trap 'exit 1' HUP INT TERM"),
+            shell_quote(fmt::format(FMT_COMPILE("rm -rf -- {}"), shell_quote(settings.ram_builddir)))));
+        commands.emplace_back(fmt::format(FMT_COMPILE("mkdir -p {}"), shell_quote(fs::path{settings.srcdir}.parent_path().string())));
+    } else if (!settings.job_id.empty()) {
+        // Held until the shell exits, the job must not be resumed while it's still running.
+        commands.emplace_back(fmt::format(FMT_COMPILE("exec 9>>{} && flock -n 9"), shell_quote(build_queue::get_lock_path(settings.job_id).string())));
+        commands.emplace_back(fmt::format(FMT_COMPILE("mkdir -p {}"), shell_quote(fs::path{settings.srcdir}.parent_path().string())));
+    }
+    if (!settings.chroot_dir.empty()) {
+        append_chroot_commands(settings, commands);
+    } else {
+        append_build_commands(settings, commands);
+    }
+    if (!settings.publish_dir.empty()) {
+        append_publish_commands(settings, commands);
+    }
+    if (!settings.repo_db_path.empty()) {
+        append_repo_commands(settings, commands);
+    }
+    if (!settings.job_id.empty()) {
+        commands.emplace_back(fmt::format(FMT_COMPILE("echo done > {}"), shell_quote(build_queue::get_stage_path(settings.job_id).string())));
+    }
+    /* clang-format off */
+    if (settings.ram_builddir.empty()) { return join_commands(commands); }
+    /* clang-format on */
+
+    // Free the memory also when the build fails, the exit status is kept.
+    return fmt::format(FMT_COMPILE("{{ {}; }}; __km_status=$?; rm -rf {}; (exit $__km_status)"), join_commands(commands),
+        shell_quote(settings.ram_builddir));
+}
+
+}  // namespace build_pipeline
@@ -0,0 +1,107 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef BUILD_PIPELINE_HPP
+#define BUILD_PIPELINE_HPP
+
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <utility>      // for pair
+#include <vector>       // for vector
+
+/// Builds the shell command, which is executed in the PKGBUILD directory by the terminal helper.
+namespace build_pipeline {
+
+struct BuildSettings {
+    // $srcdir of makepkg, where the sources are extracted.
+    std::string srcdir{};
+    // Key of the pristine tree snapshot (see tree_cache), empty if the tree must not be reused.
+    std::string tree_key{};
+
+    // Incremental mode (see incremental_build), the prepared tree is synced into work_srcdir
+    // and built there with BUILDDIR=builddir.
+    bool incremental{};
+    bool clean_build{true};
+    std::string builddir{};
+    std::string work_srcdir{};
+    // State of this build, moved over state_path when the build succeeds.
+    std::string pending_state_path{};
+    std::string state_path{};
+    // Files of the prepared tree in work_srcdir, only they are deleted when gone from the next prepared tree.
+    std::string files_path{};
+    // Printed before the build starts.
+    std::string notice{};
+
+    // BUILDDIR on a tmpfs (see tmpfs_builddir), removed after the build whatever its result. Empty to build on disk.
+    std::string ram_builddir{};
+
+    // Resumable job (see build_queue), built in its BUILDDIR. Its stage is updated once the tree is prepared
+    // and once the build is done. With resume the prepared tree is built as is, without fetch, extract and prepare().
+    std::string job_id{};
+    bool resume{};
+
+    // Exported for every command of the build.
+    std::vector<std::pair<std::string, std::string>> environment{};
+    // Prepended to PATH in this order, e.g compiler and linker wrappers.
+    std::vector<std::string> path_prefixes{};
+
+    // Clean chroot (see clean_chroot), the build runs in a working copy of the base chroot
+    // and the built packages are installed afterwards. Empty to build on the host.
+    std::string chroot_dir{};
+
+    // Entry of the binary cache (see binary_cache), its packages are installed instead of building
+    // once the signed manifest is checked.
+    std::string cached_entry{};
+    // Entry of the binary cache, the built packages are published there when the build succeeds.
+    std::string publish_dir{};
+    // Local pacman repository (see local_repo), the built packages are copied there and added with repo-add.
+    std::string repo_dir{};
+    std::string repo_db_path{};
+
+    // Persistent ThinLTO cache, linked into the kernel tree ($srcdir/kernel_srcname) before build().
+    std::string thinlto_cache_dir{};
+    std::string kernel_srcname{};
+    // Kconfig symbols enabled in .config of the kernel tree before build(), e.g for profile-guided builds (see kernel_pgo).
+    std::vector<std::string> kconfig_symbols{};
+    // Profiling build (see kernel_pgo), vmlinux of the kernel tree is kept once the build succeeds.
+    bool keep_vmlinux{};
+};
+
+/// makepkg flags of every build, the sources are verified by the source cache.
+inline constexpr std::string_view MAKEPKG_FLAGS = "--skipchecksums";
+
+/// Quotes the value for POSIX shell.
+[[nodiscard]] auto shell_quote(std::string_view value) noexcept -> std::string;
+
+/// Joins the commands with &&, the first failed one stops the rest.
+[[nodiscard]] auto join_commands(const std::vector<std::string>& commands) noexcept -> std::string;
+
+/// Appends the commands, which prepare the tree in srcdir_path: extract and prepare() with makepkg,
+/// or copy the snapshot of the tree key (see tree_cache) if use_snapshot. A new snapshot is saved after prepare().
+void append_prepare_commands(std::string_view srcdir_path, std::string_view tree_key, bool use_snapshot, std::vector<std::string>& commands) noexcept;
+
+/// Shell command, which syncs the prepared tree in srcdir_path into the kept tree of an incremental build.
+/// Only files with different content are copied, unchanged files keep their mtime. Files of the previous
+/// prepared tree (listed in files_path) gone from this one are deleted, build outputs never are in the list.
+[[nodiscard]] auto make_sync_command(std::string_view srcdir_path, std::string_view work_srcdir_path, std::string_view files_path) noexcept -> std::string;
+
+[[nodiscard]] auto make_build_command(const BuildSettings& settings) noexcept -> std::string;
+
+}  // namespace build_pipeline
+
+#endif  // BUILD_PIPELINE_HPP
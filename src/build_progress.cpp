@@ -0,0 +1,296 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "build_progress.hpp"
+#include "build_pipeline.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using build_progress::Stage;
+
+auto get_reference_path() noexcept -> fs::path {
+    return build_progress::get_log_path().parent_path() / "build-progress";
+}
+
+auto parse_number(std::string_view value) noexcept -> std::int64_t {
+    std::int64_t result{};
+    std::from_chars(value.data(), value.data() + value.size(), result);
+    return result;
+}
+
+auto stage_index(Stage stage) noexcept -> std::size_t {
+    return static_cast<std::size_t>(stage);
+}
+
+// Drops the colors of makepkg (CSI sequences and "ESC ( B" of tput sgr0) and carriage returns.
+auto strip_terminal_escapes(std::string_view line) noexcept -> std::string {
+    std::string result{};
+    for (std::size_t i = 0; i < line.size(); ++i) {
+        const char ch = line[i];
+        if (ch == '\x1b' && i + 1 < line.size() && line[i + 1] == '[') {
+            i += 2;
+            while (i < line.size() && (line[i] < '\x40' || line[i] > '\x7e')) {
+                ++i;
+            }
+        } else if (ch == '\x1b' && i + 1 < line.size() && (line[i + 1] == '(' || line[i + 1] == ')')) {
+            i += 2;
+        } else if (ch != '\r' && ch != '\x1b') {
+            result += ch;
+        }
+    }
+    return result;
+}
+
+auto parse_makepkg_stage(std::string_view message) noexcept -> Stage {
+    if (message.starts_with("Retrieving sources")) {
+        return Stage::fetch;
+    } else if (message.starts_with("Extracting sources")) {
+        return Stage::extract;
+    } else if (message.starts_with("Starting prepare()")) {
+        return Stage::prepare;
+    } else if (message.starts_with("Starting build()")) {
+        return Stage::compile;
+    } else if (message.starts_with("Entering fakeroot environment") || message.starts_with("Starting package")) {
+        return Stage::package;
+    } else if (message.starts_with("Finished making")) {
+        return Stage::done;
+    }
+    return Stage::none;
+}
+
+void advance_stage(build_progress::ProgressState& state, Stage stage, std::int64_t now) noexcept {
+    /* clang-format off */
+    if (stage <= state.stage) { return; }
+    /* clang-format on */
+    if (state.stage != Stage::none) {
+        state.stage_seconds[stage_index(state.stage)] += now - state.stage_started;
+    }
+    state.stage         = stage;
+    state.stage_started = now;
+}
+
+auto estimate_remaining(const build_progress::ProgressState& state, const build_progress::Reference& reference, std::int64_t now) noexcept -> std::int64_t {
+    const auto elapsed = now - state.stage_started;
+
+    // Compile time is proportional to the objects, other stages take about as long as the last time.
+    std::int64_t remaining{};
+    if (state.stage == Stage::compile && state.compiled_objects > 0 && reference.compiled_objects > state.compiled_objects) {
+        const auto objects_left = static_cast<std::int64_t>(reference.compiled_objects - state.compiled_objects);
+        remaining               = elapsed * objects_left / static_cast<std::int64_t>(state.compiled_objects);
+    } else {
+        remaining = std::max<std::int64_t>(reference.stage_seconds[stage_index(state.stage)] - elapsed, 0);
+    }
+    for (auto i = stage_index(state.stage) + 1; i < stage_index(Stage::done); ++i) {
+        remaining += reference.stage_seconds[i];
+    }
+    return remaining;
+}
+
+}  // namespace
+
+namespace build_progress {
+
+auto get_log_path() noexcept -> const fs::path& {
+    static const fs::path log_path = utils::fix_path("~/.cache/cachyos-km/build.log");
+    return log_path;
+}
+
+bool is_available() noexcept {
+    std::error_code err_code{};
+    return fs::exists("/usr/bin/script", err_code);
+}
+
+auto wrap_command(std::string_view command) noexcept -> std::string {
+    // script runs the command with $SHELL, which may not be bash. -e keeps the exit status, -f flushes every write.
+    return fmt::format(FMT_COMPILE("mkdir -p {} && SHELL=/usr/bin/bash script -qfec {} {}"),
+        build_pipeline::shell_quote(get_log_path().parent_path().string()), build_pipeline::shell_quote(command),
+        build_pipeline::shell_quote(get_log_path().string()));
+}
+
+auto format_duration(std::int64_t seconds) noexcept -> std::string {
+    if (seconds >= 3600) {
+        return fmt::format(FMT_COMPILE("{}:{:02}:{:02}"), seconds / 3600, (seconds / 60) % 60, seconds % 60);
+    }
+    return fmt::format(FMT_COMPILE("{}:{:02}"), seconds / 60, seconds % 60);
+}
+
+auto get_stage_name(Stage stage) noexcept -> std::string_view {
+    switch (stage) {
+    case Stage::fetch:
+        return "fetch";
+    case Stage::extract:
+        return "extract";
+    case Stage::prepare:
+        return "prepare";
+    case Stage::config:
+        return "config";
+    case Stage::compile:
+        return "compile";
+    case Stage::modules:
+        return "modules";
+    case Stage::package:
+        return "package";
+    case Stage::done:
+        return "done";
+    default:
+        break;
+    }
+    return "waiting";
+}
+
+void parse_line(ProgressState& state, std::string_view line, std::int64_t now) noexcept {
+    const auto text_pos = line.find_first_not_of(' ');
+    /* clang-format off */
+    if (text_pos == std::string_view::npos) { return; }
+    /* clang-format on */
+    const auto& text = line.substr(text_pos);
+
+    if (text.starts_with("==> ")) {
+        advance_stage(state, parse_makepkg_stage(text.substr(4)), now);
+        return;
+    }
+
+    // prepare() of the CachyOS PKGBUILDs, other PKGBUILDs run kconfig directly.
+    if (state.stage == Stage::prepare && (text.starts_with("Setting config") || text.find("scripts/kconfig/") != std::string_view::npos)) {
+        advance_stage(state, Stage::config, now);
+        return;
+    }
+
+    /* clang-format off */
+    if (state.stage != Stage::compile && state.stage != Stage::modules) { return; }
+    /* clang-format on */
+    if (text.starts_with("CC ")) {
+        ++state.compiled_objects;
+    } else if (text.starts_with("LD [M]")) {
+        ++state.linked_modules;
+    } else if (text.starts_with("MODPOST")) {
+        // vmlinux is linked, what follows is the final link of the modules.
+        advance_stage(state, Stage::modules, now);
+    }
+}
+
+void update(ProgressState& state, std::int64_t now) noexcept {
+    auto* log_file = std::fopen(get_log_path().c_str(), "rb");
+    /* clang-format off */
+    if (log_file == nullptr) { return; }
+    /* clang-format on */
+
+    std::string chunk{std::move(state.partial_line)};
+    state.partial_line.clear();
+    if (std::fseek(log_file, static_cast<long>(state.log_offset), SEEK_SET) == 0) {
+        std::array<char, 65536> buffer{};
+        std::size_t read_bytes{};
+        while ((read_bytes = std::fread(buffer.data(), 1, buffer.size(), log_file)) > 0) {
+            chunk.append(buffer.data(), read_bytes);
+            state.log_offset += read_bytes;
+            state.last_output = now;
+        }
+    }
+    std::fclose(log_file);
+
+    // The last line may still be written.
+    std::string_view pending{chunk};
+    for (auto newline_pos = pending.find('\n'); newline_pos != std::string_view::npos; newline_pos = pending.find('\n')) {
+        parse_line(state, strip_terminal_escapes(pending.substr(0, newline_pos)), now);
+        pending.remove_prefix(newline_pos + 1);
+    }
+    state.partial_line = std::string{pending};
+}
+
+void finish(ProgressState& state) noexcept {
+    /* clang-format off */
+    if (state.is_finished) { return; }
+    /* clang-format on */
+    state.is_finished = true;
+    if (state.stage != Stage::none && state.stage != Stage::done) {
+        state.stage_seconds[stage_index(state.stage)] += std::max<std::int64_t>(state.last_output - state.stage_started, 0);
+    }
+}
+
+bool write_reference(const ProgressState& state) noexcept {
+    auto reference = fmt::format(FMT_COMPILE("{}"), state.compiled_objects);
+    for (auto i = stage_index(Stage::fetch); i < stage_index(Stage::done); ++i) {
+        reference += fmt::format(FMT_COMPILE("\t{}"), state.stage_seconds[i]);
+    }
+    reference += '\n';
+    return utils::write_to_file(get_reference_path().string(), reference);
+}
+
+auto read_reference() noexcept -> std::optional<Reference> {
+    const auto& content = utils::read_whole_file(get_reference_path().string());
+    const auto& fields  = utils::make_multiline_view(std::string_view{content}.substr(0, content.find('\n')), '\t');
+    if (fields.size() != stage_index(Stage::done)) {
+        return std::nullopt;
+    }
+
+    Reference reference{.compiled_objects = static_cast<std::size_t>(parse_number(fields[0]))};
+    for (auto i = stage_index(Stage::fetch); i < stage_index(Stage::done); ++i) {
+        reference.stage_seconds[i] = parse_number(fields[i]);
+    }
+    return reference;
+}
+
+auto format_progress(const ProgressState& state, const std::optional<Reference>& reference, std::int64_t now) noexcept -> std::string {
+    std::string result{};
+    if (state.is_finished && state.stage != Stage::done) {
+        result = fmt::format(FMT_COMPILE("stopped in {}"), get_stage_name(state.stage));
+    } else if (!state.is_finished) {
+        result = fmt::format(FMT_COMPILE("{} {}"), get_stage_name(state.stage), format_duration(now - state.stage_started));
+        if (state.stage == Stage::compile || state.stage == Stage::modules) {
+            result += fmt::format(FMT_COMPILE(", {} objects"), state.compiled_objects);
+            if (reference && reference->compiled_objects > 0) {
+                const auto percent = std::min<std::size_t>(state.compiled_objects * 100 / reference->compiled_objects, 99);
+                result += fmt::format(FMT_COMPILE(" ({}%)"), percent);
+            }
+        }
+        if (state.stage == Stage::modules) {
+            result += fmt::format(FMT_COMPILE(", {} modules linked"), state.linked_modules);
+        }
+        if (reference && state.stage != Stage::none) {
+            result += fmt::format(FMT_COMPILE(", ETA {}"), format_duration(estimate_remaining(state, *reference, now)));
+        }
+    }
+
+    std::string finished_stages{};
+    // The current stage is complete only once the build has exited.
+    const auto last_stage = state.is_finished ? std::min(stage_index(state.stage) + 1, stage_index(Stage::done)) : stage_index(state.stage);
+    for (auto i = stage_index(Stage::fetch); i < last_stage; ++i) {
+        /* clang-format off */
+        if (state.stage_seconds[i] == 0) { continue; }
+        /* clang-format on */
+        finished_stages += fmt::format(FMT_COMPILE("{}{} {}"), finished_stages.empty() ? "" : ", ",
+            get_stage_name(static_cast<Stage>(i)), format_duration(state.stage_seconds[i]));
+    }
+    if (!result.empty() && !finished_stages.empty()) {
+        result += '\n';
+    }
+    result += finished_stages;
+    return result;
+}
+
+}  // namespace build_progress
@@ -0,0 +1,99 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef BUILD_PROGRESS_HPP
+#define BUILD_PROGRESS_HPP
+
+#include <array>        // for array
+#include <cstddef>      // for size_t
+#include <cstdint>      // for int64_t, uint8_t, uintmax_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+
+/// Progress of the running build, parsed from the output of makepkg and kbuild.
+///
+/// The build runs under script(1), which keeps the terminal interactive (e.g nconfig)
+/// and copies the output into ~/.cache/cachyos-km/build.log, read while the build runs.
+namespace build_progress {
+
+enum class Stage : std::uint8_t {
+    none,
+    fetch,
+    extract,
+    prepare,
+    config,
+    compile,
+    modules,
+    package,
+    done,
+};
+constexpr std::size_t STAGE_COUNT = static_cast<std::size_t>(Stage::done) + 1;
+
+struct ProgressState {
+    Stage stage{Stage::none};
+    std::int64_t stage_started{};
+    // When the log last grew, the build may exit long before the terminal is closed.
+    std::int64_t last_output{};
+    // The build has exited, stage is where it ended.
+    bool is_finished{};
+    // Durations of the finished stages, in seconds.
+    std::array<std::int64_t, STAGE_COUNT> stage_seconds{};
+    // CC lines of kbuild, vmlinux and modules objects.
+    std::size_t compiled_objects{};
+    // LD [M] lines of kbuild.
+    std::size_t linked_modules{};
+
+    std::uintmax_t log_offset{};
+    std::string partial_line{};
+};
+
+/// Stage durations and object count of the previous complete build, used for the ETA.
+struct Reference {
+    std::array<std::int64_t, STAGE_COUNT> stage_seconds{};
+    std::size_t compiled_objects{};
+};
+
+[[nodiscard]] auto get_log_path() noexcept -> const std::filesystem::path&;
+[[nodiscard]] bool is_available() noexcept;
+
+/// Wraps the shell command, to copy its output into the log.
+[[nodiscard]] auto wrap_command(std::string_view command) noexcept -> std::string;
+
+[[nodiscard]] auto get_stage_name(Stage stage) noexcept -> std::string_view;
+/// Formats seconds as "m:ss", or "h:mm:ss" from an hour.
+[[nodiscard]] auto format_duration(std::int64_t seconds) noexcept -> std::string;
+
+/// Parses a single line of the output, with terminal escapes and carriage returns stripped.
+/// Stages only advance, e.g makepkg run again with --noextract doesn't go back to fetch.
+void parse_line(ProgressState& state, std::string_view line, std::int64_t now) noexcept;
+/// Parses what was appended to the log since the last call.
+void update(ProgressState& state, std::int64_t now) noexcept;
+/// Ends the current stage at the last output, once the build has exited.
+void finish(ProgressState& state) noexcept;
+
+bool write_reference(const ProgressState& state) noexcept;
+[[nodiscard]] auto read_reference() noexcept -> std::optional<Reference>;
+
+/// Formats the current stage with its elapsed time, object count and ETA, then the durations of the finished stages.
+[[nodiscard]] auto format_progress(const ProgressState& state, const std::optional<Reference>& reference, std::int64_t now) noexcept -> std::string;
+
+}  // namespace build_progress
+
+#endif  // BUILD_PROGRESS_HPP
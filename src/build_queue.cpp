@@ -0,0 +1,236 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+
+#include "build_queue.hpp"
+#include "build_progress.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#include <fcntl.h>     // for open
+#include <sys/file.h>  // for flock
+#include <unistd.h>    // for close
+
+namespace fs = std::filesystem;
+
+namespace {
+
+bool is_locked(const fs::path& lock_path) noexcept {
+    const std::int32_t lock_fd = open(lock_path.c_str(), O_RDONLY | O_CLOEXEC);
+    /* clang-format off */
+    if (lock_fd == -1) { return false; }
+    /* clang-format on */
+
+    const bool is_held = flock(lock_fd, LOCK_SH | LOCK_NB) != 0 && errno == EWOULDBLOCK;
+    close(lock_fd);
+    return is_held;
+}
+
+auto load_job(const fs::path& job_path) noexcept -> std::optional<build_queue::Job> {
+    const auto& content = utils::read_whole_file((job_path / "job").string());
+    /* clang-format off */
+    if (content.empty()) { return std::nullopt; }
+    /* clang-format on */
+
+    // "<kind> <value>" per line
+    build_queue::Job job{.id = job_path.filename().string()};
+    for (auto&& line : utils::make_multiline_view(content, '\n')) {
+        const auto space_pos = line.find(' ');
+        /* clang-format off */
+        if (space_pos == std::string_view::npos) { continue; }
+        /* clang-format on */
+
+        const auto& kind  = line.substr(0, space_pos);
+        const auto& value = line.substr(space_pos + 1);
+        if (kind == "label") {
+            job.label = std::string{value};
+        } else if (kind == "pkgbuild_dir") {
+            job.pkgbuild_dir = std::string{value};
+        } else if (kind == "option") {
+            job.options_set += fmt::format(FMT_COMPILE("{}\n"), value);
+        } else if (kind == "revision") {
+            job.revision = std::string{value};
+        }
+    }
+    /* clang-format off */
+    if (job.pkgbuild_dir.empty()) { return std::nullopt; }
+    /* clang-format on */
+
+    const auto& stage = utils::read_whole_file(build_queue::get_stage_path(job.id).string());
+    if (stage.starts_with("done")) {
+        job.stage = build_queue::Stage::done;
+    } else if (stage.starts_with("prepared")) {
+        job.stage = build_queue::Stage::prepared;
+    }
+    job.is_running = is_locked(build_queue::get_lock_path(job.id));
+    return job;
+}
+
+}  // namespace
+
+namespace build_queue {
+
+auto get_queue_path() noexcept -> const fs::path& {
+    static const fs::path queue_path = utils::fix_path("~/.cache/cachyos-km/queue");
+    return queue_path;
+}
+
+auto get_job_path(std::string_view id) noexcept -> fs::path {
+    return get_queue_path() / id;
+}
+
+auto get_builddir_path(std::string_view id) noexcept -> fs::path {
+    return get_job_path(id) / "build";
+}
+
+auto get_stage_path(std::string_view id) noexcept -> fs::path {
+    return get_job_path(id) / "stage";
+}
+
+auto get_lock_path(std::string_view id) noexcept -> fs::path {
+    return get_job_path(id) / "lock";
+}
+
+auto get_makepkg_conf_dir_path(std::string_view id) noexcept -> fs::path {
+    return get_job_path(id) / "makepkg";
+}
+
+auto make_job_id(std::int64_t now) noexcept -> std::string {
+    return fmt::format(FMT_COMPILE("{:012}"), now);
+}
+
+auto get_stage_name(Stage stage) noexcept -> std::string_view {
+    switch (stage) {
+    case Stage::prepared:
+        return "prepared";
+    case Stage::done:
+        return "done";
+    default:
+        break;
+    }
+    return "not prepared";
+}
+
+bool create_job(const Job& job, std::string_view pkgbuild, std::string_view build_command, std::string_view resume_command) noexcept {
+    const auto& job_path = get_job_path(job.id);
+
+    std::error_code err_code{};
+    fs::create_directories(job_path, err_code);
+    if (err_code) {
+        fmt::print(stderr, "[BUILD_QUEUE] failed to create '{}': {}\n", job_path.string(), err_code.message());
+        return false;
+    }
+
+    auto content = fmt::format(FMT_COMPILE("label {}\npkgbuild_dir {}\n"), job.label, job.pkgbuild_dir);
+    if (!job.revision.empty()) {
+        content += fmt::format(FMT_COMPILE("revision {}\n"), job.revision);
+    }
+    for (auto&& option : utils::make_multiline_view(job.options_set, '\n')) {
+        content += fmt::format(FMT_COMPILE("option {}\n"), option);
+    }
+
+    // The job file goes last, a job without it is ignored.
+    return utils::write_to_file((job_path / "PKGBUILD").string(), pkgbuild)
+        && utils::write_to_file((job_path / "build.sh").string(), build_command)
+        && utils::write_to_file((job_path / "resume.sh").string(), resume_command)
+        && utils::write_to_file((job_path / "job").string(), content);
+}
+
+auto load_jobs() noexcept -> std::vector<Job> {
+    std::vector<Job> jobs{};
+    std::error_code err_code{};
+    for (const auto& dir_entry : fs::directory_iterator(get_queue_path(), err_code)) {
+        if (auto&& job = load_job(dir_entry.path())) {
+            jobs.emplace_back(std::move(*job));
+        }
+    }
+    std::ranges::sort(jobs, {}, &Job::id);
+    return jobs;
+}
+
+void remove_finished_jobs() noexcept {
+    for (const auto& job : load_jobs()) {
+        if (job.stage == Stage::done) {
+            remove_job(job.id);
+        }
+    }
+}
+
+void remove_job(std::string_view id) noexcept {
+    std::error_code err_code{};
+    fs::remove_all(get_job_path(id), err_code);
+    if (err_code) {
+        fmt::print(stderr, "[BUILD_QUEUE] failed to remove job {}: {}\n", id, err_code.message());
+    }
+}
+
+bool restore_checkout(const Job& job, const std::function<bool()>& is_cancelled) noexcept {
+    /* clang-format off */
+    if (job.revision.empty()) { return true; }
+    /* clang-format on */
+
+    // The next prepare checks out the branch again, a detached HEAD doesn't get in its way.
+    const std::vector<std::string> checkout_argv{"git", "-C", job.pkgbuild_dir, "checkout", "-q", "--force", "--detach", job.revision};
+    if (utils::run_cancellable(checkout_argv, is_cancelled) == 0) {
+        return true;
+    }
+    if (utils::run_cancellable({"git", "-C", job.pkgbuild_dir, "fetch", "-q", "--depth", "1", "origin", job.revision}, is_cancelled) != 0
+        || utils::run_cancellable(checkout_argv, is_cancelled) != 0) {
+        fmt::print(stderr, "[BUILD_QUEUE] failed to check out revision {} of job {}\n", job.revision, job.id);
+        return false;
+    }
+    return true;
+}
+
+bool restore_pkgbuild(const Job& job) noexcept {
+    const auto& pkgbuild = utils::read_whole_file((get_job_path(job.id) / "PKGBUILD").string());
+    /* clang-format off */
+    if (pkgbuild.empty()) { return false; }
+    /* clang-format on */
+    return utils::write_to_file((fs::path{job.pkgbuild_dir} / "PKGBUILD").string(), pkgbuild);
+}
+
+auto get_resume_command(const Job& job) noexcept -> std::optional<std::string> {
+    // A prepared tree saves fetch, extract and prepare(), kbuild then rebuilds only what is missing.
+    std::error_code err_code{};
+    const bool has_tree    = fs::is_directory(get_builddir_path(job.id), err_code);
+    const auto& file_name  = (job.stage == Stage::prepared && has_tree) ? "resume.sh" : "build.sh";
+    auto command           = utils::read_whole_file((get_job_path(job.id) / file_name).string());
+    /* clang-format off */
+    if (command.empty()) { return std::nullopt; }
+    /* clang-format on */
+    return command;
+}
+
+auto format_jobs(const std::vector<Job>& jobs, std::int64_t now) noexcept -> std::string {
+    std::string result{};
+    for (const auto& job : jobs) {
+        const auto created = std::strtoll(job.id.c_str(), nullptr, 10);
+        result += fmt::format(FMT_COMPILE("{}{}: {}{}, started {} ago"), result.empty() ? "" : "\n", job.label, get_stage_name(job.stage),
+            job.is_running ? ", still running" : "", build_progress::format_duration(now - created));
+    }
+    return result;
+}
+
+}  // namespace build_queue
@@ -0,0 +1,97 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+
+#ifndef BUILD_QUEUE_HPP
+#define BUILD_QUEUE_HPP
+
+#include <cstdint>      // for int64_t
+#include <filesystem>   // for path
+#include <functional>   // for function
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Builds persisted on disk, so a build lost with the terminal, the manager or the session can be resumed.
+///
+/// Layout of ~/.cache/cachyos-km/queue/<id>:
+///   job        inputs of the build, "<kind> <value>" per line
+///   PKGBUILD   the PKGBUILD as modified for the build, the checkout is reset by the next one
+///   makepkg/   makepkg.conf of the build (see makepkg_conf), the shared one is rewritten by the next build
+///   build.sh   command of the whole build
+///   resume.sh  command which continues in the prepared tree
+///   stage      "prepared" or "done", written by the build command
+///   lock       locked by the shell of the running build
+///   build/     BUILDDIR of the build
+namespace build_queue {
+
+enum class Stage {
+    queued,
+    prepared,
+    done,
+};
+
+struct Job {
+    // Seconds since epoch of the creation, zero padded so the ids sort by age.
+    std::string id{};
+    std::string label{};
+    // Absolute path of the PKGBUILD directory.
+    std::string pkgbuild_dir{};
+    // VAR=value lines.
+    std::string options_set{};
+    // Commit of the PKGBUILDs checkout the job was created from, empty for jobs of older versions.
+    std::string revision{};
+    Stage stage{Stage::queued};
+    // The shell of the build is still alive, e.g the manager was restarted while building.
+    bool is_running{};
+};
+
+[[nodiscard]] auto get_queue_path() noexcept -> const std::filesystem::path&;
+[[nodiscard]] auto get_job_path(std::string_view id) noexcept -> std::filesystem::path;
+[[nodiscard]] auto get_builddir_path(std::string_view id) noexcept -> std::filesystem::path;
+[[nodiscard]] auto get_stage_path(std::string_view id) noexcept -> std::filesystem::path;
+[[nodiscard]] auto get_lock_path(std::string_view id) noexcept -> std::filesystem::path;
+[[nodiscard]] auto get_makepkg_conf_dir_path(std::string_view id) noexcept -> std::filesystem::path;
+
+[[nodiscard]] auto make_job_id(std::int64_t now) noexcept -> std::string;
+[[nodiscard]] auto get_stage_name(Stage stage) noexcept -> std::string_view;
+
+/// Saves the job with its PKGBUILD and both commands, before the build is started.
+bool create_job(const Job& job, std::string_view pkgbuild, std::string_view build_command, std::string_view resume_command) noexcept;
+
+/// Jobs on disk, oldest first.
+[[nodiscard]] auto load_jobs() noexcept -> std::vector<Job>;
+/// Removes jobs, which have been built, together with their build directory.
+void remove_finished_jobs() noexcept;
+void remove_job(std::string_view id) noexcept;
+
+/// Checks out the revision of the job in the PKGBUILDs checkout, so files next to the PKGBUILD (config, local patches)
+/// are the ones the job was prepared with. The revision is fetched, if the shallow clone doesn't have it anymore.
+bool restore_checkout(const Job& job, const std::function<bool()>& is_cancelled = {}) noexcept;
+/// Puts the PKGBUILD of the job back into its directory.
+bool restore_pkgbuild(const Job& job) noexcept;
+/// Command which continues the job from its last finished stage, nothing if the job can't be resumed.
+[[nodiscard]] auto get_resume_command(const Job& job) noexcept -> std::optional<std::string>;
+
+/// One line per job with its label and stage.
+[[nodiscard]] auto format_jobs(const std::vector<Job>& jobs, std::int64_t now) noexcept -> std::string;
+
+}  // namespace build_queue
+
+#endif  // BUILD_QUEUE_HPP
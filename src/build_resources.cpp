@@ -0,0 +1,178 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "build_resources.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#include <sched.h>  // for sched_getaffinity
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Rough peak memory estimates, in KiB.
+constexpr std::uint64_t GIB_IN_KIB = 1024 * 1024;
+// kept for the desktop and the rest of the system
+constexpr std::uint64_t RESERVED_MEM = 2 * GIB_IN_KIB;
+constexpr std::uint64_t COMPILE_JOB_MEM = 1 * GIB_IN_KIB;
+// module (.ko) link with LTO code generation
+constexpr std::uint64_t THIN_LTO_LINK_MEM = 1 * GIB_IN_KIB;
+constexpr std::uint64_t FULL_LTO_LINK_MEM = 2 * GIB_IN_KIB;
+// vmlinux.o link, it runs while modules are still compiled and linked
+constexpr std::uint64_t THIN_LTO_VMLINUX_MEM = 4 * GIB_IN_KIB;
+constexpr std::uint64_t FULL_LTO_VMLINUX_MEM = 12 * GIB_IN_KIB;
+
+// Rough build directory sizes, in KiB. Objects include the debug info used for BTF.
+constexpr std::uint64_t SOURCE_TREE_SIZE         = 2 * GIB_IN_KIB;
+constexpr std::uint64_t OBJECTS_SIZE             = 16 * GIB_IN_KIB;
+constexpr std::uint64_t LOCALMODCFG_OBJECTS_SIZE = 4 * GIB_IN_KIB;
+constexpr std::uint64_t PACKAGE_SIZE             = 2 * GIB_IN_KIB;
+// vmlinux.o and the ThinLTO cache
+constexpr std::uint64_t THIN_LTO_EXTRA_SIZE = 4 * GIB_IN_KIB;
+constexpr std::uint64_t FULL_LTO_EXTRA_SIZE = 6 * GIB_IN_KIB;
+
+auto count_numa_nodes() noexcept -> std::uint32_t {
+    std::uint32_t nodes{};
+    std::error_code err_code{};
+    for (const auto& entry : fs::directory_iterator("/sys/devices/system/node", err_code)) {
+        const auto& name = entry.path().filename().string();
+        if (name.starts_with("node") && name.size() > 4 && std::isdigit(static_cast<unsigned char>(name[4]))) {
+            ++nodes;
+        }
+    }
+    return std::max(nodes, 1U);
+}
+
+auto read_meminfo_value(std::string_view meminfo, std::string_view key) noexcept -> std::uint64_t {
+    for (auto&& line : utils::make_multiline_view(meminfo, '\n')) {
+        /* clang-format off */
+        if (!line.starts_with(key) || line.substr(key.size(), 1) != ":") { continue; }
+        /* clang-format on */
+
+        // "MemAvailable:   12345678 kB"
+        auto value = line.substr(key.size() + 1);
+        value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+        std::uint64_t result{};
+        std::from_chars(value.data(), value.data() + value.size(), result);
+        return result;
+    }
+    return 0;
+}
+
+constexpr auto to_gib(std::uint64_t kib) noexcept -> double {
+    return static_cast<double>(kib) / static_cast<double>(GIB_IN_KIB);
+}
+
+// Jobs of job_mem which fit into mem, clamped to [1, max_jobs].
+constexpr auto fit_jobs(std::uint64_t mem, std::uint64_t job_mem, std::uint32_t max_jobs) noexcept -> std::uint32_t {
+    return static_cast<std::uint32_t>(std::clamp<std::uint64_t>(mem / job_mem, 1, max_jobs));
+}
+
+}  // namespace
+
+namespace build_resources {
+
+auto read_system_resources() noexcept -> SystemResources {
+    SystemResources resources{};
+
+    cpu_set_t cpu_set{};
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+        resources.cpus = static_cast<std::uint32_t>(CPU_COUNT(&cpu_set));
+    }
+    resources.cpus       = std::max(resources.cpus, 1U);
+    resources.numa_nodes = count_numa_nodes();
+
+    const auto& meminfo         = utils::read_whole_file("/proc/meminfo");
+    resources.mem_available_kib = read_meminfo_value(meminfo, "MemAvailable");
+    resources.mem_total_kib     = read_meminfo_value(meminfo, "MemTotal");
+    return resources;
+}
+
+auto plan_jobs(const SystemResources& resources, std::string_view lto_mode) noexcept -> JobPlan {
+    JobPlan plan{};
+    plan.reasoning.emplace_back(fmt::format(FMT_COMPILE("{} CPUs, {} NUMA node(s), {:.1f} GiB available memory"),
+        resources.cpus, resources.numa_nodes, to_gib(resources.mem_available_kib)));
+
+    const bool is_lto       = (lto_mode == "thin" || lto_mode == "full");
+    const auto vmlinux_mem  = (lto_mode == "full") ? FULL_LTO_VMLINUX_MEM : (is_lto ? THIN_LTO_VMLINUX_MEM : 0);
+    const auto reserved_mem = RESERVED_MEM + vmlinux_mem;
+    const auto usable_mem   = (resources.mem_available_kib > reserved_mem) ? (resources.mem_available_kib - reserved_mem) : 0;
+
+    plan.compile_jobs = fit_jobs(usable_mem, COMPILE_JOB_MEM, resources.cpus);
+    if (plan.compile_jobs < resources.cpus) {
+        plan.reasoning.emplace_back(fmt::format(FMT_COMPILE("compile: {} jobs, limited by memory ({:.0f} GiB per job, {:.0f} GiB reserved{})"),
+            plan.compile_jobs, to_gib(COMPILE_JOB_MEM), to_gib(reserved_mem), is_lto ? " incl. the LTO vmlinux link" : ""));
+    } else {
+        plan.reasoning.emplace_back(fmt::format(FMT_COMPILE("compile: {} jobs, one per CPU"), plan.compile_jobs));
+    }
+
+    /* clang-format off */
+    if (!is_lto) { return plan; }
+    /* clang-format on */
+
+    const auto link_mem = (lto_mode == "full") ? FULL_LTO_LINK_MEM : THIN_LTO_LINK_MEM;
+    plan.lto_link_jobs  = fit_jobs(usable_mem, link_mem, resources.cpus);
+    plan.reasoning.emplace_back(fmt::format(FMT_COMPILE("LTO links: at most {} at once ({:.0f} GiB each)"), plan.lto_link_jobs, to_gib(link_mem)));
+
+    if (lto_mode == "thin") {
+        // Keep backend threads of a single link within one node, concurrent links use the others.
+        plan.thinlto_jobs = std::max(resources.cpus / resources.numa_nodes, 1U);
+        plan.reasoning.emplace_back(fmt::format(FMT_COMPILE("ThinLTO backend: {} threads per link (CPUs of one NUMA node)"), plan.thinlto_jobs));
+    }
+    return plan;
+}
+
+auto estimate_build_memory(const JobPlan& plan, std::string_view lto_mode) noexcept -> std::uint64_t {
+    const auto vmlinux_mem = (lto_mode == "full") ? FULL_LTO_VMLINUX_MEM : ((lto_mode == "thin") ? THIN_LTO_VMLINUX_MEM : 0);
+    return RESERVED_MEM + vmlinux_mem + plan.compile_jobs * COMPILE_JOB_MEM;
+}
+
+auto estimate_builddir_size(bool is_localmodcfg, std::string_view lto_mode) noexcept -> std::uint64_t {
+    auto builddir_size = SOURCE_TREE_SIZE + PACKAGE_SIZE + (is_localmodcfg ? LOCALMODCFG_OBJECTS_SIZE : OBJECTS_SIZE);
+    if (lto_mode == "full") {
+        builddir_size += FULL_LTO_EXTRA_SIZE;
+    } else if (lto_mode == "thin") {
+        builddir_size += THIN_LTO_EXTRA_SIZE;
+    }
+    return builddir_size;
+}
+
+auto format_plan(const JobPlan& plan) noexcept -> std::string {
+    std::string result{};
+    for (const auto& line : plan.reasoning) {
+        if (!result.empty()) {
+            result += '\n';
+        }
+        result += line;
+    }
+    return result;
+}
+
+auto get_lock_dir_path() noexcept -> const fs::path& {
+    static const fs::path lock_dir_path = utils::fix_path("~/.cache/cachyos-km/link-slots");
+    return lock_dir_path;
+}
+
+}  // namespace build_resources
@@ -0,0 +1,69 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef BUILD_RESOURCES_HPP
+#define BUILD_RESOURCES_HPP
+
+#include <cstdint>      // for uint32_t, uint64_t
+#include <filesystem>   // for path
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Picks job counts of the kernel build from the cores and memory of the machine.
+namespace build_resources {
+
+struct SystemResources {
+    // CPUs we are allowed to run on (affinity mask)
+    std::uint32_t cpus{1};
+    std::uint32_t numa_nodes{1};
+    std::uint64_t mem_available_kib{};
+    std::uint64_t mem_total_kib{};
+};
+
+struct JobPlan {
+    // make -j
+    std::uint32_t compile_jobs{1};
+    // links which run LTO code generation at once, 0 if not limited
+    std::uint32_t lto_link_jobs{};
+    // ThinLTO backend threads per link, 0 for the lld default
+    std::uint32_t thinlto_jobs{};
+    // why these numbers were chosen, one line per decision
+    std::vector<std::string> reasoning{};
+};
+
+[[nodiscard]] auto read_system_resources() noexcept -> SystemResources;
+
+/// lto_mode is one of "none", "full", "thin".
+[[nodiscard]] auto plan_jobs(const SystemResources& resources, std::string_view lto_mode) noexcept -> JobPlan;
+
+/// Peak memory of the build with the plan: compile jobs, the LTO vmlinux link and the reserve for the rest of the system.
+[[nodiscard]] auto estimate_build_memory(const JobPlan& plan, std::string_view lto_mode) noexcept -> std::uint64_t;
+
+/// Rough size of the build directory (extracted sources, objects and package) in KiB.
+/// localmodcfg builds only the modules in use, LTO adds vmlinux.o and the ThinLTO cache.
+[[nodiscard]] auto estimate_builddir_size(bool is_localmodcfg, std::string_view lto_mode) noexcept -> std::uint64_t;
+
+/// Reasoning of the plan, one decision per line.
+[[nodiscard]] auto format_plan(const JobPlan& plan) noexcept -> std::string;
+
+[[nodiscard]] auto get_lock_dir_path() noexcept -> const std::filesystem::path&;
+
+}  // namespace build_resources
+
+#endif  // BUILD_RESOURCES_HPP
@@ -0,0 +1,134 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "build_scope.hpp"
+#include "build_pipeline.hpp"
+#include "utils.hpp"
+
+#include <charconv>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#include <unistd.h>  // for getpid
+
+namespace fs = std::filesystem;
+
+namespace {
+
+auto parse_number(std::string_view value) noexcept -> std::uint64_t {
+    std::uint64_t result{};
+    std::from_chars(value.data(), value.data() + value.size(), result);
+    return result;
+}
+
+// Returns value of "<key> <value>" line (cpu.stat format).
+auto find_stat_value(std::string_view stat, std::string_view key) noexcept -> std::uint64_t {
+    for (auto&& line : utils::make_multiline_view(stat, '\n')) {
+        if (line.starts_with(key) && line.size() > key.size() && line[key.size()] == ' ') {
+            return parse_number(line.substr(key.size() + 1));
+        }
+    }
+    return 0;
+}
+
+constexpr auto to_mib(std::uint64_t bytes) noexcept -> double {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+}  // namespace
+
+namespace build_scope {
+
+bool is_available() noexcept {
+    std::error_code err_code{};
+    return fs::exists("/usr/bin/systemd-run", err_code) && fs::exists("/sys/fs/cgroup/cgroup.controllers", err_code);
+}
+
+auto make_unit_name() noexcept -> std::string {
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    return fmt::format(FMT_COMPILE("cachyos-km-build-{}-{}"), getpid(), now);
+}
+
+auto wrap_command(std::string_view command, std::string_view unit_name, const ScopeLimits& limits) noexcept -> std::string {
+    // --scope runs the command as our child, it keeps the terminal and the environment.
+    auto result = fmt::format(FMT_COMPILE("systemd-run --user --scope --quiet --collect --unit={} -p CPUWeight={} -p IOWeight={}"),
+        unit_name, limits.cpu_weight, limits.io_weight);
+    if (limits.memory_high_gib > 0) {
+        result += fmt::format(FMT_COMPILE(" -p MemoryHigh={}G"), limits.memory_high_gib);
+    }
+    result += fmt::format(FMT_COMPILE(" -- nice -n {} ionice -c 2 -n {} bash -c {}"), limits.nice, limits.ionice_level,
+        build_pipeline::shell_quote(command));
+    return result;
+}
+
+auto find_cgroup_path(std::string_view unit_name) noexcept -> std::optional<fs::path> {
+    const auto& control_group = utils::exec(fmt::format(FMT_COMPILE("systemctl --user show --property=ControlGroup --value '{}.scope' 2>/dev/null"), unit_name));
+    if (control_group.empty() || !control_group.starts_with('/')) {
+        return std::nullopt;
+    }
+
+    std::error_code err_code{};
+    auto cgroup_path = fs::path{"/sys/fs/cgroup"} / std::string_view{control_group}.substr(1);
+    if (!fs::is_directory(cgroup_path, err_code)) {
+        return std::nullopt;
+    }
+    return cgroup_path;
+}
+
+auto read_usage(const fs::path& cgroup_path) noexcept -> std::optional<ScopeUsage> {
+    const auto& cpu_stat = utils::read_whole_file((cgroup_path / "cpu.stat").string());
+    /* clang-format off */
+    if (cpu_stat.empty()) { return std::nullopt; }
+    /* clang-format on */
+
+    ScopeUsage usage{.timestamp = std::chrono::steady_clock::now()};
+    usage.cpu_usage_usec = find_stat_value(cpu_stat, "usage_usec");
+    usage.memory_current = parse_number(utils::read_whole_file((cgroup_path / "memory.current").string()));
+    usage.memory_peak    = parse_number(utils::read_whole_file((cgroup_path / "memory.peak").string()));
+
+    // "<major>:<minor> rbytes=N wbytes=N rios=N wios=N ..." per device, io controller may be not delegated.
+    const auto& io_stat = utils::read_whole_file((cgroup_path / "io.stat").string());
+    for (auto&& line : utils::make_multiline_view(io_stat, '\n')) {
+        for (auto&& field : utils::make_multiline_view(line, ' ')) {
+            if (field.starts_with("rbytes=")) {
+                usage.io_read_bytes += parse_number(field.substr(7));
+            } else if (field.starts_with("wbytes=")) {
+                usage.io_write_bytes += parse_number(field.substr(7));
+            }
+        }
+    }
+    return usage;
+}
+
+auto format_usage(const ScopeUsage& previous, const ScopeUsage& current) noexcept -> std::string {
+    const auto elapsed_usec = std::chrono::duration_cast<std::chrono::microseconds>(current.timestamp - previous.timestamp).count();
+    if (elapsed_usec <= 0) {
+        return fmt::format(FMT_COMPILE("memory {:.0f} MiB"), to_mib(current.memory_current));
+    }
+
+    const auto elapsed_sec = static_cast<double>(elapsed_usec) / 1'000'000.0;
+    // 100% is one fully used CPU
+    const auto cpu_percent = static_cast<double>(current.cpu_usage_usec - previous.cpu_usage_usec) * 100.0 / static_cast<double>(elapsed_usec);
+    const auto read_rate   = to_mib(current.io_read_bytes - previous.io_read_bytes) / elapsed_sec;
+    const auto write_rate  = to_mib(current.io_write_bytes - previous.io_write_bytes) / elapsed_sec;
+    return fmt::format(FMT_COMPILE("CPU {:.0f}%, memory {:.0f} MiB, read {:.1f} MiB/s, write {:.1f} MiB/s"), cpu_percent,
+        to_mib(current.memory_current), read_rate, write_rate);
+}
+
+}  // namespace build_scope
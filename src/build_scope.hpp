@@ -0,0 +1,72 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef BUILD_SCOPE_HPP
+#define BUILD_SCOPE_HPP
+
+#include <chrono>       // for steady_clock
+#include <cstdint>      // for int32_t, uint32_t, uint64_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+
+/// Runs the build in a transient systemd user scope, so its cgroup can be weighted and limited
+/// against the rest of the session.
+namespace build_scope {
+
+struct ScopeLimits {
+    // cpu.weight and io.weight, 1..10000, the default of other units is 100
+    std::uint32_t cpu_weight{100};
+    std::uint32_t io_weight{100};
+    // memory.high in GiB, 0 if not limited
+    std::uint32_t memory_high_gib{};
+    std::int32_t nice{};
+    // best-effort ionice level, 0..7
+    std::int32_t ionice_level{4};
+};
+
+struct ScopeUsage {
+    std::chrono::steady_clock::time_point timestamp{};
+    std::uint64_t cpu_usage_usec{};
+    std::uint64_t memory_current{};
+    // memory.peak, 0 on kernels older than 5.19
+    std::uint64_t memory_peak{};
+    std::uint64_t io_read_bytes{};
+    std::uint64_t io_write_bytes{};
+};
+
+[[nodiscard]] bool is_available() noexcept;
+
+/// Returns unique name of the scope unit, without the .scope suffix.
+[[nodiscard]] auto make_unit_name() noexcept -> std::string;
+
+/// Wraps the shell command, to run it in the scope with the limits.
+[[nodiscard]] auto wrap_command(std::string_view command, std::string_view unit_name, const ScopeLimits& limits) noexcept -> std::string;
+
+/// Resolves the cgroup directory of the running scope, nothing if it isn't running.
+[[nodiscard]] auto find_cgroup_path(std::string_view unit_name) noexcept -> std::optional<std::filesystem::path>;
+
+[[nodiscard]] auto read_usage(const std::filesystem::path& cgroup_path) noexcept -> std::optional<ScopeUsage>;
+
+/// Formats CPU, memory and IO usage, rates are computed between the two samples.
+[[nodiscard]] auto format_usage(const ScopeUsage& previous, const ScopeUsage& current) noexcept -> std::string;
+
+}  // namespace build_scope
+
+#endif  // BUILD_SCOPE_HPP
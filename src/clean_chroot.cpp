@@ -0,0 +1,66 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "clean_chroot.hpp"
+#include "utils.hpp"
+
+#include <linux/magic.h>  // for BTRFS_SUPER_MAGIC
+#include <sys/vfs.h>      // for statfs
+
+namespace fs = std::filesystem;
+
+namespace clean_chroot {
+
+auto get_chroot_path() noexcept -> const fs::path& {
+    static const fs::path chroot_path = utils::fix_path("~/.cache/cachyos-km/chroot");
+    return chroot_path;
+}
+
+auto get_root_path() noexcept -> const fs::path& {
+    static const fs::path root_path = get_chroot_path() / "root";
+    return root_path;
+}
+
+bool is_available() noexcept {
+    std::error_code err_code{};
+    return fs::exists("/usr/bin/mkarchroot", err_code) && fs::exists("/usr/bin/arch-nspawn", err_code)
+        && fs::exists("/usr/bin/makechrootpkg", err_code);
+}
+
+bool has_root() noexcept {
+    std::error_code err_code{};
+    // Created by mkarchroot, once the base chroot is complete.
+    return fs::exists(get_root_path() / ".arch-chroot", err_code);
+}
+
+bool supports_snapshots() noexcept {
+    // The chroot may not exist yet, check the filesystem it would be created on.
+    std::error_code err_code{};
+    auto fs_path = get_chroot_path();
+    while (!fs::exists(fs_path, err_code) && fs_path.has_parent_path() && fs_path != fs_path.parent_path()) {
+        fs_path = fs_path.parent_path();
+    }
+
+    struct statfs fs_info { };
+    if (statfs(fs_path.c_str(), &fs_info) != 0) {
+        return false;
+    }
+    return static_cast<unsigned long>(fs_info.f_type) == BTRFS_SUPER_MAGIC;
+}
+
+}  // namespace clean_chroot
@@ -0,0 +1,48 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef CLEAN_CHROOT_HPP
+#define CLEAN_CHROOT_HPP
+
+#include <filesystem>  // for path
+
+/// Builds in a clean chroot with devtools.
+///
+/// Layout of ~/.cache/cachyos-km/chroot:
+///   root/    base chroot (base-devel), created once and updated before every build
+///   <user>/  working copy of root, recreated by makechrootpkg for every build
+///
+/// On btrfs the base chroot is a subvolume and the working copy is a snapshot of it,
+/// otherwise makechrootpkg copies the base chroot with rsync.
+namespace clean_chroot {
+
+[[nodiscard]] auto get_chroot_path() noexcept -> const std::filesystem::path&;
+[[nodiscard]] auto get_root_path() noexcept -> const std::filesystem::path&;
+
+/// Checks if devtools (mkarchroot, arch-nspawn, makechrootpkg) are installed.
+[[nodiscard]] bool is_available() noexcept;
+
+/// Checks if the base chroot has been created.
+[[nodiscard]] bool has_root() noexcept;
+
+/// Checks if working copies are btrfs snapshots, i.e the chroot lives on btrfs.
+[[nodiscard]] bool supports_snapshots() noexcept;
+
+}  // namespace clean_chroot
+
+#endif  // CLEAN_CHROOT_HPP
@@ -0,0 +1,116 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "compiler_cache.hpp"
+#include "utils.hpp"
+
+#include <charconv>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+auto make_ccache_command(std::string_view args) noexcept -> std::string {
+    return fmt::format(FMT_COMPILE("CCACHE_DIR='{}' ccache {} 2>/dev/null"), compiler_cache::get_cache_path().string(), args);
+}
+
+}  // namespace
+
+namespace compiler_cache {
+
+auto get_cache_path() noexcept -> const fs::path& {
+    static const fs::path cache_path = utils::fix_path("~/.cache/cachyos-km/ccache");
+    return cache_path;
+}
+
+auto get_masquerade_path() noexcept -> std::string_view {
+    return "/usr/lib/ccache/bin";
+}
+
+bool is_available() noexcept {
+    std::error_code err_code{};
+    return fs::is_directory(get_masquerade_path(), err_code);
+}
+
+auto make_environment(std::uint32_t max_size_gib) noexcept -> std::vector<std::pair<std::string, std::string>> {
+    return {
+        {"CCACHE_DIR", get_cache_path().string()},
+        {"CCACHE_MAXSIZE", fmt::format(FMT_COMPILE("{}G"), max_size_gib)},
+        // Hash the compiler binary itself, mtime of clang/gcc changes on every reinstall
+        // and the LLVM version affects the emitted LTO bitcode.
+        {"CCACHE_COMPILERCHECK", "content"},
+        // Paths of the pristine, incremental and regular trees differ, rewrite them to relative ones.
+        {"CCACHE_BASEDIR", utils::fix_path("~/.cache/cachyos-km")},
+    };
+}
+
+void zero_stats() noexcept {
+    utils::exec(make_ccache_command("--zero-stats"));
+}
+
+auto parse_stats(std::string_view print_stats_output) noexcept -> std::optional<CacheStats> {
+    static constexpr auto parse_value = [](std::string_view value) -> std::uint64_t {
+        std::uint64_t result{};
+        std::from_chars(value.data(), value.data() + value.size(), result);
+        return result;
+    };
+
+    CacheStats stats{};
+    bool is_found{};
+    // "<key>\t<value>" per line
+    for (auto&& line : utils::make_multiline_view(print_stats_output, '\n')) {
+        const auto tab_pos = line.find('\t');
+        /* clang-format off */
+        if (tab_pos == std::string_view::npos) { continue; }
+        /* clang-format on */
+
+        const auto& key   = line.substr(0, tab_pos);
+        const auto& value = line.substr(tab_pos + 1);
+        if (key == "direct_cache_hit" || key == "preprocessed_cache_hit") {
+            stats.hits += parse_value(value);
+        } else if (key == "cache_miss") {
+            stats.misses += parse_value(value);
+        } else if (key == "cache_size_kibibyte") {
+            stats.size_kib = parse_value(value);
+        } else {
+            continue;
+        }
+        is_found = true;
+    }
+
+    /* clang-format off */
+    if (!is_found) { return std::nullopt; }
+    /* clang-format on */
+    return stats;
+}
+
+auto read_stats() noexcept -> std::optional<CacheStats> {
+    return parse_stats(utils::exec(make_ccache_command("--print-stats")));
+}
+
+auto format_stats(const CacheStats& stats) noexcept -> std::string {
+    const auto total     = stats.hits + stats.misses;
+    const auto hit_ratio = (total > 0) ? (static_cast<double>(stats.hits) * 100.0 / static_cast<double>(total)) : 0.0;
+    return fmt::format(FMT_COMPILE("{} hits, {} misses ({:.1f}%), cache size {:.1f} GiB"), stats.hits, stats.misses,
+        hit_ratio, static_cast<double>(stats.size_kib) / (1024.0 * 1024.0));
+}
+
+}  // namespace compiler_cache
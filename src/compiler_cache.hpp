@@ -0,0 +1,59 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef COMPILER_CACHE_HPP
+#define COMPILER_CACHE_HPP
+
+#include <cstdint>      // for uint64_t, uint32_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <utility>      // for pair
+#include <vector>       // for vector
+
+/// ccache setup for kernel builds, the cache lives in ~/.cache/cachyos-km/ccache.
+///
+/// PKGBUILD passes the compiler to make by name (gcc or clang), so ccache is enabled
+/// with its masquerade directory in PATH.
+namespace compiler_cache {
+
+struct CacheStats {
+    std::uint64_t hits{};
+    std::uint64_t misses{};
+    std::uint64_t size_kib{};
+};
+
+[[nodiscard]] auto get_cache_path() noexcept -> const std::filesystem::path&;
+[[nodiscard]] auto get_masquerade_path() noexcept -> std::string_view;
+[[nodiscard]] bool is_available() noexcept;
+
+/// Environment for the build, max_size_gib caps the cache size.
+[[nodiscard]] auto make_environment(std::uint32_t max_size_gib) noexcept -> std::vector<std::pair<std::string, std::string>>;
+
+/// Resets the statistics, so they cover only the next build.
+void zero_stats() noexcept;
+
+/// Parses output of 'ccache --print-stats'.
+[[nodiscard]] auto parse_stats(std::string_view print_stats_output) noexcept -> std::optional<CacheStats>;
+[[nodiscard]] auto read_stats() noexcept -> std::optional<CacheStats>;
+[[nodiscard]] auto format_stats(const CacheStats& stats) noexcept -> std::string;
+
+}  // namespace compiler_cache
+
+#endif  // COMPILER_CACHE_HPP
@@ -17,14 +17,43 @@
 // 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 
 #include "conf-window.hpp"
+#include "binary_cache.hpp"
+#include "build_batch.hpp"
+#include "build_history.hpp"
+#include "build_pipeline.hpp"
+#include "build_progress.hpp"
+#include "build_queue.hpp"
+#include "build_resources.hpp"
+#include "build_scope.hpp"
+#include "clean_chroot.hpp"
 #include "compile_options.hpp"
+#include "compiler_cache.hpp"
+#include "distributed_compile.hpp"
+#include "incremental_build.hpp"
+#include "kernel_pgo.hpp"
+#include "link_tools.hpp"
+#include "local_repo.hpp"
+#include "makepkg_conf.hpp"
+#include "module_db.hpp"
+#include "patch_cache.hpp"
+#include "patch_check.hpp"
+#include "source_cache.hpp"
+#include "tmpfs_builddir.hpp"
+#include "tree_cache.hpp"
 #include "utils.hpp"
 
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
+#include <functional>
+#include <iterator>
 #include <string_view>
+#include <utility>
 
 #if defined(__clang__)
 #pragma clang diagnostic push
@@ -46,10 +75,15 @@
 #include <range/v3/view/filter.hpp>
 #include <range/v3/view/join.hpp>
 
+#include <QDialog>
 #include <QFileDialog>
+#include <QHeaderView>
 #include <QInputDialog>
 #include <QLineEdit>
 #include <QStringList>
+#include <QTableWidget>
+#include <QVBoxLayout>
+#include <QtConcurrent/QtConcurrent>
 
 #if defined(__clang__)
 #pragma clang diagnostic pop
@@ -106,6 +140,10 @@ GENERATE_CONST_OPTION_VALUES(tickless_mode, "full", "idle", "perodic")
 GENERATE_CONST_OPTION_VALUES(preempt_mode, "full", "voluntary", "server")
 GENERATE_CONST_OPTION_VALUES(lru_config_mode, "standard", "stats", "none")
 GENERATE_CONST_OPTION_VALUES(lto_mode, "none", "full", "thin")
+GENERATE_CONST_OPTION_VALUES(host_linker, "default", "lld", "mold")
+GENERATE_CONST_OPTION_VALUES(distributed_compiler, "none", "distcc", "icecc")
+GENERATE_CONST_OPTION_VALUES(pgo_mode, "none", "autofdo", "propeller")
+GENERATE_CONST_OPTION_VALUES(package_compressor, "zstd", "xz", "none")
 GENERATE_CONST_OPTION_VALUES(hugepage_mode, "always", "madvise")
 GENERATE_CONST_OPTION_VALUES(cpu_opt_mode, "manual", "generic", "native_amd", "native_intel", "zen", "zen2", "zen3", "sandybridge", "ivybridge", "haswell", "icelake", "tigerlake", "alderlake")
 
@@ -118,6 +156,9 @@ static_assert(lookup_kernel_name("rt") == 3, "Invalid position");
 static_assert(lookup_kernel_name("rt-bore") == 4, "Invalid position");
 static_assert(lookup_kernel_name("sched-ext") == 5, "Invalid position");
 
+// Length of a system-wide profile recording, when no workload is given.
+constexpr std::uint32_t PGO_RECORD_SECONDS = 300;
+
 constexpr auto get_kernel_name_path(std::string_view kernel_name) noexcept {
     using namespace std::string_view_literals;
     if (kernel_name == "cachyos"sv) {
@@ -187,11 +228,12 @@ void child_watch_cb(GPid pid, [[maybe_unused]] gint status, gpointer user_data)
     // process exits.
     g_spawn_close_pid(pid);
 
-    auto* data = static_cast<bool*>(user_data);
-    *data      = false;
+    auto* on_exit = static_cast<std::function<void()>*>(user_data);
+    (*on_exit)();
+    delete on_exit;
 }
 
-void run_cmd_async(std::string cmd, bool* data) noexcept {
+void run_cmd_async(std::string cmd, std::function<void()> on_exit) noexcept {
     cmd += "; read -p 'Press enter to exit'";
     const gchar* const argv[] = {"/usr/lib/cachyos-kernel-manager/terminal-helper", cmd.c_str(), nullptr};
     gint child_stdout{};
@@ -206,28 +248,15 @@ void run_cmd_async(std::string cmd, bool* data) noexcept {
         &child_stderr, &error);
     if (error != nullptr) {
         fmt::print(stderr, "Spawning child failed: {}", error->message);
+        on_exit();
         return;
     }
     // Add a child watch function which will be called when the child process
     // exits.
-    g_child_watch_add(child_pid, child_watch_cb, data);
-}
-
-auto get_source_array_from_pkgbuild(std::string_view kernel_name_path, std::string_view options_set) noexcept {
-    const auto& testscript_src  = fmt::format(FMT_COMPILE("#!/usr/bin/bash\n{}\nsource $1\n{}"), options_set, "echo \"${source[@]}\"");
-    const auto& testscript_path = fmt::format(FMT_COMPILE("{}/.testscript"), kernel_name_path);
-
-    if (utils::write_to_file(testscript_path, testscript_src)) {
-        fs::permissions(testscript_path,
-            fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec,
-            fs::perm_options::add);
-    }
-
-    const auto& src_entries = utils::exec(fmt::format(FMT_COMPILE("{} {}/PKGBUILD"), testscript_path, kernel_name_path));
-    return utils::make_multiline(src_entries, ' ');
+    g_child_watch_add(child_pid, child_watch_cb, new std::function<void()>(std::move(on_exit)));
 }
 
-bool insert_new_source_array_into_pkgbuild(std::string_view kernel_name_path, QListWidget* list_widget, const std::vector<std::string>& orig_source_array) noexcept {
+bool insert_new_source_array_into_pkgbuild(std::string_view kernel_name_path, const std::vector<std::string>& patches, const std::vector<std::string>& orig_source_array) noexcept {
     static constexpr auto functor = [](auto&& rng) {
         auto rng_str = std::string_view(&*rng.begin(), static_cast<size_t>(ranges::distance(rng)));
         return !rng_str.ends_with(".patch");
@@ -237,9 +266,8 @@ bool insert_new_source_array_into_pkgbuild(std::string_view kernel_name_path, QL
     ranges::for_each(orig_source_array | ranges::views::filter(functor), [&](auto&& rng) { array_entries.emplace_back(fmt::format(FMT_COMPILE("\"{}\""), rng)); });
 
     // Apply flag to each item in list widget
-    for (int i = 0; i < list_widget->count(); ++i) {
-        auto* item = list_widget->item(i);
-        array_entries.emplace_back(fmt::format(FMT_COMPILE("\"{}\""), item->text().toStdString()));
+    for (const auto& patch : patches) {
+        array_entries.emplace_back(fmt::format(FMT_COMPILE("\"{}\""), patch));
     }
     const auto& pkgbuild_path = fmt::format(FMT_COMPILE("{}/PKGBUILD"), kernel_name_path);
     auto pkgbuildsrc          = utils::read_whole_file(pkgbuild_path);
@@ -266,6 +294,125 @@ bool set_custom_name_in_pkgbuild(std::string_view kernel_name_path, std::string_
     return utils::write_to_file(pkgbuild_path, pkgbuildsrc);
 }
 
+bool set_options_in_pkgbuild(std::string_view kernel_name_path, std::string_view all_set_values) noexcept {
+    const auto& pkgbuild_path = fmt::format(FMT_COMPILE("{}/PKGBUILD"), kernel_name_path);
+    auto pkgbuildsrc          = utils::read_whole_file(pkgbuild_path);
+
+    // The environment doesn't get into the chroot, PKGBUILD keeps the values set before its defaults.
+    std::string options_vars{};
+    for (auto&& expr : utils::make_multiline_view(all_set_values, '\n')) {
+        const auto delim_pos = expr.find('=');
+        /* clang-format off */
+        if (delim_pos == std::string_view::npos) { continue; }
+        /* clang-format on */
+        options_vars += fmt::format(FMT_COMPILE("{}={}\n"), expr.substr(0, delim_pos), build_pipeline::shell_quote(expr.substr(delim_pos + 1)));
+    }
+    pkgbuildsrc.insert(0, options_vars);
+    return utils::write_to_file(pkgbuild_path, pkgbuildsrc);
+}
+
+auto make_source_cache_entries(PkgbuildEvaluator* evaluator, std::string_view options_set, const std::vector<std::string>& source_array) noexcept {
+    // Use the strongest checksums declared by PKGBUILD.
+    for (auto&& algo : {"b2", "sha512", "sha256"}) {
+        const auto& checksums = evaluator->array(options_set, fmt::format(FMT_COMPILE("{}sums"), algo));
+        if (checksums.size() == source_array.size()) {
+            return source_cache::make_entries(source_array, algo, checksums);
+        }
+    }
+    return source_cache::make_entries(source_array, {}, {});
+}
+
+void setup_incremental_build(PkgbuildEvaluator* evaluator, std::string_view options_set, build_pipeline::BuildSettings& build_settings) noexcept {
+    const auto& pkgbase_values = evaluator->array(options_set, "pkgbase");
+    const auto& pkgver_values  = evaluator->array(options_set, "pkgver");
+    if (pkgbase_values.empty() || pkgver_values.empty()) {
+        fmt::print(stderr, "Failed to evaluate pkgbase and pkgver, incremental build is disabled\n");
+        return;
+    }
+
+    const auto& pkgbase     = pkgbase_values.front();
+    const auto& state_path  = incremental_build::get_state_path(pkgbase);
+    const auto& work_srcdir = incremental_build::get_srcdir_path(pkgbase);
+    const auto& current     = incremental_build::make_state(pkgver_values.front(), options_set, evaluator->source_array(options_set));
+
+    std::error_code err_code{};
+    auto decision = incremental_build::decide(incremental_build::load_state(state_path), current, fs::is_directory(work_srcdir, err_code));
+    if (!decision.clean_build && !fs::exists("/usr/bin/rsync")) {
+        decision = {.clean_build = true, .reason = "rsync is not installed"};
+    }
+
+    // The state is committed by the build command, only if the build succeeds.
+    const auto& pending_state_path = fmt::format(FMT_COMPILE("{}.pending"), state_path.string());
+    if (!incremental_build::save_state(pending_state_path, current)) {
+        fmt::print(stderr, "Failed to write '{}', incremental build is disabled\n", pending_state_path);
+        return;
+    }
+
+    build_settings.incremental        = true;
+    build_settings.clean_build        = decision.clean_build;
+    build_settings.builddir           = incremental_build::get_builddir_path().string();
+    build_settings.work_srcdir        = work_srcdir.string();
+    build_settings.pending_state_path = pending_state_path;
+    build_settings.state_path         = state_path.string();
+    build_settings.files_path         = incremental_build::get_files_path(pkgbase).string();
+    build_settings.notice             = fmt::format(FMT_COMPILE("{} build: {}"), decision.clean_build ? "Clean" : "Incremental", decision.reason);
+}
+
+auto setup_tmpfs_builddir(PkgbuildEvaluator* evaluator, std::string_view options_set, bool is_localmodcfg, std::string_view lto_mode,
+    build_pipeline::BuildSettings& build_settings) noexcept -> std::string {
+    const auto& pkgbase_values = evaluator->array(options_set, "pkgbase");
+    /* clang-format off */
+    if (pkgbase_values.empty()) { return "on disk, failed to evaluate pkgbase"; }
+    /* clang-format on */
+
+    const auto& resources = build_resources::read_system_resources();
+    const auto& plan      = build_resources::plan_jobs(resources, lto_mode);
+    const auto& decision  = tmpfs_builddir::decide(resources, build_resources::estimate_builddir_size(is_localmodcfg, lto_mode),
+        build_resources::estimate_build_memory(plan, lto_mode));
+    if (!decision.builddir.empty()) {
+        build_settings.ram_builddir = decision.builddir;
+        build_settings.srcdir       = (fs::path{decision.builddir} / pkgbase_values.front() / "src").string();
+    }
+    return decision.reason;
+}
+
+void setup_build_job(PkgbuildEvaluator* evaluator, std::string_view kernel_name_path, std::string_view options_set,
+    build_pipeline::BuildSettings& build_settings) noexcept {
+    const auto& pkgbase_values = evaluator->array(options_set, "pkgbase");
+    if (pkgbase_values.empty()) {
+        fmt::print(stderr, "Failed to evaluate pkgbase, the build can't be resumed\n");
+        return;
+    }
+
+    // Unfinished jobs of the same variant are superseded by this build, their trees would only take space.
+    const auto& pkgbuild_dir = fs::absolute(kernel_name_path);
+    for (const auto& job : build_queue::load_jobs()) {
+        if (!job.is_running && fs::path{job.pkgbuild_dir} == pkgbuild_dir) {
+            build_queue::remove_job(job.id);
+        }
+    }
+
+    const auto now        = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    build_settings.job_id = build_queue::make_job_id(now);
+    build_settings.srcdir = (build_queue::get_builddir_path(build_settings.job_id) / pkgbase_values.front() / "src").string();
+
+    // The environment of the manager is gone when the job is resumed.
+    for (auto&& option : utils::make_multiline_view(options_set, '\n')) {
+        if (const auto delim_pos = option.find('='); delim_pos != std::string_view::npos) {
+            build_settings.environment.emplace_back(option.substr(0, delim_pos), option.substr(delim_pos + 1));
+        }
+    }
+    build_settings.environment.emplace_back("SRCDEST", source_cache::get_srcdest_path().string());
+}
+
+auto format_parallelism_plan(const build_resources::JobPlan& plan, std::uint32_t remote_slots) noexcept -> std::string {
+    auto result = build_resources::format_plan(plan);
+    if (remote_slots > 0) {
+        result += fmt::format(FMT_COMPILE(", {} remote compile jobs"), remote_slots);
+    }
+    return result;
+}
+
 auto convert_vector_of_strings_to_stringlist(const std::vector<std::string>& vec) noexcept {
     QStringList result{};
 
@@ -275,6 +422,46 @@ auto convert_vector_of_strings_to_stringlist(const std::vector<std::string>& vec
     return result;
 }
 
+auto get_list_widget_items(QListWidget* list_widget) noexcept {
+    std::vector<std::string> result{};
+    for (int i = 0; i < list_widget->count(); ++i) {
+        result.emplace_back(list_widget->item(i)->text().toStdString());
+    }
+    return result;
+}
+
+void mark_patch_item(QListWidgetItem* item, const patch_cache::FetchResult& result) noexcept {
+    if (result.digest.empty()) {
+        item->setForeground(Qt::red);
+        item->setToolTip(QObject::tr("Failed to fetch: %1").arg(QString::fromStdString(result.error)));
+    } else {
+        item->setData(Qt::ForegroundRole, QVariant{});
+        item->setToolTip(QObject::tr("Fetched, sha256 %1").arg(QString::fromStdString(result.digest)));
+    }
+}
+
+void mark_checked_patch_item(QListWidgetItem* item, const patch_check::PatchResult& result, const std::vector<patch_check::PatchResult>& results) noexcept {
+    if (result.applies_in_order) {
+        item->setData(Qt::ForegroundRole, QVariant{});
+        item->setToolTip(QObject::tr("Applies"));
+        return;
+    }
+
+    const auto& error = QString::fromStdString(result.error).trimmed();
+    if (!result.applies_alone) {
+        item->setForeground(Qt::red);
+        item->setToolTip(QObject::tr("Doesn't apply to the source tree:\n%1").arg(error));
+        return;
+    }
+
+    QStringList conflicting_entries{};
+    for (const auto conflict_index : result.conflicts) {
+        conflicting_entries << QString::fromStdString(results[conflict_index].entry);
+    }
+    item->setForeground(Qt::darkYellow);
+    item->setToolTip(QObject::tr("Applies alone, but not after:\n%1\n%2").arg(conflicting_entries.join('\n'), error));
+}
+
 inline void list_widget_apply_edit_flag(QListWidget* list_widget) noexcept {
     // Apply flag to each item in list widget
     for (int i = 0; i < list_widget->count(); ++i) {
@@ -283,6 +470,48 @@ inline void list_widget_apply_edit_flag(QListWidget* list_widget) noexcept {
     }
 }
 
+auto ConfWindow::get_pkgbuild_evaluator(std::string_view kernel_name_path) noexcept -> PkgbuildEvaluator* {
+    const std::lock_guard<std::mutex> guard(m_evaluators_mutex);
+
+    const auto& pkgbuild_dir = fs::absolute(kernel_name_path).string();
+    auto& evaluator_entry    = m_evaluators[pkgbuild_dir];
+    if (!evaluator_entry) {
+        evaluator_entry = std::make_unique<PkgbuildEvaluator>(pkgbuild_dir);
+    }
+    return evaluator_entry.get();
+}
+
+auto ConfWindow::get_source_array_from_pkgbuild(std::string_view kernel_name_path, std::string_view options_set) noexcept -> std::vector<std::string> {
+    return get_pkgbuild_evaluator(kernel_name_path)->source_array(options_set);
+}
+
+auto ConfWindow::get_cached_source_array(std::string_view kernel_name_path, std::string_view options_set, std::string* cache_key) noexcept -> std::vector<std::string> {
+    // PKGBUILD content is part of the key, so the cache is invalidated by git pull.
+    // The key is the whole string, a hash collision would return the source array of another configuration.
+    const auto& pkgbuild_blob_id = utils::git_blob_id(fmt::format(FMT_COMPILE("{}/PKGBUILD"), kernel_name_path));
+    auto key                     = fmt::format(FMT_COMPILE("{}:{}:{}"), kernel_name_path, pkgbuild_blob_id, options_set);
+    if (cache_key != nullptr) {
+        *cache_key = key;
+    }
+
+    {
+        const std::lock_guard<std::mutex> guard(m_source_cache_mutex);
+        if (auto found = m_source_cache.find(key); found != m_source_cache.end()) {
+            return found->second;
+        }
+    }
+
+    // A failed evaluation returns nothing, it's retried by the next lookup.
+    auto source_array = get_source_array_from_pkgbuild(kernel_name_path, options_set);
+    /* clang-format off */
+    if (source_array.empty()) { return source_array; }
+    /* clang-format on */
+
+    const std::lock_guard<std::mutex> guard(m_source_cache_mutex);
+    m_source_cache.insert_or_assign(std::move(key), source_array);
+    return source_array;
+}
+
 void ConfWindow::connect_all_checkboxes() noexcept {
     auto* options_page_ui_obj = m_ui->conf_options_page_widget->get_ui_obj();
 
@@ -292,7 +521,7 @@ void ConfWindow::connect_all_checkboxes() noexcept {
 
     for (auto* checkbox : checkbox_list) {
         connect(checkbox, &QCheckBox::stateChanged, this, [this](std::int32_t) {
-            reset_patches_data_tab();
+            schedule_patches_data_tab_reset();
         });
     }
 }
@@ -348,6 +577,11 @@ void ConfWindow::clear_patches_data_tab() noexcept {
     patches_page_ui_obj->list_widget->clear();
 }
 
+void ConfWindow::schedule_patches_data_tab_reset() noexcept {
+    // restart the timer on every change, only the last one in a burst triggers evaluation.
+    m_patches_reset_timer->start();
+}
+
 void ConfWindow::reset_patches_data_tab() noexcept {
     auto* options_page_ui_obj = m_ui->conf_options_page_widget->get_ui_obj();
     auto* patches_page_ui_obj = m_ui->conf_patches_page_widget->get_ui_obj();
@@ -355,7 +589,15 @@ void ConfWindow::reset_patches_data_tab() noexcept {
     const std::int32_t main_combo_index  = options_page_ui_obj->main_combo_box->currentIndex();
     const std::string_view cpusched_path = get_kernel_name_path(get_kernel_name(static_cast<size_t>(main_combo_index)));
 
-    auto current_array_items = get_source_array_from_pkgbuild(cpusched_path, get_all_set_values());
+    std::string cache_key{};
+    auto current_array_items = get_cached_source_array(cpusched_path, get_all_set_values(), &cache_key);
+
+    // Nothing changed since the last reset, keep the list (and the user edits) as is.
+    /* clang-format off */
+    if (cache_key == m_displayed_patches_key && patches_page_ui_obj->list_widget->count() > 0) { return; }
+    /* clang-format on */
+    m_displayed_patches_key = std::move(cache_key);
+
     std::erase_if(current_array_items, [](auto&& item_el) { return !item_el.ends_with(".patch"); });
 
     clear_patches_data_tab();
@@ -375,6 +617,11 @@ ConfWindow::ConfWindow(QWidget* parent)
     auto* options_page_ui_obj = m_ui->conf_options_page_widget->get_ui_obj();
     auto* patches_page_ui_obj = m_ui->conf_patches_page_widget->get_ui_obj();
 
+    // Debounce patches tab reset
+    m_patches_reset_timer->setSingleShot(true);
+    m_patches_reset_timer->setInterval(150);
+    connect(m_patches_reset_timer, &QTimer::timeout, this, &ConfWindow::reset_patches_data_tab);
+
     // Selecting the CPU scheduler
     QStringList kernel_names;
     kernel_names << tr("CachyOS - BORE + SCHED-EXT")
@@ -453,7 +700,120 @@ ConfWindow::ConfWindow(QWidget* parent)
     connect(options_page_ui_obj->cancel_button, &QPushButton::clicked, this, &ConfWindow::on_cancel);
     connect(options_page_ui_obj->ok_button, &QPushButton::clicked, this, &ConfWindow::on_execute);
     connect(options_page_ui_obj->main_combo_box, &QComboBox::currentIndexChanged, this, [this](std::int32_t) {
-        reset_patches_data_tab();
+        schedule_patches_data_tab_reset();
+    });
+
+    // Setup build page
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+    if (!compiler_cache::is_available()) {
+        build_page_ui_obj->ccache_check->setEnabled(false);
+        build_page_ui_obj->ccache_check->setToolTip(tr("ccache is not installed"));
+    }
+
+    QStringList host_linkers;
+    host_linkers << tr("Default")
+                 << "LLD"
+                 << "mold";
+    build_page_ui_obj->host_linker_combo_box->addItems(host_linkers);
+
+    QStringList distributed_backends;
+    distributed_backends << tr("None")
+                         << "distcc"
+                         << "icecream";
+    build_page_ui_obj->distributed_compile_combo_box->addItems(distributed_backends);
+    update_distributed_status();
+    connect(build_page_ui_obj->distributed_compile_combo_box, &QComboBox::currentIndexChanged, this, [this](std::int32_t) {
+        update_distributed_status();
+    });
+    connect(build_page_ui_obj->distcc_hosts_edit, &QLineEdit::textChanged, this, &ConfWindow::update_distributed_status);
+    connect(build_page_ui_obj->remote_slots_spin_box, &QSpinBox::valueChanged, this, [this](std::int32_t) {
+        update_distributed_status();
+    });
+
+    QStringList pgo_modes;
+    pgo_modes << tr("None")
+              << "AutoFDO"
+              << "AutoFDO + Propeller";
+    build_page_ui_obj->pgo_mode_combo_box->addItems(pgo_modes);
+    update_pgo_status();
+    connect(build_page_ui_obj->pgo_mode_combo_box, &QComboBox::currentIndexChanged, this, [this](std::int32_t) {
+        update_pgo_status();
+    });
+    connect(options_page_ui_obj->lto_combo_box, &QComboBox::currentIndexChanged, this, [this](std::int32_t) {
+        update_pgo_status();
+    });
+    connect(build_page_ui_obj->pgo_record_button, &QPushButton::clicked, this, &ConfWindow::on_record_pgo_profile);
+
+    // Modules used over days, localmodcfg then doesn't miss the ones which aren't loaded right now.
+    build_page_ui_obj->module_collector_check->setChecked(module_db::is_collector_enabled());
+    update_module_db_status();
+    connect(build_page_ui_obj->module_collector_check, &QCheckBox::toggled, this, &ConfWindow::on_module_collector_toggled);
+    connect(options_page_ui_obj->localmodcfg_check, &QCheckBox::stateChanged, this, [this](std::int32_t) {
+        update_module_db_status();
+    });
+
+    QStringList package_compressors;
+    package_compressors << "zstd"
+                        << "xz"
+                        << tr("None");
+    build_page_ui_obj->package_compressor_combo_box->addItems(package_compressors);
+
+    if (!clean_chroot::is_available()) {
+        build_page_ui_obj->clean_chroot_check->setEnabled(false);
+        build_page_ui_obj->clean_chroot_check->setToolTip(tr("devtools is not installed"));
+    }
+    update_chroot_status();
+
+    if (!local_repo::is_available()) {
+        build_page_ui_obj->local_repo_check->setEnabled(false);
+        build_page_ui_obj->local_repo_check->setToolTip(tr("repo-add is not installed"));
+    }
+    update_local_repo_conf();
+    connect(build_page_ui_obj->local_repo_dir_edit, &QLineEdit::textChanged, this, &ConfWindow::update_local_repo_conf);
+    connect(build_page_ui_obj->local_repo_name_edit, &QLineEdit::textChanged, this, &ConfWindow::update_local_repo_conf);
+
+    if (!build_scope::is_available()) {
+        build_page_ui_obj->build_scope_check->setEnabled(false);
+        build_page_ui_obj->build_scope_check->setToolTip(tr("systemd-run or cgroup v2 is not available"));
+    }
+    m_usage_timer->setInterval(1000);
+    connect(m_usage_timer, &QTimer::timeout, this, &ConfWindow::update_build_usage);
+    m_progress_timer->setInterval(1000);
+    connect(m_progress_timer, &QTimer::timeout, this, &ConfWindow::update_build_progress);
+
+    // Predict duration of the selected options from the build history, every option and build mode change affects it.
+    m_prediction_timer->setSingleShot(true);
+    m_prediction_timer->setInterval(300);
+    connect(m_prediction_timer, &QTimer::timeout, this, &ConfWindow::update_build_prediction);
+    for (auto* settings_page : std::array<QWidget*, 2>{m_ui->conf_options_page_widget, m_ui->conf_build_page_widget}) {
+        for (auto* checkbox : settings_page->findChildren<QCheckBox*>()) {
+            connect(checkbox, &QCheckBox::stateChanged, this, [this](std::int32_t) { m_prediction_timer->start(); });
+        }
+        for (auto* combo_box : settings_page->findChildren<QComboBox*>()) {
+            connect(combo_box, &QComboBox::currentIndexChanged, this, [this](std::int32_t) { m_prediction_timer->start(); });
+        }
+    }
+    update_build_prediction();
+    connect(build_page_ui_obj->build_history_button, &QPushButton::clicked, this, &ConfWindow::show_build_comparison);
+
+    connect(build_page_ui_obj->batch_add_button, &QPushButton::clicked, this, &ConfWindow::add_to_batch);
+    connect(build_page_ui_obj->batch_clear_button, &QPushButton::clicked, this, &ConfWindow::clear_batch);
+    connect(build_page_ui_obj->batch_build_button, &QPushButton::clicked, this, &ConfWindow::on_build_batch);
+
+    // Builds lost with the terminal or the session can be continued from their last finished stage.
+    // Their build directories in memory can't, they would hold the memory until reboot.
+    tmpfs_builddir::remove_stale();
+    update_build_queue_status();
+    connect(build_page_ui_obj->resume_build_button, &QPushButton::clicked, this, &ConfWindow::on_resume_build);
+    connect(build_page_ui_obj->discard_build_button, &QPushButton::clicked, this, &ConfWindow::discard_build);
+
+    // Job counts depend on the LTO mode, show what the next build would use.
+    update_parallelism_plan();
+    connect(options_page_ui_obj->lto_combo_box, &QComboBox::currentIndexChanged, this, [this](std::int32_t) {
+        update_parallelism_plan();
+    });
+    connect(build_page_ui_obj->auto_parallelism_check, &QCheckBox::stateChanged, this, [this](std::int32_t) {
+        update_parallelism_plan();
     });
 
     // Setup patches page
@@ -464,7 +824,7 @@ ConfWindow::ConfWindow(QWidget* parent)
     connect_all_checkboxes();
 
     connect(options_page_ui_obj->vma_config_combo_box, &QComboBox::currentIndexChanged, this, [this](std::int32_t) {
-        reset_patches_data_tab();
+        schedule_patches_data_tab_reset();
     });
 
     // local patches
@@ -506,6 +866,30 @@ ConfWindow::ConfWindow(QWidget* parent)
         list_widget_apply_edit_flag(patches_page_ui_obj->list_widget);
     });
 
+    // Fetch patches as soon as they are added, a bad url shows up in the list instead of failing the build.
+    m_patch_prefetch_timer->setSingleShot(true);
+    m_patch_prefetch_timer->setInterval(300);
+    connect(m_patch_prefetch_timer, &QTimer::timeout, this, &ConfWindow::prefetch_patches);
+    connect(patches_page_ui_obj->list_widget->model(), &QAbstractItemModel::rowsInserted, this, [this] { m_patch_prefetch_timer->start(); });
+    connect(patches_page_ui_obj->list_widget, &QListWidget::itemChanged, this, [this] { m_patch_prefetch_timer->start(); });
+    connect(&m_patch_prefetch_watcher, &QFutureWatcher<patch_cache::FetchResult>::resultReadyAt, this, &ConfWindow::on_patch_fetched);
+    connect(&m_patch_prefetch_watcher, &QFutureWatcher<patch_cache::FetchResult>::finished, this, [this] {
+        if (m_patch_prefetch_pending) {
+            m_patch_prefetch_pending = false;
+            prefetch_patches();
+        }
+    });
+
+    // Dry-run the patches in the chosen order, instead of finding a broken one in the middle of the build.
+    connect(patches_page_ui_obj->verify_patches_button, &QPushButton::clicked, this, &ConfWindow::verify_patches);
+    connect(&m_patch_check_watcher, &QFutureWatcher<std::optional<std::vector<patch_check::PatchResult>>>::finished, this, &ConfWindow::on_patches_verified);
+
+    // Builds and the patches check continue once the PKGBUILDs are synced, without blocking the window meanwhile.
+    connect(&m_prepare_watcher, &QFutureWatcher<bool>::finished, this, [this] {
+        auto on_prepared = std::exchange(m_on_prepared, {});
+        on_prepared(m_prepare_watcher.future().result());
+    });
+
     patches_page_ui_obj->remove_entry_button->setIcon(QApplication::style()->standardIcon(QStyle::SP_TrashIcon));
     patches_page_ui_obj->move_up_button->setIcon(QApplication::style()->standardIcon(QStyle::SP_ArrowUp));
     patches_page_ui_obj->move_down_button->setIcon(QApplication::style()->standardIcon(QStyle::SP_ArrowDown));
@@ -532,27 +916,776 @@ ConfWindow::ConfWindow(QWidget* parent)
     });
 }
 
+ConfWindow::~ConfWindow() {
+    // The sync captures the window, the running git command is killed on cancel.
+    m_prepare_cancelled.store(true, std::memory_order_relaxed);
+    m_prepare_watcher.waitForFinished();
+}
+
 void ConfWindow::closeEvent(QCloseEvent* event) {
     QWidget::closeEvent(event);
 }
 
+void ConfWindow::on_build_finished() noexcept {
+    m_running = false;
+    m_usage_timer->stop();
+    update_chroot_status();
+    update_build_queue_status();
+
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+    if (m_progress_timer->isActive()) {
+        m_progress_timer->stop();
+        update_build_progress();
+        build_progress::finish(m_build_progress);
+
+        // Only complete builds are a reference for the ETA of the next one.
+        if (m_build_progress.stage == build_progress::Stage::done) {
+            build_progress::write_reference(m_build_progress);
+        }
+        record_build_history();
+        const auto& summary = build_progress::format_progress(m_build_progress, m_build_progress_reference, m_build_progress.last_output);
+        build_page_ui_obj->build_progress_value_label->setText(QString::fromStdString(summary));
+        fmt::print(stderr, "Build stages: {}\n", summary);
+    }
+    if (m_ccache_enabled) {
+        const auto& stats = compiler_cache::read_stats();
+        build_page_ui_obj->ccache_stats_value_label->setText(stats ? QString::fromStdString(compiler_cache::format_stats(*stats)) : tr("unavailable"));
+    }
+    if (m_distributed_backend == distributed_compile::Backend::distcc) {
+        const auto compiled_objects = build_progress::is_available() ? m_build_progress.compiled_objects : 0;
+        const auto& job_counts      = distributed_compile::format_job_counts(distributed_compile::read_job_counts(), compiled_objects);
+        build_page_ui_obj->distributed_status_value_label->setText(QString::fromStdString(job_counts));
+        fmt::print(stderr, "Distributed jobs: {}\n", job_counts);
+    } else if (m_distributed_backend == distributed_compile::Backend::icecc) {
+        // icecream doesn't log the placement of jobs into a file, icemon shows it live.
+        build_page_ui_obj->distributed_status_value_label->setText(tr("job placement is shown by icemon"));
+    }
+    if (!m_link_timings_label.empty()) {
+        show_link_timings();
+    }
+}
+
+auto ConfWindow::get_binary_cache_store_path() const noexcept -> fs::path {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    const auto& store_dir = build_page_ui_obj->binary_cache_dir_edit->text().trimmed().toStdString();
+    /* clang-format off */
+    if (store_dir.empty()) { return binary_cache::get_default_store_path(); }
+    /* clang-format on */
+    return utils::fix_path(store_dir);
+}
+
+auto ConfWindow::get_package_settings() const noexcept -> makepkg_conf::PackageSettings {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    return makepkg_conf::PackageSettings{
+        .compressor = std::string{get_package_compressor(static_cast<size_t>(build_page_ui_obj->package_compressor_combo_box->currentIndex()))},
+        .threads    = static_cast<std::uint32_t>(build_page_ui_obj->compression_threads_spin_box->value()),
+        .level      = static_cast<std::uint32_t>(build_page_ui_obj->compression_level_spin_box->value()),
+        .debug      = build_page_ui_obj->debug_package_check->isChecked(),
+        .strip      = build_page_ui_obj->strip_check->isChecked(),
+    };
+}
+
+auto ConfWindow::get_local_repo_path() const noexcept -> fs::path {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    const auto& repo_dir = build_page_ui_obj->local_repo_dir_edit->text().trimmed().toStdString();
+    /* clang-format off */
+    if (repo_dir.empty()) { return local_repo::get_default_repo_path(); }
+    /* clang-format on */
+    return utils::fix_path(repo_dir);
+}
+
+auto ConfWindow::get_local_repo_name() const noexcept -> std::string {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    auto repo_name = build_page_ui_obj->local_repo_name_edit->text().trimmed().toStdString();
+    /* clang-format off */
+    if (repo_name.empty()) { return std::string{local_repo::DEFAULT_REPO_NAME}; }
+    /* clang-format on */
+    return repo_name;
+}
+
+void ConfWindow::update_local_repo_conf() noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    const auto& repo_name = get_local_repo_name();
+    if (!local_repo::is_valid_repo_name(repo_name)) {
+        build_page_ui_obj->local_repo_conf_value_label->setText(tr("invalid repository name"));
+        return;
+    }
+    build_page_ui_obj->local_repo_conf_value_label->setText(QString::fromStdString(local_repo::make_pacman_conf_entry(get_local_repo_path(), repo_name)));
+}
+
+void ConfWindow::prefetch_patches() noexcept {
+    // Entries changed during the fetch are picked up once it's done, so one url is never fetched twice at once.
+    if (m_patch_prefetch_watcher.isRunning()) {
+        m_patch_prefetch_pending = true;
+        return;
+    }
+
+    auto* list_widget = m_ui->conf_patches_page_widget->get_ui_obj()->list_widget;
+    const QSignalBlocker blocker(list_widget);
+
+    std::vector<std::string> urls{};
+    for (int i = 0; i < list_widget->count(); ++i) {
+        auto* item = list_widget->item(i);
+        auto url   = patch_cache::parse_patch_url(item->text().toStdString());
+        /* clang-format off */
+        if (!url) { continue; }
+        /* clang-format on */
+
+        // Items are recreated when the patches page is reset, show what is already known.
+        if (auto prefetched_it = m_prefetched_patches.find(*url); prefetched_it != m_prefetched_patches.end()) {
+            mark_patch_item(item, patch_cache::FetchResult{.url = *url, .digest = prefetched_it->second});
+        } else if (std::ranges::find(urls, *url) == urls.end()) {
+            urls.emplace_back(std::move(*url));
+        }
+    }
+    /* clang-format off */
+    if (urls.empty()) { return; }
+    /* clang-format on */
+
+    m_patch_prefetch_watcher.setFuture(QtConcurrent::mapped(std::move(urls), [](const std::string& url) { return patch_cache::fetch(url); }));
+}
+
+void ConfWindow::on_patch_fetched(std::int32_t result_index) noexcept {
+    const auto& result = m_patch_prefetch_watcher.resultAt(result_index);
+    if (result.error.empty()) {
+        m_prefetched_patches[result.url] = result.digest;
+    } else {
+        fmt::print(stderr, "Failed to fetch '{}': {}\n", result.url, result.error);
+    }
+
+    // Marking items must not trigger another prefetch.
+    auto* list_widget = m_ui->conf_patches_page_widget->get_ui_obj()->list_widget;
+    const QSignalBlocker blocker(list_widget);
+    for (int i = 0; i < list_widget->count(); ++i) {
+        auto* item = list_widget->item(i);
+        if (patch_cache::parse_patch_url(item->text().toStdString()) == result.url) {
+            mark_patch_item(item, result);
+        }
+    }
+}
+
+void ConfWindow::verify_patches() noexcept {
+    // The build resets the PKGBUILD, which the check extracts.
+    /* clang-format off */
+    if (m_running || m_patch_check_watcher.isRunning() || m_prepare_watcher.isRunning()) { return; }
+    /* clang-format on */
+
+    auto* patches_page_ui_obj = m_ui->conf_patches_page_widget->get_ui_obj();
+    patches_page_ui_obj->verify_status_label->setText(tr("Syncing PKGBUILDs..."));
+    prepare_build_environment_async([this, patches_page_ui_obj](bool is_prepared) {
+        if (!is_prepared) {
+            patches_page_ui_obj->verify_status_label->setText(tr("Failed to prepare build environment"));
+            return;
+        }
+        start_patches_check();
+    });
+}
+
+void ConfWindow::start_patches_check() noexcept {
+    auto* options_page_ui_obj = m_ui->conf_options_page_widget->get_ui_obj();
+    auto* patches_page_ui_obj = m_ui->conf_patches_page_widget->get_ui_obj();
+
+    const std::int32_t main_combo_index  = options_page_ui_obj->main_combo_box->currentIndex();
+    const std::string_view cpusched_path = get_kernel_name_path(get_kernel_name(static_cast<size_t>(main_combo_index)));
+
+    auto* evaluator            = get_pkgbuild_evaluator(cpusched_path);
+    const auto& all_set_values = get_all_set_values();
+    const auto& pkgbase_values = evaluator->array(all_set_values, "pkgbase");
+    const auto& pkgver_values  = evaluator->array(all_set_values, "pkgver");
+    const auto& srcname_values = evaluator->array(all_set_values, "_srcname");
+    if (pkgbase_values.empty() || pkgver_values.empty() || srcname_values.empty()) {
+        patches_page_ui_obj->verify_status_label->setText(tr("Failed to evaluate the PKGBUILD"));
+        return;
+    }
+
+    const auto& src_array = get_cached_source_array(cpusched_path, all_set_values);
+    auto source_entries   = make_source_cache_entries(evaluator, all_set_values, src_array);
+    const auto& patches   = get_list_widget_items(patches_page_ui_obj->list_widget);
+
+    // Patches of the PKGBUILD, which are still in the list, are applied to the base tree in their order, as prepare() does.
+    // Only the added patches are checked against it.
+    std::vector<std::string> pkgbuild_patches{};
+    for (const auto& source : src_array) {
+        if (source.ends_with(".patch") && std::ranges::find(patches, source) != patches.end()) {
+            pkgbuild_patches.emplace_back(source);
+        }
+    }
+    std::vector<std::string> entries{};
+    std::ranges::copy_if(patches, std::back_inserter(entries), [&src_array](auto&& patch) { return std::ranges::find(src_array, patch) == src_array.end(); });
+    auto base_key = patch_check::make_base_key(pkgver_values.front(), src_array, pkgbuild_patches);
+
+    patches_page_ui_obj->verify_patches_button->setEnabled(false);
+    patches_page_ui_obj->verify_status_label->setText(tr("Verifying %1 patches...").arg(patches.size()));
+
+    // Downloads of the extraction go into the source cache, the next build reuses them.
+    auto check_task = [pkgbuild_dir = fs::path{cpusched_path}, all_set_values, pkgbase = pkgbase_values.front(), srcname = srcname_values.front(),
+                          source_entries = std::move(source_entries), base_key = std::move(base_key), pkgbuild_patches = std::move(pkgbuild_patches),
+                          entries = std::move(entries)]() {
+        source_cache::prepare_srcdest(source_entries);
+        const auto& tree_path = patch_check::prepare_base_tree(pkgbuild_dir, all_set_values, pkgbase, srcname, pkgbuild_patches, base_key);
+        /* clang-format off */
+        if (!tree_path) { return std::optional<std::vector<patch_check::PatchResult>>{}; }
+        /* clang-format on */
+
+        // Conflicts are indexes of the checked entries, the applied patches go after them.
+        auto results = patch_check::check_patches(*tree_path, entries);
+        for (const auto& patch : pkgbuild_patches) {
+            results.emplace_back(patch_check::PatchResult{.entry = patch, .applies_alone = true, .applies_in_order = true});
+        }
+        return std::optional{std::move(results)};
+    };
+    m_patch_check_watcher.setFuture(QtConcurrent::run(std::move(check_task)));
+}
+
+void ConfWindow::on_patches_verified() noexcept {
+    auto* patches_page_ui_obj = m_ui->conf_patches_page_widget->get_ui_obj();
+    patches_page_ui_obj->verify_patches_button->setEnabled(true);
+
+    const auto& results = m_patch_check_watcher.result();
+    if (!results) {
+        patches_page_ui_obj->verify_status_label->setText(tr("Failed to prepare the sources, see the log"));
+        return;
+    }
+
+    // The list may have been edited meanwhile, results are matched by entry.
+    auto* list_widget = patches_page_ui_obj->list_widget;
+    const QSignalBlocker blocker(list_widget);
+    for (int i = 0; i < list_widget->count(); ++i) {
+        auto* item         = list_widget->item(i);
+        const auto& result = std::ranges::find(*results, item->text().toStdString(), &patch_check::PatchResult::entry);
+        if (result != results->end()) {
+            mark_checked_patch_item(item, *result, *results);
+        }
+    }
+
+    const auto failed_count = std::ranges::count_if(*results, [](auto&& result) { return !result.applies_in_order; });
+    if (failed_count == 0) {
+        patches_page_ui_obj->verify_status_label->setText(tr("All %1 patches apply").arg(results->size()));
+    } else {
+        patches_page_ui_obj->verify_status_label->setText(tr("%1 of %2 patches fail").arg(failed_count).arg(results->size()));
+    }
+}
+
+void ConfWindow::update_chroot_status() noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    QString status{};
+    if (!clean_chroot::is_available()) {
+        status = tr("devtools is not installed");
+    } else if (!clean_chroot::has_root()) {
+        status = tr("base chroot is created by the first build");
+    } else {
+        status = clean_chroot::supports_snapshots() ? tr("ready, btrfs snapshots") : tr("ready, copied with rsync");
+    }
+    build_page_ui_obj->chroot_status_value_label->setText(status);
+}
+
+void ConfWindow::update_build_progress() noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    build_progress::update(m_build_progress, now);
+    build_page_ui_obj->build_progress_value_label->setText(QString::fromStdString(build_progress::format_progress(m_build_progress, m_build_progress_reference, now)));
+
+    // Pages of the tmpfs can go only to swap, warn once the memory gets low.
+    if (m_build_in_tmpfs && !m_tmpfs_memory_warned) {
+        if (const auto& warning = tmpfs_builddir::check_memory()) {
+            m_tmpfs_memory_warned = true;
+            build_page_ui_obj->tmpfs_status_value_label->setText(QString::fromStdString(*warning));
+            fmt::print(stderr, "{}\n", *warning);
+        }
+    }
+}
+
+void ConfWindow::record_build_history() noexcept {
+    /* clang-format off */
+    if (m_build_progress.stage == build_progress::Stage::none) { return; }
+    /* clang-format on */
+
+    // Peak memory is known only for builds in the scope.
+    const auto& resources = build_resources::read_system_resources();
+    build_history::append_record({
+        .timestamp       = m_build_progress.last_output,
+        .cpus            = resources.cpus,
+        .mem_total_mib   = resources.mem_total_kib / 1024,
+        .succeeded       = m_build_progress.stage == build_progress::Stage::done,
+        .peak_memory_mib = m_build_unit_name.empty() ? 0 : m_build_peak_memory / (1024 * 1024),
+        .build_mode      = m_build_mode,
+        .stage_seconds   = m_build_progress.stage_seconds,
+        .options         = m_build_options,
+    });
+    update_build_prediction();
+    update_module_db_status();
+}
+
+void ConfWindow::add_to_batch() noexcept {
+    auto* options_page_ui_obj = m_ui->conf_options_page_widget->get_ui_obj();
+    auto* build_page_ui_obj   = m_ui->conf_build_page_widget->get_ui_obj();
+    auto* patches_page_ui_obj = m_ui->conf_patches_page_widget->get_ui_obj();
+
+    const std::string_view kernel_name = get_kernel_name(static_cast<size_t>(options_page_ui_obj->main_combo_box->currentIndex()));
+    build_batch::BatchEntry entry{
+        .label        = std::string{kernel_name},
+        .pkgbuild_dir = std::string{get_kernel_name_path(kernel_name)},
+        .options_set  = get_all_set_values(),
+        .lto_mode     = std::string{get_lto_mode(static_cast<size_t>(options_page_ui_obj->lto_combo_box->currentIndex()))},
+        .patches      = get_list_widget_items(patches_page_ui_obj->list_widget),
+        .custom_name  = options_page_ui_obj->custom_name_edit->text().toStdString(),
+    };
+
+    // The same variant with the same options would be built twice for nothing.
+    const bool is_duplicate = std::ranges::any_of(m_batch_entries, [&entry](auto&& batch_entry) {
+        return batch_entry.pkgbuild_dir == entry.pkgbuild_dir && batch_entry.options_set == entry.options_set
+            && batch_entry.patches == entry.patches && batch_entry.custom_name == entry.custom_name;
+    });
+    /* clang-format off */
+    if (is_duplicate) { return; }
+    /* clang-format on */
+
+    m_batch_entries.emplace_back(std::move(entry));
+    build_page_ui_obj->batch_entries_value_label->setText(QString::fromStdString(build_batch::format_entries(m_batch_entries)));
+}
+
+void ConfWindow::clear_batch() noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+    m_batch_entries.clear();
+    build_page_ui_obj->batch_entries_value_label->setText("-");
+}
+
+void ConfWindow::on_build_batch() noexcept {
+    // Skip execution of the batch, if already a build is running or the patches are being verified
+    /* clang-format off */
+    if (m_running || m_patch_check_watcher.isRunning() || m_prepare_watcher.isRunning() || m_batch_entries.empty()) { return; }
+    /* clang-format on */
+    m_running = true;
+
+    // Resets the PKGBUILDs, every entry gets its own copy with its patches and custom name.
+    prepare_build_environment_async([this](bool is_prepared) {
+        if (!is_prepared) {
+            m_running = false;
+            fmt::print(stderr, "Failed to prepare build environment\n");
+            return;
+        }
+        build_batch();
+    });
+}
+
+void ConfWindow::build_batch() noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    // Sources of all entries go into the shared SRCDEST, so the kernel tarball is fetched once.
+    const bool reuse_tree = build_page_ui_obj->reuse_tree_check->isChecked();
+    auto entries          = m_batch_entries;
+    std::error_code err_code{};
+    fs::remove_all(build_batch::get_pending_batch_path(), err_code);
+    std::vector<source_cache::SourceEntry> source_entries{};
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        auto& entry = entries[i];
+
+        const auto& orig_src_array = get_cached_source_array(entry.pkgbuild_dir, entry.options_set);
+        const auto& pkgbuild_copy  = build_batch::copy_pkgbuild(i, entry);
+        if (orig_src_array.empty() || !pkgbuild_copy) {
+            m_running = false;
+            fmt::print(stderr, "Failed to prepare the PKGBUILD of '{}'\n", entry.pkgbuild_dir);
+            return;
+        }
+        const auto& copy_dir = pkgbuild_copy->string();
+        if (!insert_new_source_array_into_pkgbuild(copy_dir, entry.patches, orig_src_array) || !set_custom_name_in_pkgbuild(copy_dir, entry.custom_name)) {
+            m_running = false;
+            fmt::print(stderr, "Failed to apply the patches and the custom name to '{}/PKGBUILD'\n", copy_dir);
+            return;
+        }
+        entry.pkgbuild_dir = fs::absolute(*pkgbuild_copy).string();
+
+        auto* evaluator            = get_pkgbuild_evaluator(entry.pkgbuild_dir);
+        const auto& pkgbase_values = evaluator->array(entry.options_set, "pkgbase");
+        if (pkgbase_values.empty()) {
+            m_running = false;
+            fmt::print(stderr, "Failed to evaluate pkgbase of '{}'\n", entry.pkgbuild_dir);
+            return;
+        }
+        const auto& src_array     = get_cached_source_array(entry.pkgbuild_dir, entry.options_set);
+        const auto& entry_sources = make_source_cache_entries(evaluator, entry.options_set, src_array);
+        source_entries.insert(source_entries.end(), entry_sources.begin(), entry_sources.end());
+
+        entry.pkgbase = pkgbase_values.front();
+        if (reuse_tree && tree_cache::is_reusable(entry.options_set)) {
+            entry.tree_key = tree_cache::compute_key(fmt::format(FMT_COMPILE("{}/PKGBUILD"), entry.pkgbuild_dir), entry.options_set, src_array);
+        }
+    }
+    const auto reused_sources = source_cache::prepare_srcdest(source_entries);
+    fmt::print(stderr, "Reusing {} of {} cached sources\n", reused_sources, source_entries.size());
+    if (setenv("SRCDEST", source_cache::get_srcdest_path().c_str(), 1) != 0) {
+        fmt::print(stderr, "Cannot set environment variable!: {}\n", std::strerror(errno));
+    }
+    if (reuse_tree) {
+        tree_cache::prune_snapshots(std::max<std::size_t>(2, entries.size()), {});
+    }
+
+    const auto& plan = build_batch::plan_batch(build_resources::read_system_resources(), entries);
+    std::string makepkg_conf_path{};
+    if (const auto& conf_path = makepkg_conf::write(makepkg_conf::format_package_settings(get_package_settings()) + makepkg_conf::format_makeflags(plan.compile_jobs))) {
+        makepkg_conf_path = conf_path->string();
+    } else {
+        fmt::print(stderr, "Failed to write makepkg.conf, using the system one\n");
+    }
+
+    const auto& status = fmt::format(FMT_COMPILE("{}\n{}"), build_batch::format_entries(entries), plan.reason);
+    build_page_ui_obj->batch_entries_value_label->setText(QString::fromStdString(status));
+    fmt::print(stderr, "Batch: {}\n", plan.reason);
+
+    // Nothing of the single build is tracked, every entry has its own log.
+    m_ccache_enabled      = false;
+    m_distributed_backend = distributed_compile::Backend::none;
+    m_link_timings_label.clear();
+    m_build_unit_name.clear();
+    run_cmd_async(build_batch::make_batch_command(entries, plan, makepkg_conf_path, m_previously_set_options), [this] { on_build_finished(); });
+}
+
+auto ConfWindow::get_build_mode() const noexcept -> std::string {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+    if (build_page_ui_obj->clean_chroot_check->isChecked() && clean_chroot::is_available()) {
+        return "chroot";
+    }
+
+    std::string build_mode{};
+    const std::array<std::pair<QCheckBox*, std::string_view>, 4> features{{
+        {build_page_ui_obj->reuse_tree_check, "tree"},
+        {build_page_ui_obj->incremental_build_check, "incremental"},
+        {build_page_ui_obj->ccache_check, "ccache"},
+        {build_page_ui_obj->thinlto_cache_check, "thinlto-cache"},
+    }};
+    for (const auto& [checkbox, feature] : features) {
+        if (checkbox->isEnabled() && checkbox->isChecked()) {
+            build_mode += fmt::format(FMT_COMPILE("{}{}"), build_mode.empty() ? "" : ",", feature);
+        }
+    }
+
+    auto* options_page_ui_obj       = m_ui->conf_options_page_widget->get_ui_obj();
+    const std::string_view lto_mode = get_lto_mode(static_cast<size_t>(options_page_ui_obj->lto_combo_box->currentIndex()));
+    if (const std::string_view pgo_mode = get_pgo_mode(static_cast<size_t>(build_page_ui_obj->pgo_mode_combo_box->currentIndex())); pgo_mode != "none" && lto_mode != "none") {
+        build_mode += fmt::format(FMT_COMPILE("{}{}"), build_mode.empty() ? "" : ",", pgo_mode);
+    }
+    if (const auto backend = get_distributed_backend(); distributed_compile::is_available(backend)) {
+        build_mode += fmt::format(FMT_COMPILE("{}{}"), build_mode.empty() ? "" : ",", distributed_compile::get_backend_name(backend));
+    }
+    return build_mode.empty() ? "clean" : build_mode;
+}
+
+void ConfWindow::update_build_prediction() noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    const auto& resources  = build_resources::read_system_resources();
+    const auto& prediction = build_history::predict(build_history::read_records(), build_history::normalize_options(get_all_set_values()),
+        get_build_mode(), resources.cpus, resources.mem_total_kib / 1024);
+    if (!prediction) {
+        build_page_ui_obj->build_prediction_value_label->setText(tr("no builds with these options yet"));
+        return;
+    }
+
+    const auto& duration = QString::fromStdString(build_progress::format_duration(prediction->seconds));
+    if (prediction->is_scaled) {
+        build_page_ui_obj->build_prediction_value_label->setText(tr("~%1, scaled from %2 build(s) on other hosts").arg(duration).arg(prediction->sample_count));
+    } else {
+        build_page_ui_obj->build_prediction_value_label->setText(tr("~%1, average of %2 build(s)").arg(duration).arg(prediction->sample_count));
+    }
+}
+
+void ConfWindow::show_build_comparison() noexcept {
+    const auto& rows = build_history::make_comparison(build_history::read_records());
+
+    auto* dialog = new QDialog(this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->setWindowTitle(tr("Build history"));
+
+    auto* table = new QTableWidget(static_cast<int>(rows.size()), 8, dialog);
+    table->setHorizontalHeaderLabels({tr("Host"), tr("Mode"), tr("Options"), tr("Builds"), tr("Failed"), tr("Average"), tr("Compile"), tr("Peak memory")});
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    table->verticalHeader()->hide();
+    for (int i = 0; i < static_cast<int>(rows.size()); ++i) {
+        const auto& row         = rows[static_cast<std::size_t>(i)];
+        const bool has_duration = row.build_count > row.failed_count;
+        table->setItem(i, 0, new QTableWidgetItem(QString::fromStdString(row.host)));
+        table->setItem(i, 1, new QTableWidgetItem(QString::fromStdString(row.build_mode)));
+        table->setItem(i, 2, new QTableWidgetItem(row.options.empty() ? QString{"-"} : QString::fromStdString(row.options)));
+        table->setItem(i, 3, new QTableWidgetItem(QString::number(row.build_count)));
+        table->setItem(i, 4, new QTableWidgetItem(QString::number(row.failed_count)));
+        table->setItem(i, 5, new QTableWidgetItem(has_duration ? QString::fromStdString(build_progress::format_duration(row.avg_seconds)) : QString{"-"}));
+        table->setItem(i, 6, new QTableWidgetItem(has_duration ? QString::fromStdString(build_progress::format_duration(row.avg_compile_seconds)) : QString{"-"}));
+        table->setItem(i, 7, new QTableWidgetItem((row.peak_memory_mib > 0) ? tr("%1 MiB").arg(row.peak_memory_mib) : QString{"-"}));
+    }
+    table->resizeColumnsToContents();
+    table->horizontalHeader()->setStretchLastSection(true);
+
+    auto* layout = new QVBoxLayout(dialog);
+    layout->addWidget(table);
+    dialog->resize(900, 400);
+    dialog->show();
+}
+
+void ConfWindow::update_build_usage() noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    // The scope appears only once the terminal has started the command.
+    if (!m_build_cgroup_path) {
+        m_build_cgroup_path = build_scope::find_cgroup_path(m_build_unit_name);
+        /* clang-format off */
+        if (!m_build_cgroup_path) { return; }
+        /* clang-format on */
+    }
+
+    auto usage = build_scope::read_usage(*m_build_cgroup_path);
+    /* clang-format off */
+    if (!usage) { return; }
+    /* clang-format on */
+    if (m_last_build_usage) {
+        build_page_ui_obj->build_usage_value_label->setText(QString::fromStdString(build_scope::format_usage(*m_last_build_usage, *usage)));
+    }
+    m_build_peak_memory = std::max({m_build_peak_memory, usage->memory_current, usage->memory_peak});
+    m_last_build_usage  = std::move(usage);
+}
+
+void ConfWindow::update_parallelism_plan() noexcept {
+    auto* options_page_ui_obj = m_ui->conf_options_page_widget->get_ui_obj();
+    auto* build_page_ui_obj   = m_ui->conf_build_page_widget->get_ui_obj();
+
+    if (!build_page_ui_obj->auto_parallelism_check->isChecked()) {
+        build_page_ui_obj->parallelism_plan_value_label->setText(tr("MAKEFLAGS of makepkg.conf"));
+        return;
+    }
+
+    const std::string_view lto_mode = get_lto_mode(static_cast<size_t>(options_page_ui_obj->lto_combo_box->currentIndex()));
+    const auto& plan                = build_resources::plan_jobs(build_resources::read_system_resources(), lto_mode);
+    build_page_ui_obj->parallelism_plan_value_label->setText(QString::fromStdString(format_parallelism_plan(plan, get_distributed_slots())));
+}
+
+auto ConfWindow::get_distributed_backend() const noexcept -> distributed_compile::Backend {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+    return distributed_compile::parse_backend(get_distributed_compiler(static_cast<size_t>(build_page_ui_obj->distributed_compile_combo_box->currentIndex())));
+}
+
+auto ConfWindow::get_distributed_hosts() const noexcept -> std::string {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+    /* clang-format off */
+    if (get_distributed_backend() != distributed_compile::Backend::distcc) { return {}; }
+    /* clang-format on */
+    return distributed_compile::read_hosts(build_page_ui_obj->distcc_hosts_edit->text().trimmed().toStdString());
+}
+
+auto ConfWindow::get_distributed_slots() const noexcept -> std::uint32_t {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    const auto backend = get_distributed_backend();
+    /* clang-format off */
+    if (!distributed_compile::is_available(backend)) { return 0; }
+    /* clang-format on */
+
+    // The icecream scheduler doesn't tell its slots, they must be set.
+    if (const auto configured_slots = build_page_ui_obj->remote_slots_spin_box->value(); configured_slots > 0) {
+        return static_cast<std::uint32_t>(configured_slots);
+    }
+    return distributed_compile::count_remote_slots(distributed_compile::parse_hosts(get_distributed_hosts()));
+}
+
+void ConfWindow::update_distributed_status() noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    const auto backend = get_distributed_backend();
+    build_page_ui_obj->distcc_hosts_edit->setEnabled(backend == distributed_compile::Backend::distcc);
+    build_page_ui_obj->remote_slots_spin_box->setEnabled(backend != distributed_compile::Backend::none);
+    update_parallelism_plan();
+
+    if (backend == distributed_compile::Backend::none) {
+        build_page_ui_obj->distributed_status_value_label->setText("-");
+        return;
+    }
+    if (!distributed_compile::is_available(backend)) {
+        build_page_ui_obj->distributed_status_value_label->setText(tr("%1 is not installed").arg(QString::fromUtf8(distributed_compile::get_backend_name(backend).data())));
+        return;
+    }
+
+    const auto& hosts = (backend == distributed_compile::Backend::distcc)
+        ? distributed_compile::format_hosts(distributed_compile::parse_hosts(get_distributed_hosts()))
+        : std::string{"hosts of the scheduler"};
+    const auto& status = fmt::format(FMT_COMPILE("{}, make runs {} extra jobs"), hosts, get_distributed_slots());
+    build_page_ui_obj->distributed_status_value_label->setText(QString::fromStdString(status));
+}
+
+auto ConfWindow::get_pgo_selection(std::string_view kernel_name_path, std::string_view options_set) noexcept -> std::optional<kernel_pgo::Selection> {
+    auto* options_page_ui_obj = m_ui->conf_options_page_widget->get_ui_obj();
+    auto* build_page_ui_obj   = m_ui->conf_build_page_widget->get_ui_obj();
+
+    // Host builds with clang only, the PKGBUILD uses clang for the LTO modes.
+    const std::string_view pgo_mode = get_pgo_mode(static_cast<size_t>(build_page_ui_obj->pgo_mode_combo_box->currentIndex()));
+    const std::string_view lto_mode = get_lto_mode(static_cast<size_t>(options_page_ui_obj->lto_combo_box->currentIndex()));
+    const bool use_chroot           = build_page_ui_obj->clean_chroot_check->isChecked() && clean_chroot::is_available();
+    /* clang-format off */
+    if (pgo_mode == "none" || lto_mode == "none" || use_chroot) { return std::nullopt; }
+    /* clang-format on */
+
+    const auto& pkgver_values = get_pkgbuild_evaluator(kernel_name_path)->array(options_set, "pkgver");
+    if (pkgver_values.empty()) {
+        return kernel_pgo::Selection{.reason = "failed to evaluate pkgver, building without a profile"};
+    }
+    return kernel_pgo::select_profile(kernel_pgo::load_profiles(), pkgver_values.front(), pgo_mode == "propeller");
+}
+
+void ConfWindow::update_pgo_status() noexcept {
+    auto* options_page_ui_obj = m_ui->conf_options_page_widget->get_ui_obj();
+    auto* build_page_ui_obj   = m_ui->conf_build_page_widget->get_ui_obj();
+
+    const std::string_view pgo_mode = get_pgo_mode(static_cast<size_t>(build_page_ui_obj->pgo_mode_combo_box->currentIndex()));
+    build_page_ui_obj->pgo_workload_edit->setEnabled(pgo_mode != "none");
+    build_page_ui_obj->pgo_record_button->setEnabled(pgo_mode != "none" && kernel_pgo::is_available());
+    if (pgo_mode == "none") {
+        build_page_ui_obj->pgo_status_value_label->setText("-");
+        return;
+    }
+    if (get_lto_mode(static_cast<size_t>(options_page_ui_obj->lto_combo_box->currentIndex())) == std::string_view{"none"}) {
+        build_page_ui_obj->pgo_status_value_label->setText(tr("needs clang, select an LTO mode"));
+        return;
+    }
+
+    // Profile which a rebuild of the running kernel would use.
+    const auto now        = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    const auto& release   = kernel_pgo::get_running_release();
+    const auto& selection = kernel_pgo::select_profile(kernel_pgo::load_profiles(), kernel_pgo::get_release_version(release), pgo_mode == "propeller");
+    auto status           = selection.profile ? kernel_pgo::format_profile(*selection.profile, now) : selection.reason;
+    if (!kernel_pgo::is_available()) {
+        status += ", install perf and autofdo to record profiles";
+    }
+    build_page_ui_obj->pgo_status_value_label->setText(QString::fromStdString(status));
+}
+
+void ConfWindow::update_module_db_status() noexcept {
+    auto* options_page_ui_obj = m_ui->conf_options_page_widget->get_ui_obj();
+    auto* build_page_ui_obj   = m_ui->conf_build_page_widget->get_ui_obj();
+
+    const auto& modules = module_db::read_db();
+    if (modules.empty()) {
+        build_page_ui_obj->module_db_status_value_label->setText(tr("empty, localmodcfg uses the loaded modules"));
+        return;
+    }
+
+    const auto total_count = module_db::get_total_module_count();
+    const auto savings     = module_db::estimate_savings(modules.size(), total_count);
+    auto status            = tr("%1 of %2 modules, ~%3% less build time").arg(modules.size()).arg(total_count).arg(qRound(savings * 100));
+
+    // With localmodcfg checked the prediction is already of the smaller build.
+    if (!options_page_ui_obj->localmodcfg_check->isChecked()) {
+        const auto& resources  = build_resources::read_system_resources();
+        const auto& prediction = build_history::predict(build_history::read_records(), build_history::normalize_options(get_all_set_values()),
+            get_build_mode(), resources.cpus, resources.mem_total_kib / 1024);
+        if (prediction) {
+            const auto saved_secs = static_cast<std::int64_t>(static_cast<double>(prediction->seconds) * savings);
+            status += tr(", about %1 saved").arg(QString::fromStdString(build_progress::format_duration(saved_secs)));
+        }
+    }
+    build_page_ui_obj->module_db_status_value_label->setText(status);
+}
+
+void ConfWindow::on_module_collector_toggled(bool checked) noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    if (!checked) {
+        if (!module_db::disable_collector()) {
+            fmt::print(stderr, "Failed to disable the module collector\n");
+        }
+        return;
+    }
+
+    // Start with the modules loaded now, the timer adds the rest.
+    module_db::collect();
+    if (!module_db::enable_collector(QCoreApplication::applicationFilePath().toStdString())) {
+        const QSignalBlocker blocker(build_page_ui_obj->module_collector_check);
+        build_page_ui_obj->module_collector_check->setChecked(false);
+        build_page_ui_obj->module_db_status_value_label->setText(tr("failed to enable the systemd user timer"));
+        return;
+    }
+    update_module_db_status();
+}
+
+void ConfWindow::on_record_pgo_profile() noexcept {
+    /* clang-format off */
+    if (m_running) { return; }
+    /* clang-format on */
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    // Samples of taken branches with their branch records, AutoFDO can't use plain cycle samples.
+    const auto& perf_event = kernel_pgo::get_perf_event(utils::read_whole_file("/proc/cpuinfo"));
+    if (perf_event.empty()) {
+        build_page_ui_obj->pgo_status_value_label->setText(tr("the CPU has no branch records (LBR, BRS), profiles can't be recorded"));
+        return;
+    }
+    m_running = true;
+
+    const std::string_view pgo_mode = get_pgo_mode(static_cast<size_t>(build_page_ui_obj->pgo_mode_combo_box->currentIndex()));
+    const auto& workload            = build_page_ui_obj->pgo_workload_edit->text().trimmed().toStdString();
+    const auto now                  = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    run_cmd_async(kernel_pgo::make_record_command(kernel_pgo::get_running_release(), workload, PGO_RECORD_SECONDS, pgo_mode == "propeller", perf_event, now),
+        [this] {
+            m_running = false;
+            update_pgo_status();
+        });
+}
+
+void ConfWindow::show_link_timings() noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    const auto& timings = link_tools::parse_timings_log(utils::read_whole_file(link_tools::get_timings_log_path().string()));
+    if (timings.vmlinux_o_ms == 0 && timings.vmlinux_ms == 0 && timings.modules_count == 0) {
+        build_page_ui_obj->link_timings_result_value_label->setText(tr("no links recorded"));
+        return;
+    }
+
+    // Compare with the previous build of the same LTO mode and host linker.
+    const auto& history = link_tools::read_history();
+    const auto& previous = std::find_if(history.rbegin(), history.rend(), [this](auto&& record) { return record.label == m_link_timings_label; });
+
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    link_tools::append_history({.timestamp = static_cast<std::int64_t>(now), .label = m_link_timings_label, .timings = timings});
+
+    auto text = fmt::format(FMT_COMPILE("{}: {}"), m_link_timings_label, link_tools::format_timings(timings));
+    if (previous != history.rend()) {
+        text += fmt::format(FMT_COMPILE("\nprevious: {}"), link_tools::format_timings(previous->timings));
+    }
+    build_page_ui_obj->link_timings_result_value_label->setText(QString::fromStdString(text));
+}
+
 void ConfWindow::on_cancel() noexcept {
     close();
 }
 
 void ConfWindow::on_execute() noexcept {
-    // Skip execution of the build, if already one is running
+    // Skip execution of the build, if already one is running or the patches are being verified
     /* clang-format off */
-    if (m_running) { return; }
+    if (m_running || m_patch_check_watcher.isRunning() || m_prepare_watcher.isRunning()) { return; }
     /* clang-format on */
     m_running = true;
 
+    // Resets the PKGBUILDs, fetch is skipped if it has been done recently.
+    prepare_build_environment_async([this](bool is_prepared) {
+        if (!is_prepared) {
+            m_running = false;
+            fmt::print(stderr, "Failed to prepare build environment\n");
+            return;
+        }
+        execute_build();
+    });
+}
+
+void ConfWindow::execute_build() noexcept {
     auto* options_page_ui_obj = m_ui->conf_options_page_widget->get_ui_obj();
     auto* patches_page_ui_obj = m_ui->conf_patches_page_widget->get_ui_obj();
+    auto* build_page_ui_obj   = m_ui->conf_build_page_widget->get_ui_obj();
 
     const std::int32_t main_combo_index  = options_page_ui_obj->main_combo_box->currentIndex();
     const std::string_view cpusched_path = get_kernel_name_path(get_kernel_name(static_cast<size_t>(main_combo_index)));
-    utils::prepare_build_environment();
 
     // Restore clean environment.
     const auto& all_set_values = get_all_set_values();
@@ -560,8 +1693,14 @@ void ConfWindow::on_execute() noexcept {
 
     // Only files which end with .patch,
     // are considered as patches.
-    const auto& orig_src_array = get_source_array_from_pkgbuild(cpusched_path, all_set_values);
-    auto insert_status         = insert_new_source_array_into_pkgbuild(cpusched_path, patches_page_ui_obj->list_widget, orig_src_array);
+    const auto& orig_src_array = get_cached_source_array(cpusched_path, all_set_values);
+    // The kernel tarball is in it, a build with an empty source array can't succeed.
+    if (orig_src_array.empty()) {
+        m_running = false;
+        fmt::print(stderr, "Failed to evaluate the source array of '{}/PKGBUILD', the build is not started\n", cpusched_path);
+        return;
+    }
+    auto insert_status = insert_new_source_array_into_pkgbuild(cpusched_path, get_list_widget_items(patches_page_ui_obj->list_widget), orig_src_array);
     if (!insert_status) {
         m_running = false;
         fmt::print(stderr, "Failed to insert new source array into pkgbuild\n");
@@ -574,8 +1713,390 @@ void ConfWindow::on_execute() noexcept {
         fmt::print(stderr, "Failed to set custom name in pkgbuild\n");
         return;
     }
+    // Profile-guided build, with the stored profile of the same kernel series if there is one.
+    const std::string_view pgo_mode = get_pgo_mode(static_cast<size_t>(build_page_ui_obj->pgo_mode_combo_box->currentIndex()));
+    const auto& pgo_selection       = get_pgo_selection(cpusched_path, all_set_values);
+
+    // Build in a snapshot of the base chroot, makedepends aren't installed on the host.
+    const bool use_chroot = build_page_ui_obj->clean_chroot_check->isChecked() && clean_chroot::is_available();
+
+    // Install the packages of an earlier build with the same inputs, maybe built by another machine.
+    std::string publish_dir{};
+    if (build_page_ui_obj->binary_cache_check->isChecked() && binary_cache::is_cacheable(all_set_values)) {
+        // Package settings change the produced files (compression, debug packages), they are inputs too.
+        // A chroot build uses makepkg.conf of the chroot, they don't apply to it.
+        const auto& store_path       = get_binary_cache_store_path();
+        const auto& package_settings = use_chroot ? std::string{} : makepkg_conf::format_package_settings(get_package_settings());
+        // So is the profile of a profile-guided build.
+        const auto& pgo_inputs       = pgo_selection ? fmt::format(FMT_COMPILE("pgo {} {}\n"), pgo_mode, pgo_selection->profile ? pgo_selection->profile->dir.string() : "") : std::string{};
+        const auto& build_inputs     = fmt::format(FMT_COMPILE("{}{}{}"), all_set_values, package_settings, pgo_inputs);
+        const auto& fingerprint      = binary_cache::compute_fingerprint(fmt::format(FMT_COMPILE("{}/PKGBUILD"), cpusched_path),
+            build_inputs, get_list_widget_items(patches_page_ui_obj->list_widget));
+
+        if (!binary_cache::lookup_packages(store_path, fingerprint).empty()) {
+            build_page_ui_obj->binary_cache_status_value_label->setText(tr("installing cached build %1").arg(QString::fromStdString(fingerprint.substr(0, 12))));
+
+            const build_pipeline::BuildSettings install_settings{.notice = fmt::format(FMT_COMPILE("Installing cached build {}"), fingerprint),
+                .cached_entry = binary_cache::get_entry_path(store_path, fingerprint).string()};
+            m_ccache_enabled      = false;
+            m_distributed_backend = distributed_compile::Backend::none;
+            m_link_timings_label.clear();
+            m_build_unit_name.clear();
+            run_cmd_async(build_pipeline::make_build_command(install_settings), [this] { on_build_finished(); });
+            return;
+        }
+        build_page_ui_obj->binary_cache_status_value_label->setText(tr("building %1, it will be stored").arg(QString::fromStdString(fingerprint.substr(0, 12))));
+        publish_dir = binary_cache::get_entry_path(store_path, fingerprint).string();
+    }
+
+    // Reuse sources downloaded by previous builds, they are kept outside of the git checkout.
+    const auto& source_entries = make_source_cache_entries(get_pkgbuild_evaluator(cpusched_path), all_set_values, orig_src_array);
+    const auto reused_sources  = source_cache::prepare_srcdest(source_entries);
+    fmt::print(stderr, "Reusing {} of {} cached sources\n", reused_sources, source_entries.size());
+    if (setenv("SRCDEST", source_cache::get_srcdest_path().c_str(), 1) != 0) {
+        fmt::print(stderr, "Cannot set environment variable!: {}\n", std::strerror(errno));
+    }
+    // Patches fetched by the patches page, only their checksum is verified now.
+    patch_cache::link_into_srcdest(get_list_widget_items(patches_page_ui_obj->list_widget), source_cache::get_srcdest_path());
+
+    build_pipeline::BuildSettings build_settings{.srcdir = (fs::absolute(cpusched_path) / "src").string(), .publish_dir = std::move(publish_dir)};
+
+    // The caches below live on the host, they are used only by host builds.
+    if (use_chroot) {
+        if (!set_options_in_pkgbuild(cpusched_path, all_set_values)) {
+            m_running = false;
+            fmt::print(stderr, "Failed to set options in pkgbuild\n");
+            return;
+        }
+        build_settings.chroot_dir = clean_chroot::get_chroot_path().string();
+    }
+
+    // Publish the packages, other hosts then install them from the repository instead of building.
+    if (build_page_ui_obj->local_repo_check->isChecked() && local_repo::is_available()) {
+        const auto& repo_name = get_local_repo_name();
+        if (local_repo::is_valid_repo_name(repo_name)) {
+            const auto& repo_path       = get_local_repo_path();
+            build_settings.repo_dir     = repo_path.string();
+            build_settings.repo_db_path = local_repo::get_db_path(repo_path, repo_name).string();
+        } else {
+            fmt::print(stderr, "Invalid repository name '{}', packages won't be published\n", repo_name);
+        }
+    }
+
+    // Keep the built tree between builds, and rebuild only what changed.
+    if (!use_chroot && build_page_ui_obj->incremental_build_check->isChecked()) {
+        setup_incremental_build(get_pkgbuild_evaluator(cpusched_path), all_set_values, build_settings);
+    }
+
+    // Build directory in memory, the incremental tree must survive the build and the chroot has its own.
+    const std::string_view lto_mode = get_lto_mode(static_cast<size_t>(options_page_ui_obj->lto_combo_box->currentIndex()));
+    m_tmpfs_memory_warned           = false;
+    if (!use_chroot && !build_settings.incremental && build_page_ui_obj->tmpfs_builddir_check->isChecked()) {
+        const auto& reason = setup_tmpfs_builddir(get_pkgbuild_evaluator(cpusched_path), all_set_values,
+            options_page_ui_obj->localmodcfg_check->isChecked(), lto_mode, build_settings);
+        build_page_ui_obj->tmpfs_status_value_label->setText(QString::fromStdString(reason));
+        fmt::print(stderr, "Build directory: {}\n", reason);
+    }
+
+    // Build in a job directory, which survives the manager and the terminal, so the build can be resumed.
+    // Incremental builds keep their tree anyway, the chroot and the tmpfs don't survive.
+    if (!use_chroot && !build_settings.incremental && build_settings.ram_builddir.empty() && build_page_ui_obj->resumable_build_check->isChecked()) {
+        setup_build_job(get_pkgbuild_evaluator(cpusched_path), cpusched_path, all_set_values, build_settings);
+    }
+
+    // Persistent ThinLTO cache, kbuild uses it only with Thin LTO.
+    if (!use_chroot && build_page_ui_obj->thinlto_cache_check->isChecked() && lto_mode == "thin") {
+        const auto& srcname_values = get_pkgbuild_evaluator(cpusched_path)->array(all_set_values, "_srcname");
+        if (!srcname_values.empty()) {
+            build_settings.thinlto_cache_dir = link_tools::get_thinlto_cache_path().string();
+            build_settings.kernel_srcname    = srcname_values.front();
+        } else {
+            fmt::print(stderr, "Failed to evaluate _srcname, ThinLTO cache is disabled\n");
+        }
+    }
+
+    // Without a profile the build is only ready to be profiled, the Kconfig symbols are needed in both cases.
+    if (pgo_selection) {
+        const auto& srcname_values = get_pkgbuild_evaluator(cpusched_path)->array(all_set_values, "_srcname");
+        if (!srcname_values.empty()) {
+            build_settings.kernel_srcname  = srcname_values.front();
+            build_settings.kconfig_symbols = kernel_pgo::get_config_symbols(pgo_mode == "propeller");
+            build_settings.keep_vmlinux    = true;
+
+            const auto& pgo_environment = kernel_pgo::make_environment(*pgo_selection);
+            build_settings.environment.insert(build_settings.environment.end(), pgo_environment.begin(), pgo_environment.end());
+            build_page_ui_obj->pgo_status_value_label->setText(QString::fromStdString(pgo_selection->reason));
+            fmt::print(stderr, "Profile-guided build: {}\n", pgo_selection->reason);
+        } else {
+            fmt::print(stderr, "Failed to evaluate _srcname, profile-guided optimization is disabled\n");
+        }
+    }
+
+    // Modules of the database instead of just the loaded ones, PKGBUILD passes the file to make localmodconfig as LSMOD.
+    // makechrootpkg doesn't pass the environment, the chroot build uses the modules loaded on the host.
+    if (!use_chroot && options_page_ui_obj->localmodcfg_check->isChecked()) {
+        if (const auto module_count = module_db::collect(); module_count > 0) {
+            build_settings.environment.emplace_back("_localmodcfg_path", module_db::get_db_path().string());
+            fmt::print(stderr, "Building {} modules of the module database\n", module_count);
+        }
+    }
+
+    // Only host tools can use another linker, vmlinux and modules are linked by kbuild with LD.
+    // makechrootpkg doesn't pass HOSTLDFLAGS into the chroot, the chroot has only base-devel anyway.
+    const std::string_view host_linker = get_host_linker(static_cast<size_t>(build_page_ui_obj->host_linker_combo_box->currentIndex()));
+    if (use_chroot) {
+        if (host_linker != "default") {
+            fmt::print(stderr, "Clean chroot build, using the default linker for host tools\n");
+        }
+    } else if (link_tools::is_linker_available(host_linker)) {
+        if (const auto& host_ldflags = link_tools::get_host_ldflags(host_linker); !host_ldflags.empty()) {
+            build_settings.environment.emplace_back("HOSTLDFLAGS", host_ldflags);
+        }
+    } else {
+        fmt::print(stderr, "Linker '{}' is not installed, using the default one\n", host_linker);
+    }
+
+    // Compiler cache, shared by all variants and kept between builds.
+    m_ccache_enabled = !use_chroot && build_page_ui_obj->ccache_check->isChecked();
+    if (m_ccache_enabled) {
+        const auto& ccache_environment = compiler_cache::make_environment(static_cast<std::uint32_t>(build_page_ui_obj->ccache_size_spin_box->value()));
+        build_settings.environment.insert(build_settings.environment.end(), ccache_environment.begin(), ccache_environment.end());
+        build_settings.path_prefixes.emplace_back(compiler_cache::get_masquerade_path());
+        compiler_cache::zero_stats();
+    }
+
+    // Compile jobs on other hosts, preprocessing and linking stay local.
+    // Only the host has distcc or icecream, the chroot has just base-devel.
+    m_distributed_backend = use_chroot ? distributed_compile::Backend::none : get_distributed_backend();
+    if (!distributed_compile::is_available(m_distributed_backend)) {
+        m_distributed_backend = distributed_compile::Backend::none;
+    }
+    const std::uint32_t remote_slots = (m_distributed_backend != distributed_compile::Backend::none) ? get_distributed_slots() : 0;
+    if (m_distributed_backend != distributed_compile::Backend::none) {
+        const auto& distributed_environment = distributed_compile::make_environment(m_distributed_backend, get_distributed_hosts(), m_ccache_enabled);
+        build_settings.environment.insert(build_settings.environment.end(), distributed_environment.begin(), distributed_environment.end());
+        // With ccache, its masquerade directory is already in PATH and CCACHE_PREFIX runs the backend.
+        if (!m_ccache_enabled) {
+            build_settings.path_prefixes.emplace_back(distributed_compile::get_masquerade_path(m_distributed_backend));
+        }
+        // distcc appends to the log, the counts must cover only this build.
+        utils::write_to_file(distributed_compile::get_log_path().string(), "");
+        fmt::print(stderr, "Distributing compile jobs with {}, {} remote slots\n", distributed_compile::get_backend_name(m_distributed_backend), remote_slots);
+    }
+
+    // Compression and OPTIONS of the packages, makepkg.conf would override them from the environment.
+    // makechrootpkg uses makepkg.conf of the chroot, there is no way to pass our one.
+    std::string makepkg_settings = makepkg_conf::format_package_settings(get_package_settings());
+
+    // Job counts from the current cores and memory.
+    bool needs_link_wrappers{};
+    if (build_page_ui_obj->auto_parallelism_check->isChecked()) {
+        const auto& plan = build_resources::plan_jobs(build_resources::read_system_resources(), lto_mode);
+        build_page_ui_obj->parallelism_plan_value_label->setText(QString::fromStdString(format_parallelism_plan(plan, remote_slots)));
+        if (use_chroot) {
+            // makechrootpkg writes MAKEFLAGS from the environment into makepkg.conf of the working copy.
+            build_settings.environment.emplace_back("MAKEFLAGS", fmt::format(FMT_COMPILE("-j{}"), plan.compile_jobs));
+        } else {
+            makepkg_settings += makepkg_conf::format_makeflags(plan.compile_jobs + remote_slots);
+        }
+        if (plan.lto_link_jobs > 0 && !use_chroot) {
+            std::error_code err_code{};
+            fs::create_directories(build_resources::get_lock_dir_path(), err_code);
+            build_settings.environment.emplace_back("KM_LTO_LINK_SLOTS", std::to_string(plan.lto_link_jobs));
+            build_settings.environment.emplace_back("KM_LTO_LOCK_DIR", build_resources::get_lock_dir_path().string());
+            needs_link_wrappers = true;
+        }
+        if (plan.thinlto_jobs > 0 && !use_chroot) {
+            build_settings.environment.emplace_back("KM_THINLTO_JOBS", std::to_string(plan.thinlto_jobs));
+        }
+    } else if (remote_slots > 0) {
+        // Without the plan, every core runs a local job.
+        makepkg_settings += makepkg_conf::format_makeflags(build_resources::read_system_resources().cpus + remote_slots);
+    }
+
+    if (!use_chroot) {
+        // A resumable job keeps its own copy, the shared one is rewritten by the next build.
+        const auto& makepkg_conf_dir = build_settings.job_id.empty() ? makepkg_conf::get_conf_dir_path() : build_queue::get_makepkg_conf_dir_path(build_settings.job_id);
+        if (const auto& makepkg_conf_path = makepkg_conf::write(makepkg_settings, makepkg_conf_dir)) {
+            for (auto&& variable : makepkg_conf::get_environment(*makepkg_conf_path)) {
+                build_settings.environment.emplace_back(std::move(variable));
+            }
+        } else {
+            fmt::print(stderr, "Failed to write makepkg.conf, using the system one\n");
+        }
+    }
+
+    // Linker wrappers limit LTO links and log duration of every link, to compare LTO modes and linkers.
+    m_link_timings_label.clear();
+    const bool record_link_timings = build_page_ui_obj->link_timings_check->isChecked();
+    if (!use_chroot && (record_link_timings || needs_link_wrappers)) {
+        if (link_tools::install_wrappers()) {
+            build_settings.path_prefixes.emplace_back(link_tools::get_wrappers_path().string());
+            if (record_link_timings) {
+                build_settings.environment.emplace_back("KM_LINK_LOG", link_tools::get_timings_log_path().string());
+                m_link_timings_label = fmt::format(FMT_COMPILE("{}/{}"), lto_mode, host_linker);
+            }
+        } else {
+            fmt::print(stderr, "Failed to install linker wrappers\n");
+        }
+    }
+
     fs::current_path(cpusched_path);
 
+    // Reuse the extracted and patched tree, if the PKGBUILD and options didn't change since it was saved.
+    if (!use_chroot && build_page_ui_obj->reuse_tree_check->isChecked() && tree_cache::is_reusable(all_set_values)) {
+        build_settings.tree_key = tree_cache::compute_key("PKGBUILD", all_set_values, get_list_widget_items(patches_page_ui_obj->list_widget));
+        if (tree_cache::has_snapshot(build_settings.tree_key)) {
+            tree_cache::touch_snapshot(build_settings.tree_key);
+            fmt::print(stderr, "Reusing pristine source tree {}\n", build_settings.tree_key);
+        }
+        tree_cache::prune_snapshots(2, build_settings.tree_key);
+    }
+
+    const auto& build_command = build_pipeline::make_build_command(build_settings);
+    if (!build_settings.job_id.empty()) {
+        auto resume_settings   = build_settings;
+        resume_settings.resume = true;
+
+        // The revision is checked out again on resume, together with the files next to the PKGBUILD.
+        auto revision = utils::exec("git rev-parse --verify -q HEAD 2>/dev/null");
+        if (revision.size() != 40) {
+            fmt::print(stderr, "Failed to read the PKGBUILDs revision, the job resumes with the current checkout\n");
+            revision.clear();
+        }
+        const build_queue::Job job{
+            .id           = build_settings.job_id,
+            .label        = std::string{get_kernel_name(static_cast<size_t>(main_combo_index))},
+            .pkgbuild_dir = fs::current_path().string(),
+            .options_set  = all_set_values,
+            .revision     = std::move(revision),
+        };
+        if (!build_queue::create_job(job, utils::read_whole_file("PKGBUILD"), build_command, build_pipeline::make_build_command(resume_settings))) {
+            fmt::print(stderr, "Failed to save the build job, it can't be resumed\n");
+        }
+        update_build_queue_status();
+    }
+
+    run_build(build_command, all_set_values, get_build_mode(), !use_chroot, !build_settings.ram_builddir.empty());
+}
+
+void ConfWindow::run_build(std::string build_command, std::string_view options_set, std::string build_mode, bool use_scope, bool in_tmpfs) noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+    m_build_in_tmpfs        = in_tmpfs;
+
+    // Follow the output of the build, the build page shows the current stage and timings of the finished ones.
+    if (build_progress::is_available()) {
+        const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+        std::error_code err_code{};
+        fs::remove(build_progress::get_log_path(), err_code);
+        build_command = build_progress::wrap_command(build_command);
+
+        m_build_progress           = {.stage_started = now, .last_output = now};
+        m_build_progress_reference = build_progress::read_reference();
+        m_build_options            = build_history::normalize_options(options_set);
+        m_build_mode               = std::move(build_mode);
+        m_progress_timer->start();
+    }
+
+    // Weight and limit the build against the rest of the session.
+    // systemd-nspawn puts the chroot build into its own scope, outside of ours.
+    m_build_unit_name.clear();
+    if (use_scope && build_page_ui_obj->build_scope_check->isChecked() && build_scope::is_available()) {
+        const build_scope::ScopeLimits limits{
+            .cpu_weight      = static_cast<std::uint32_t>(build_page_ui_obj->cpu_weight_spin_box->value()),
+            .io_weight       = static_cast<std::uint32_t>(build_page_ui_obj->io_weight_spin_box->value()),
+            .memory_high_gib = static_cast<std::uint32_t>(build_page_ui_obj->memory_high_spin_box->value()),
+            .nice            = build_page_ui_obj->nice_level_spin_box->value(),
+            .ionice_level    = build_page_ui_obj->ionice_level_spin_box->value(),
+        };
+        m_build_unit_name = build_scope::make_unit_name();
+        build_command     = build_scope::wrap_command(build_command, m_build_unit_name, limits);
+
+        m_build_cgroup_path.reset();
+        m_last_build_usage.reset();
+        m_build_peak_memory = 0;
+        m_usage_timer->start();
+    }
+
     // Run our build command!
-    run_cmd_async("makepkg -sicf --cleanbuild --skipchecksums", &m_running);
+    run_cmd_async(std::move(build_command), [this] { on_build_finished(); });
+}
+
+void ConfWindow::update_build_queue_status() noexcept {
+    auto* build_page_ui_obj = m_ui->conf_build_page_widget->get_ui_obj();
+
+    build_queue::remove_finished_jobs();
+    const auto& jobs = build_queue::load_jobs();
+    const auto now   = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    build_page_ui_obj->build_queue_value_label->setText(jobs.empty() ? QString{"-"} : QString::fromStdString(build_queue::format_jobs(jobs, now)));
+    build_page_ui_obj->resume_build_button->setEnabled(!jobs.empty());
+    build_page_ui_obj->discard_build_button->setEnabled(!jobs.empty());
+}
+
+void ConfWindow::on_resume_build() noexcept {
+    /* clang-format off */
+    if (m_running || m_patch_check_watcher.isRunning() || m_prepare_watcher.isRunning()) { return; }
+    /* clang-format on */
+
+    // Oldest job first, a job which is still building in its terminal is left alone.
+    const auto& jobs  = build_queue::load_jobs();
+    const auto job_it = std::ranges::find_if(jobs, [](auto&& job) { return job.stage != build_queue::Stage::done && !job.is_running; });
+    if (job_it == jobs.end()) {
+        update_build_queue_status();
+        return;
+    }
+    m_running = true;
+
+    // The checkout is reset as for every build, then the revision and the PKGBUILD of the job are put back.
+    // The upstream may have moved on since the job was prepared.
+    const auto restore_job = [this, job = *job_it] {
+        return build_queue::restore_checkout(job, [this] { return m_prepare_cancelled.load(std::memory_order_relaxed); })
+            && build_queue::restore_pkgbuild(job);
+    };
+    prepare_build_environment_async(
+        [this, job = *job_it](bool is_prepared) {
+            if (!is_prepared) {
+                m_running = false;
+                fmt::print(stderr, "Failed to restore the PKGBUILDs of the job {}\n", job.id);
+                return;
+            }
+            resume_build(job);
+        },
+        restore_job);
+}
+
+void ConfWindow::resume_build(const build_queue::Job& job) noexcept {
+    auto build_command = build_queue::get_resume_command(job);
+    if (!build_command) {
+        m_running = false;
+        fmt::print(stderr, "Job {} can't be resumed\n", job.id);
+        return;
+    }
+    fmt::print(stderr, "Resuming build of {} ({})\n", job.label, build_queue::get_stage_name(job.stage));
+
+    // Options of the job are exported by its command.
+    m_ccache_enabled      = false;
+    m_distributed_backend = distributed_compile::Backend::none;
+    m_link_timings_label.clear();
+    fs::current_path(job.pkgbuild_dir);
+    // Stages before the restart aren't timed, the mode keeps the partial build out of the predictions.
+    run_build(std::move(*build_command), job.options_set, "resumed", true, false);
+}
+
+void ConfWindow::prepare_build_environment_async(std::function<void(bool)> on_prepared, std::function<bool()> after_prepare) noexcept {
+    m_on_prepared = std::move(on_prepared);
+    m_prepare_watcher.setFuture(QtConcurrent::run([this, after_prepare = std::move(after_prepare)] {
+        return utils::prepare_build_environment([this] { return m_prepare_cancelled.load(std::memory_order_relaxed); })
+            && (!after_prepare || after_prepare());
+    }));
+}
+
+void ConfWindow::discard_build() noexcept {
+    const auto& jobs  = build_queue::load_jobs();
+    const auto job_it = std::ranges::find_if(jobs, [](auto&& job) { return !job.is_running; });
+    if (job_it != jobs.end()) {
+        build_queue::remove_job(job_it->id);
+    }
+    update_build_queue_status();
 }
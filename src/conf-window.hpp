@@ -39,12 +39,32 @@
 
 #include <ui_conf-window.h>
 
+#include "build_batch.hpp"
+#include "build_history.hpp"
+#include "build_progress.hpp"
+#include "build_queue.hpp"
+#include "distributed_compile.hpp"
+#include "kernel_pgo.hpp"
+#include "build_scope.hpp"
+#include "makepkg_conf.hpp"
+#include "patch_cache.hpp"
+#include "patch_check.hpp"
+#include "pkgbuild_evaluator.hpp"
+
+#include <atomic>
+#include <filesystem>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include <QFutureWatcher>
 #include <QMainWindow>
+#include <QTimer>
 
 #if defined(__clang__)
 #pragma clang diagnostic pop
@@ -57,9 +77,11 @@ class ConfWindow final : public QMainWindow {
     Q_DISABLE_COPY_MOVE(ConfWindow)
  public:
     explicit ConfWindow(QWidget* parent = nullptr);
-    ~ConfWindow() = default;
+    ~ConfWindow() override;
 
     void reset_patches_data_tab() noexcept;
+    // Coalesces bursts of option changes into a single reset of the patches tab.
+    void schedule_patches_data_tab_reset() noexcept;
 
  protected:
     void closeEvent(QCloseEvent* event) override;
@@ -67,12 +89,109 @@ class ConfWindow final : public QMainWindow {
  private:
     void on_cancel() noexcept;
     void on_execute() noexcept;
+    void execute_build() noexcept;
+    // Syncs and resets the PKGBUILDs in the background, then runs after_prepare there (if any) and calls on_prepared with the result.
+    void prepare_build_environment_async(std::function<void(bool)> on_prepared, std::function<bool()> after_prepare = {}) noexcept;
+    void on_build_finished() noexcept;
+    void show_link_timings() noexcept;
+    void update_parallelism_plan() noexcept;
+    [[nodiscard]] auto get_distributed_backend() const noexcept -> distributed_compile::Backend;
+    [[nodiscard]] auto get_distributed_hosts() const noexcept -> std::string;
+    [[nodiscard]] auto get_distributed_slots() const noexcept -> std::uint32_t;
+    void update_distributed_status() noexcept;
+    [[nodiscard]] auto get_pgo_selection(std::string_view kernel_name_path, std::string_view options_set) noexcept -> std::optional<kernel_pgo::Selection>;
+    void update_pgo_status() noexcept;
+    void on_record_pgo_profile() noexcept;
+    void update_module_db_status() noexcept;
+    void on_module_collector_toggled(bool checked) noexcept;
+    void update_build_usage() noexcept;
+    void update_build_progress() noexcept;
+    void record_build_history() noexcept;
+    void update_build_prediction() noexcept;
+    void show_build_comparison() noexcept;
+    void add_to_batch() noexcept;
+    void clear_batch() noexcept;
+    void on_build_batch() noexcept;
+    void build_batch() noexcept;
+    void run_build(std::string build_command, std::string_view options_set, std::string build_mode, bool use_scope, bool in_tmpfs) noexcept;
+    void update_build_queue_status() noexcept;
+    void on_resume_build() noexcept;
+    void resume_build(const build_queue::Job& job) noexcept;
+    void discard_build() noexcept;
+    [[nodiscard]] auto get_build_mode() const noexcept -> std::string;
+    void update_chroot_status() noexcept;
+    [[nodiscard]] auto get_binary_cache_store_path() const noexcept -> std::filesystem::path;
+    [[nodiscard]] auto get_package_settings() const noexcept -> makepkg_conf::PackageSettings;
+    [[nodiscard]] auto get_local_repo_path() const noexcept -> std::filesystem::path;
+    [[nodiscard]] auto get_local_repo_name() const noexcept -> std::string;
+    void update_local_repo_conf() noexcept;
+    void prefetch_patches() noexcept;
+    void on_patch_fetched(std::int32_t result_index) noexcept;
+    void verify_patches() noexcept;
+    void start_patches_check() noexcept;
+    void on_patches_verified() noexcept;
 
     bool m_running{};
+    bool m_ccache_enabled{};
+    distributed_compile::Backend m_distributed_backend{distributed_compile::Backend::none};
+    // "<lto mode>/<host linker>" of the running build, empty if link timings aren't recorded.
+    std::string m_link_timings_label{};
     std::vector<std::string> m_previously_set_options{};
     std::unique_ptr<Ui::ConfWindow> m_ui = std::make_unique<Ui::ConfWindow>();
 
+    // One evaluator coprocess per PKGBUILD directory.
+    std::mutex m_evaluators_mutex{};
+    std::unordered_map<std::string, std::unique_ptr<PkgbuildEvaluator>> m_evaluators{};
+
+    // Source arrays keyed by "<variant path>:<PKGBUILD blob id>:<option set>".
+    std::mutex m_source_cache_mutex{};
+    std::unordered_map<std::string, std::vector<std::string>> m_source_cache{};
+    std::string m_displayed_patches_key{};
+
+    QTimer* m_patches_reset_timer = new QTimer(this);
+
+    // Patches of the patches page are fetched as soon as they are added, url -> sha256 of the fetched ones.
+    std::unordered_map<std::string, std::string> m_prefetched_patches{};
+    QFutureWatcher<patch_cache::FetchResult> m_patch_prefetch_watcher{};
+    bool m_patch_prefetch_pending{};
+    QTimer* m_patch_prefetch_timer = new QTimer(this);
+
+    // Sync of the PKGBUILDs before a build or the patches check.
+    QFutureWatcher<bool> m_prepare_watcher{};
+    std::function<void(bool)> m_on_prepared{};
+    std::atomic_bool m_prepare_cancelled{};
+
+    // Check of the patches against the pristine tree, nothing if the sources couldn't be extracted.
+    QFutureWatcher<std::optional<std::vector<patch_check::PatchResult>>> m_patch_check_watcher{};
+
+    // Systemd scope of the running build, empty if it isn't isolated.
+    std::string m_build_unit_name{};
+    std::optional<std::filesystem::path> m_build_cgroup_path{};
+    std::optional<build_scope::ScopeUsage> m_last_build_usage{};
+    QTimer* m_usage_timer = new QTimer(this);
+
+    // Progress of the running build, parsed from its log.
+    build_progress::ProgressState m_build_progress{};
+    std::optional<build_progress::Reference> m_build_progress_reference{};
+    QTimer* m_progress_timer = new QTimer(this);
+
+    // Options and build mode of the running build, recorded into the build history once it exits.
+    // The mode is the one of get_build_mode(), so the prediction finds the build.
+    std::string m_build_options{};
+    std::string m_build_mode{};
+    std::uint64_t m_build_peak_memory{};
+    // Low memory of a build in the tmpfs is reported once per build.
+    bool m_build_in_tmpfs{};
+    bool m_tmpfs_memory_warned{};
+    QTimer* m_prediction_timer = new QTimer(this);
+
+    // Variants and option sets of the next batch build.
+    std::vector<build_batch::BatchEntry> m_batch_entries{};
+
     std::string get_all_set_values() const noexcept;
+    auto get_pkgbuild_evaluator(std::string_view kernel_name_path) noexcept -> PkgbuildEvaluator*;
+    auto get_source_array_from_pkgbuild(std::string_view kernel_name_path, std::string_view options_set) noexcept -> std::vector<std::string>;
+    auto get_cached_source_array(std::string_view kernel_name_path, std::string_view options_set, std::string* cache_key = nullptr) noexcept -> std::vector<std::string>;
     void clear_patches_data_tab() noexcept;
     void connect_all_checkboxes() noexcept;
 };
@@ -0,0 +1,248 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "distributed_compile.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Defaults of distcc, when the host entry has no "/LIMIT".
+constexpr std::uint32_t DEFAULT_REMOTE_SLOTS = 4;
+constexpr std::uint32_t DEFAULT_LOCAL_SLOTS  = 2;
+
+constexpr std::string_view COMPILE_PREFIX   = " compile ";
+constexpr std::string_view COMPLETED_SUFFIX = " completed ok";
+constexpr std::string_view FALLBACK_MESSAGE = "failed to distribute, running locally instead";
+
+// "host:port/8,lzo,cpp" -> "host:port"
+auto strip_host_options(std::string_view host_entry) noexcept -> std::string_view {
+    return host_entry.substr(0, host_entry.find_first_of("/,"));
+}
+
+// "localhost", or distccd of this machine on the loopback ("127.0.0.1:3632", "[::1]").
+bool is_local_host(std::string_view host_name) noexcept {
+    if (!host_name.starts_with('[')) {
+        host_name = host_name.substr(0, host_name.find(':'));
+    }
+    return host_name == "localhost" || host_name.starts_with("127.") || host_name.starts_with("[::1]");
+}
+
+}  // namespace
+
+namespace distributed_compile {
+
+auto parse_backend(std::string_view name) noexcept -> Backend {
+    if (name == "distcc") {
+        return Backend::distcc;
+    } else if (name == "icecc") {
+        return Backend::icecc;
+    }
+    return Backend::none;
+}
+
+auto get_backend_name(Backend backend) noexcept -> std::string_view {
+    switch (backend) {
+    case Backend::distcc:
+        return "distcc";
+    case Backend::icecc:
+        return "icecc";
+    default:
+        break;
+    }
+    return "none";
+}
+
+auto get_masquerade_path(Backend backend) noexcept -> std::string_view {
+    switch (backend) {
+    case Backend::distcc:
+        return "/usr/lib/distcc/bin";
+    case Backend::icecc:
+        return "/usr/lib/icecream/bin";
+    default:
+        break;
+    }
+    return {};
+}
+
+bool is_available(Backend backend) noexcept {
+    /* clang-format off */
+    if (backend == Backend::none) { return false; }
+    /* clang-format on */
+    std::error_code err_code{};
+    return fs::is_directory(get_masquerade_path(backend), err_code);
+}
+
+auto get_log_path() noexcept -> const fs::path& {
+    static const fs::path log_path = utils::fix_path("~/.cache/cachyos-km/distcc.log");
+    return log_path;
+}
+
+auto read_hosts(std::string_view configured_hosts) noexcept -> std::string {
+    /* clang-format off */
+    if (!configured_hosts.empty()) { return std::string{configured_hosts}; }
+    /* clang-format on */
+
+    // NOLINTNEXTLINE
+    if (const auto* env_hosts = std::getenv("DISTCC_HOSTS"); env_hosts != nullptr && env_hosts[0] != '\0') {
+        return env_hosts;
+    }
+    for (auto&& hosts_path : {utils::fix_path("~/.distcc/hosts"), std::string{"/etc/distcc/hosts"}}) {
+        if (auto&& hosts_list = utils::read_whole_file(hosts_path); !hosts_list.empty()) {
+            return hosts_list;
+        }
+    }
+    return {};
+}
+
+auto parse_hosts(std::string_view hosts_list) noexcept -> std::vector<Host> {
+    std::vector<Host> hosts{};
+    for (auto&& line : utils::make_multiline_view(hosts_list, '\n')) {
+        line = line.substr(0, line.find('#'));
+
+        std::string entries{line};
+        std::replace(entries.begin(), entries.end(), '\t', ' ');
+        for (auto&& entry : utils::make_multiline_view(entries, ' ')) {
+            /* clang-format off */
+            if (entry.starts_with("--")) { continue; }
+            /* clang-format on */
+            if (entry == "+zeroconf") {
+                hosts.emplace_back(Host{.name = std::string{entry}, .is_zeroconf = true});
+                continue;
+            }
+
+            // Only plain localhost runs without distccd, it has the local default.
+            const auto& name    = strip_host_options(entry);
+            const bool is_local = is_local_host(name);
+
+            std::uint32_t slots = (name == "localhost") ? DEFAULT_LOCAL_SLOTS : DEFAULT_REMOTE_SLOTS;
+            if (const auto slash_pos = entry.find('/'); slash_pos != std::string_view::npos) {
+                const auto& limit = entry.substr(slash_pos + 1);
+                std::from_chars(limit.data(), limit.data() + limit.size(), slots);
+            }
+            hosts.emplace_back(Host{.name = std::string{name}, .slots = slots, .is_local = is_local});
+        }
+    }
+    return hosts;
+}
+
+auto count_remote_slots(const std::vector<Host>& hosts) noexcept -> std::uint32_t {
+    std::uint32_t result{};
+    for (const auto& host : hosts) {
+        /* clang-format off */
+        if (host.is_local || host.is_zeroconf) { continue; }
+        /* clang-format on */
+        result += host.slots;
+    }
+    return result;
+}
+
+auto format_hosts(const std::vector<Host>& hosts) noexcept -> std::string {
+    /* clang-format off */
+    if (hosts.empty()) { return "no hosts"; }
+    /* clang-format on */
+
+    std::string result{};
+    for (const auto& host : hosts) {
+        result += result.empty() ? "" : ", ";
+        if (host.is_zeroconf) {
+            result += "zeroconf";
+        } else {
+            result += fmt::format(FMT_COMPILE("{}/{}"), host.name, host.slots);
+        }
+    }
+    return fmt::format(FMT_COMPILE("{} ({} remote slots)"), result, count_remote_slots(hosts));
+}
+
+auto make_environment(Backend backend, std::string_view hosts_list, bool with_ccache) noexcept -> std::vector<std::pair<std::string, std::string>> {
+    std::vector<std::pair<std::string, std::string>> environment{};
+    if (with_ccache) {
+        environment.emplace_back("CCACHE_PREFIX", get_backend_name(backend));
+    }
+    if (backend == Backend::distcc) {
+        if (!hosts_list.empty()) {
+            // Single line, the hosts file may have one host per line.
+            std::string hosts{hosts_list};
+            std::replace(hosts.begin(), hosts.end(), '\n', ' ');
+            environment.emplace_back("DISTCC_HOSTS", std::move(hosts));
+        }
+        environment.emplace_back("DISTCC_LOG", get_log_path().string());
+    }
+    return environment;
+}
+
+auto parse_log(std::string_view log) noexcept -> JobCounts {
+    JobCounts counts{};
+    for (auto&& line : utils::make_multiline_view(log, '\n')) {
+        if (line.find(FALLBACK_MESSAGE) != std::string_view::npos) {
+            ++counts.fallback_jobs;
+            continue;
+        }
+        // "distcc[1234] compile kernel/fork.c on 192.168.1.10/8,lzo completed ok"
+        /* clang-format off */
+        if (!line.ends_with(COMPLETED_SUFFIX) || line.find(COMPILE_PREFIX) == std::string_view::npos) { continue; }
+        /* clang-format on */
+        line.remove_suffix(COMPLETED_SUFFIX.size());
+
+        const auto on_pos = line.rfind(" on ");
+        /* clang-format off */
+        if (on_pos == std::string_view::npos) { continue; }
+        /* clang-format on */
+        const auto& host_name = strip_host_options(line.substr(on_pos + 4));
+        if (!is_local_host(host_name)) {
+            ++counts.remote_jobs[std::string{host_name}];
+        }
+    }
+    return counts;
+}
+
+auto read_job_counts() noexcept -> JobCounts {
+    return parse_log(utils::read_whole_file(get_log_path().string()));
+}
+
+auto format_job_counts(const JobCounts& counts, std::uint64_t compiled_objects) noexcept -> std::string {
+    std::uint64_t remote_total{};
+    std::string per_host{};
+    for (const auto& [host_name, jobs] : counts.remote_jobs) {
+        remote_total += jobs;
+        per_host += fmt::format(FMT_COMPILE("{}{} {}"), per_host.empty() ? "" : ", ", host_name, jobs);
+    }
+
+    auto result = fmt::format(FMT_COMPILE("{} remote"), remote_total);
+    if (!per_host.empty()) {
+        result += fmt::format(FMT_COMPILE(" ({})"), per_host);
+    }
+    // Objects not compiled remotely were compiled here.
+    if (compiled_objects > 0) {
+        result += fmt::format(FMT_COMPILE(", {} local"), (compiled_objects > remote_total) ? compiled_objects - remote_total : 0);
+    }
+    if (counts.fallback_jobs > 0) {
+        result += fmt::format(FMT_COMPILE(", {} failed to distribute"), counts.fallback_jobs);
+    }
+    return result;
+}
+
+}  // namespace distributed_compile
@@ -0,0 +1,96 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef DISTRIBUTED_COMPILE_HPP
+#define DISTRIBUTED_COMPILE_HPP
+
+#include <cstdint>      // for uint32_t, uint64_t
+#include <filesystem>   // for path
+#include <map>          // for map
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <utility>      // for pair
+#include <vector>       // for vector
+
+/// distcc and icecream setup for kernel builds on the host.
+///
+/// Both are enabled the same way as ccache, with their masquerade directory in PATH,
+/// or through CCACHE_PREFIX when ccache is enabled too, so cache misses are distributed.
+/// Preprocessing and linking stay local, only the compile jobs are sent to the hosts.
+namespace distributed_compile {
+
+enum class Backend {
+    none,
+    distcc,
+    icecc,
+};
+
+struct Host {
+    // Host name as written in the hosts list, without the slot count and options.
+    std::string name{};
+    std::uint32_t slots{};
+    // "localhost" runs the jobs locally without distccd, a loopback address (e.g "127.0.0.1") through distccd.
+    // Either way they take cores of this machine.
+    bool is_local{};
+    // "+zeroconf", the hosts and their slots are discovered by distcc itself.
+    bool is_zeroconf{};
+};
+
+/// Remote compile jobs of the build.
+struct JobCounts {
+    // Successful remote compiles per host name.
+    std::map<std::string, std::uint64_t> remote_jobs{};
+    // Jobs which failed to distribute and were compiled locally.
+    std::uint64_t fallback_jobs{};
+};
+
+/// Parses backend name ("distcc", "icecc"), anything else is none.
+[[nodiscard]] auto parse_backend(std::string_view name) noexcept -> Backend;
+[[nodiscard]] auto get_backend_name(Backend backend) noexcept -> std::string_view;
+[[nodiscard]] auto get_masquerade_path(Backend backend) noexcept -> std::string_view;
+[[nodiscard]] bool is_available(Backend backend) noexcept;
+
+/// Log of the distcc client, it's recreated by every build.
+[[nodiscard]] auto get_log_path() noexcept -> const std::filesystem::path&;
+
+/// Returns the configured hosts list, or the one distcc would use:
+/// DISTCC_HOSTS, ~/.distcc/hosts or /etc/distcc/hosts.
+[[nodiscard]] auto read_hosts(std::string_view configured_hosts) noexcept -> std::string;
+
+/// Parses distcc hosts list (e.g "localhost/2 192.168.1.10/8,lzo @builder/16 +zeroconf").
+/// Options like --randomize and --localslots are skipped, comments are allowed.
+[[nodiscard]] auto parse_hosts(std::string_view hosts_list) noexcept -> std::vector<Host>;
+
+/// Sum of slots of the remote hosts, local hosts and zeroconf aren't counted.
+[[nodiscard]] auto count_remote_slots(const std::vector<Host>& hosts) noexcept -> std::uint32_t;
+[[nodiscard]] auto format_hosts(const std::vector<Host>& hosts) noexcept -> std::string;
+
+/// Environment for the build, hosts_list is passed as DISTCC_HOSTS if not empty.
+/// With ccache, the compiler is invoked through it and ccache runs distcc or icecc on a miss.
+[[nodiscard]] auto make_environment(Backend backend, std::string_view hosts_list, bool with_ccache) noexcept -> std::vector<std::pair<std::string, std::string>>;
+
+/// Parses the distcc client log ("compile <file> on <host> completed ok" lines), jobs of local hosts aren't counted.
+[[nodiscard]] auto parse_log(std::string_view log) noexcept -> JobCounts;
+[[nodiscard]] auto read_job_counts() noexcept -> JobCounts;
+
+/// Formats remote and local job counts, compiled_objects is the count of all objects of the build (0 if unknown).
+[[nodiscard]] auto format_job_counts(const JobCounts& counts, std::uint64_t compiled_objects) noexcept -> std::string;
+
+}  // namespace distributed_compile
+
+#endif  // DISTRIBUTED_COMPILE_HPP
@@ -0,0 +1,167 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "incremental_build.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Options which change compiler or flags of every object, kbuild would rebuild everything anyway.
+constexpr std::array TOOLCHAIN_OPTIONS{"_use_llvm_lto", "_processor_opt", "_use_auto_optimization", "_cc_harder"};
+
+auto get_option_value(const std::vector<std::string>& options, std::string_view name) noexcept -> std::string_view {
+    for (const auto& option : options) {
+        std::string_view option_view{option};
+        if (option_view.starts_with(name) && option_view.size() > name.size() && option_view[name.size()] == '=') {
+            return option_view.substr(name.size() + 1);
+        }
+    }
+    return {};
+}
+
+auto count_changed(const std::vector<std::string>& lhs, const std::vector<std::string>& rhs) noexcept -> std::size_t {
+    std::vector<std::string> difference{};
+    std::ranges::set_symmetric_difference(lhs, rhs, std::back_inserter(difference));
+    return difference.size();
+}
+
+}  // namespace
+
+namespace incremental_build {
+
+auto get_builddir_path() noexcept -> const fs::path& {
+    static const fs::path builddir_path = utils::fix_path("~/.cache/cachyos-km/builds");
+    return builddir_path;
+}
+
+auto get_srcdir_path(std::string_view pkgbase) noexcept -> fs::path {
+    // Same as makepkg: $BUILDDIR/$pkgbase/src
+    return get_builddir_path() / pkgbase / "src";
+}
+
+auto get_state_path(std::string_view pkgbase) noexcept -> fs::path {
+    return get_builddir_path() / fmt::format(FMT_COMPILE("{}.state"), pkgbase);
+}
+
+auto get_files_path(std::string_view pkgbase) noexcept -> fs::path {
+    return get_builddir_path() / fmt::format(FMT_COMPILE("{}.files"), pkgbase);
+}
+
+auto make_state(std::string_view pkgver, std::string_view options_set, const std::vector<std::string>& source_array) noexcept -> BuildState {
+    BuildState state{.pkgver = std::string{pkgver}};
+
+    for (auto&& option : utils::make_multiline_view(options_set, '\n')) {
+        /* clang-format off */
+        if (option.empty()) { continue; }
+        /* clang-format on */
+        state.options.emplace_back(option);
+    }
+    std::ranges::sort(state.options);
+
+    for (const auto& source : source_array) {
+        /* clang-format off */
+        if (!source.ends_with(".patch")) { continue; }
+        /* clang-format on */
+
+        // Local patches may be edited in place, track their content.
+        if (source.starts_with("file://")) {
+            state.patches.emplace_back(fmt::format(FMT_COMPILE("{}#{}"), source, utils::git_blob_id(std::string_view{source}.substr(7))));
+        } else {
+            state.patches.emplace_back(source);
+        }
+    }
+    return state;
+}
+
+auto load_state(const fs::path& state_path) noexcept -> std::optional<BuildState> {
+    const auto& content = utils::read_whole_file(state_path.string());
+    /* clang-format off */
+    if (content.empty()) { return std::nullopt; }
+    /* clang-format on */
+
+    // "<kind> <value>" per line
+    BuildState state{};
+    for (auto&& line : utils::make_multiline_view(content, '\n')) {
+        const auto space_pos = line.find(' ');
+        /* clang-format off */
+        if (space_pos == std::string_view::npos) { continue; }
+        /* clang-format on */
+
+        const auto& kind  = line.substr(0, space_pos);
+        const auto& value = line.substr(space_pos + 1);
+        if (kind == "pkgver") {
+            state.pkgver = std::string{value};
+        } else if (kind == "option") {
+            state.options.emplace_back(value);
+        } else if (kind == "patch") {
+            state.patches.emplace_back(value);
+        }
+    }
+    std::ranges::sort(state.options);
+    return state;
+}
+
+bool save_state(const fs::path& state_path, const BuildState& state) noexcept {
+    std::error_code err_code{};
+    fs::create_directories(state_path.parent_path(), err_code);
+
+    auto content = fmt::format(FMT_COMPILE("pkgver {}\n"), state.pkgver);
+    for (const auto& option : state.options) {
+        content += fmt::format(FMT_COMPILE("option {}\n"), option);
+    }
+    for (const auto& patch : state.patches) {
+        content += fmt::format(FMT_COMPILE("patch {}\n"), patch);
+    }
+    return utils::write_to_file(state_path.string(), content);
+}
+
+auto decide(const std::optional<BuildState>& previous, const BuildState& current, bool tree_present) noexcept -> Decision {
+    if (!previous || !tree_present) {
+        return {.clean_build = true, .reason = "no previous build to reuse"};
+    }
+    if (previous->pkgver != current.pkgver) {
+        return {.clean_build = true, .reason = fmt::format(FMT_COMPILE("base version changed ({} -> {})"), previous->pkgver, current.pkgver)};
+    }
+    for (auto&& option_name : TOOLCHAIN_OPTIONS) {
+        const auto& prev_value = get_option_value(previous->options, option_name);
+        const auto& curr_value = get_option_value(current.options, option_name);
+        if (prev_value != curr_value) {
+            return {.clean_build = true, .reason = fmt::format(FMT_COMPILE("toolchain option {} changed ('{}' -> '{}')"), option_name, prev_value, curr_value)};
+        }
+    }
+
+    // Config options and patches are applied by prepare(), the changed files are synced into the kept tree.
+    auto prev_patches = previous->patches;
+    auto curr_patches = current.patches;
+    std::ranges::sort(prev_patches);
+    std::ranges::sort(curr_patches);
+    const auto changed_options = count_changed(previous->options, current.options);
+    const auto changed_patches = count_changed(prev_patches, curr_patches);
+    return {.clean_build = false, .reason = fmt::format(FMT_COMPILE("{} option and {} patch changes since the last build"), changed_options, changed_patches)};
+}
+
+}  // namespace incremental_build
@@ -0,0 +1,66 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef INCREMENTAL_BUILD_HPP
+#define INCREMENTAL_BUILD_HPP
+
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Incremental builds keep the built tree in ~/.cache/cachyos-km/builds/<pkgbase>/src (used as BUILDDIR),
+/// outside of the PKGBUILDs checkout. Each build prepares a fresh tree as usual and syncs only
+/// the changed files into the kept one, so kbuild recompiles only what depends on them.
+namespace incremental_build {
+
+/// What the kept tree was built from, saved in builds/<pkgbase>.state after a successful build.
+struct BuildState {
+    std::string pkgver{};
+    // sorted VAR=value lines
+    std::vector<std::string> options{};
+    // patch sources in order of application, local patches with id of their content
+    std::vector<std::string> patches{};
+};
+
+struct Decision {
+    bool clean_build{true};
+    // human readable explanation, shown in the build terminal
+    std::string reason{};
+};
+
+[[nodiscard]] auto get_builddir_path() noexcept -> const std::filesystem::path&;
+[[nodiscard]] auto get_srcdir_path(std::string_view pkgbase) noexcept -> std::filesystem::path;
+[[nodiscard]] auto get_state_path(std::string_view pkgbase) noexcept -> std::filesystem::path;
+/// Files of the prepared tree last synced into the kept tree (see build_pipeline::make_sync_command).
+[[nodiscard]] auto get_files_path(std::string_view pkgbase) noexcept -> std::filesystem::path;
+
+/// Collects the state of the upcoming build, from the final PKGBUILD values.
+[[nodiscard]] auto make_state(std::string_view pkgver, std::string_view options_set,
+    const std::vector<std::string>& source_array) noexcept -> BuildState;
+
+[[nodiscard]] auto load_state(const std::filesystem::path& state_path) noexcept -> std::optional<BuildState>;
+bool save_state(const std::filesystem::path& state_path, const BuildState& state) noexcept;
+
+/// Decides whether the kept tree can be reused for the current build.
+[[nodiscard]] auto decide(const std::optional<BuildState>& previous, const BuildState& current, bool tree_present) noexcept -> Decision;
+
+}  // namespace incremental_build
+
+#endif  // INCREMENTAL_BUILD_HPP
@@ -90,6 +90,15 @@ std::string Kernel::version() noexcept {
     return sync_pkg_ver;
 }
 
+std::string Kernel::installed_version() const noexcept {
+    auto* db        = alpm_get_localdb(m_handle);
+    auto* local_pkg = alpm_db_get_pkg(db, m_name.c_str());
+    /* clang-format off */
+    if (local_pkg == nullptr) { return {}; }
+    /* clang-format on */
+    return alpm_pkg_get_version(local_pkg);
+}
+
 // Name must be without any repo name (e.g. core/linux)
 bool Kernel::is_installed() const noexcept {
     auto* db  = alpm_get_localdb(m_handle);
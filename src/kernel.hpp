@@ -93,6 +93,7 @@ class Kernel {
         return "stable";
     }
     std::string version() noexcept;
+    std::string installed_version() const noexcept;
 
     bool is_installed() const noexcept;
     bool install() const noexcept;
@@ -104,6 +105,9 @@ class Kernel {
     inline const char* get_raw() const noexcept
     { return m_raw.c_str(); }
 
+    inline std::string_view get_name() const noexcept
+    { return m_name; }
+
     inline std::string_view get_repo() const noexcept
     { return m_repo.c_str(); }
 
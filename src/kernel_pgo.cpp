@@ -0,0 +1,270 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "kernel_pgo.hpp"
+#include "build_pipeline.hpp"
+#include "build_progress.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#include <sys/utsname.h>  // for uname
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::string_view AUTOFDO_PROFILE_NAME  = "autofdo.afdo";
+constexpr std::string_view PROPELLER_PREFIX_NAME = "propeller";
+constexpr std::string_view PROPELLER_CC_PROFILE  = "propeller_cc_profile.txt";
+constexpr std::string_view PROPELLER_LD_PROFILE  = "propeller_ld_profile.txt";
+constexpr std::string_view INFO_NAME             = "info";
+constexpr std::string_view VMLINUX_NAME          = "vmlinux";
+
+// Sampling period of the taken branches, as suggested by the kernel AutoFDO documentation.
+constexpr std::uint32_t PERF_SAMPLE_PERIOD = 500009;
+
+// "6.13.2" -> "6.13"
+auto get_series(std::string_view version) noexcept -> std::string_view {
+    const auto first_dot = version.find('.');
+    /* clang-format off */
+    if (first_dot == std::string_view::npos) { return version; }
+    /* clang-format on */
+    return version.substr(0, version.find_first_of(".-", first_dot + 1));
+}
+
+auto make_config_check(std::string_view symbol) noexcept -> std::string {
+    // Kernels without IKCONFIG_PROC can't be checked, perf then records it anyway.
+    return fmt::format(FMT_COMPILE("{{ ! test -f /proc/config.gz || zgrep -q '^CONFIG_{0}=y' /proc/config.gz "
+                                   "|| {{ echo 'The running kernel is not built with CONFIG_{0}, build it with profile-guided optimization first'; false; }}; }}"),
+        symbol);
+}
+
+}  // namespace
+
+namespace kernel_pgo {
+
+auto get_profiles_path() noexcept -> const fs::path& {
+    static const fs::path profiles_path = utils::fix_path("~/.cache/cachyos-km/pgo");
+    return profiles_path;
+}
+
+bool is_available() noexcept {
+    std::error_code err_code{};
+    return fs::exists("/usr/bin/perf", err_code) && fs::exists("/usr/bin/create_llvm_prof", err_code);
+}
+
+auto get_running_release() noexcept -> std::string {
+    struct utsname uts {};
+    /* clang-format off */
+    if (uname(&uts) != 0) { return {}; }
+    /* clang-format on */
+    return uts.release;
+}
+
+auto get_release_version(std::string_view kernel_release) noexcept -> std::string_view {
+    return kernel_release.substr(0, kernel_release.find('-'));
+}
+
+auto get_config_symbols(bool with_propeller) noexcept -> std::vector<std::string> {
+    if (with_propeller) {
+        return {"AUTOFDO_CLANG", "PROPELLER_CLANG"};
+    }
+    return {"AUTOFDO_CLANG"};
+}
+
+auto get_perf_event(std::string_view cpuinfo) noexcept -> std::string {
+    std::string_view vendor{};
+    std::string_view flags{};
+    for (auto&& line : utils::make_multiline_view(cpuinfo, '\n')) {
+        if (vendor.empty() && line.starts_with("vendor_id")) {
+            vendor = line;
+        } else if (flags.empty() && line.starts_with("flags")) {
+            flags = line;
+        }
+    }
+
+    if (vendor.ends_with("GenuineIntel")) {
+        return "-e BR_INST_RETIRED.NEAR_TAKEN:k";
+    }
+    // Branch records of AMD: BRS since Zen 3, LbrExtV2 since Zen 4.
+    const auto has_flag = [flags](std::string_view flag) {
+        return std::ranges::any_of(utils::make_multiline_view(flags, ' '), [flag](auto&& entry) { return entry == flag; });
+    };
+    if (vendor.ends_with("AuthenticAMD") && (has_flag("brs") || has_flag("amd_lbr_v2"))) {
+        return "--pfm-events RETIRED_TAKEN_BRANCH_INSTRUCTIONS:k";
+    }
+    return {};
+}
+
+auto get_vmlinux_path(std::string_view kernel_release) noexcept -> fs::path {
+    return get_profiles_path() / kernel_release / VMLINUX_NAME;
+}
+
+auto make_keep_vmlinux_command(std::string_view kernel_dir) noexcept -> std::string {
+    using build_pipeline::shell_quote;
+
+    // Replaced through a temporary file, a failed copy doesn't leave a truncated vmlinux behind.
+    const auto& release_dir = fmt::format(FMT_COMPILE("{}/\"$__km_release\""), shell_quote(get_profiles_path().string()));
+    return fmt::format(FMT_COMPILE("__km_release=\"$(cat {0}/include/config/kernel.release)\" && test -n \"$__km_release\" "
+                                   "&& mkdir -p {1} && cp --reflink=auto {0}/{2} {1}/{2}.tmp && mv -f {1}/{2}.tmp {1}/{2}"),
+        shell_quote(kernel_dir), release_dir, VMLINUX_NAME);
+}
+
+auto make_record_command(std::string_view kernel_release, std::string_view workload, std::uint32_t duration_secs,
+    bool with_propeller, std::string_view perf_event, std::int64_t now) noexcept -> std::string {
+    using build_pipeline::shell_quote;
+
+    const auto& profile_dir = get_profiles_path() / kernel_release / std::to_string(now);
+    const auto& tmp_dir     = fs::path{profile_dir.string() + ".tmp"};
+    const auto& perf_data   = shell_quote((tmp_dir / "perf.data").string());
+    const auto& vmlinux     = shell_quote(get_vmlinux_path(kernel_release).string());
+
+    std::vector<std::string> commands{};
+    commands.emplace_back(fmt::format(FMT_COMPILE("echo {}"), shell_quote(fmt::format(FMT_COMPILE("Recording profile of {}"), kernel_release))));
+    // The profile maps samples to source lines through the debug info of the running kernel, only its build has it.
+    commands.emplace_back(fmt::format(FMT_COMPILE("{{ test -f {} || {{ echo 'vmlinux of the running kernel is missing, build it with profile-guided optimization first'; false; }}; }}"), vmlinux));
+    for (const auto& symbol : get_config_symbols(with_propeller)) {
+        commands.emplace_back(make_config_check(symbol));
+    }
+    commands.emplace_back(fmt::format(FMT_COMPILE("rm -rf {0} && mkdir -p {0}"), shell_quote(tmp_dir.string())));
+
+    // Kernel samples of the whole system, the workload itself runs as the user.
+    const auto& workload_command = workload.empty()
+        ? fmt::format(FMT_COMPILE("sleep {}"), duration_secs)
+        : fmt::format(FMT_COMPILE("sudo -u \"$(id -un)\" -- bash -c {}"), shell_quote(workload));
+    commands.emplace_back(fmt::format(FMT_COMPILE("sudo perf record {} -a -N -b -c {} -o {} -- {}"), perf_event, PERF_SAMPLE_PERIOD,
+        perf_data, workload_command));
+    commands.emplace_back(fmt::format(FMT_COMPILE("sudo chown \"$(id -u):$(id -g)\" {}"), perf_data));
+
+    commands.emplace_back(fmt::format(FMT_COMPILE("create_llvm_prof --binary={} --profile={} --format=extbinary --out={}"), vmlinux, perf_data,
+        shell_quote((tmp_dir / AUTOFDO_PROFILE_NAME).string())));
+    if (with_propeller) {
+        commands.emplace_back(fmt::format(FMT_COMPILE("create_llvm_prof --binary={} --profile={} --format=propeller --propeller_output_module_name "
+                                                      "--out={} --propeller_symorder={}"),
+            vmlinux, perf_data, shell_quote((tmp_dir / PROPELLER_CC_PROFILE).string()), shell_quote((tmp_dir / PROPELLER_LD_PROFILE).string())));
+    }
+    // Raw samples take gigabytes, only the converted profile is kept.
+    commands.emplace_back(fmt::format(FMT_COMPILE("rm -f {}"), perf_data));
+
+    const auto& info = fmt::format(FMT_COMPILE("release {}\nrecorded {}\nworkload {}\n"), kernel_release, now,
+        workload.empty() ? fmt::format(FMT_COMPILE("system-wide for {}s"), duration_secs) : std::string{workload});
+    commands.emplace_back(fmt::format(FMT_COMPILE("printf '%s' {} > {}"), shell_quote(info), shell_quote((tmp_dir / INFO_NAME).string())));
+    commands.emplace_back(fmt::format(FMT_COMPILE("mv {} {}"), shell_quote(tmp_dir.string()), shell_quote(profile_dir.string())));
+
+    return build_pipeline::join_commands(commands);
+}
+
+auto parse_info(std::string_view info) noexcept -> Profile {
+    Profile profile{};
+    for (auto&& line : utils::make_multiline_view(info, '\n')) {
+        const auto space_pos = line.find(' ');
+        /* clang-format off */
+        if (space_pos == std::string_view::npos) { continue; }
+        /* clang-format on */
+
+        const auto& kind  = line.substr(0, space_pos);
+        const auto& value = line.substr(space_pos + 1);
+        if (kind == "release") {
+            profile.kernel_release = std::string{value};
+        } else if (kind == "recorded") {
+            profile.recorded = std::strtoll(std::string{value}.c_str(), nullptr, 10);
+        } else if (kind == "workload") {
+            profile.workload = std::string{value};
+        }
+    }
+    return profile;
+}
+
+auto load_profiles() noexcept -> std::vector<Profile> {
+    std::vector<Profile> profiles{};
+
+    std::error_code err_code{};
+    for (const auto& release_entry : fs::directory_iterator(get_profiles_path(), err_code)) {
+        for (const auto& profile_entry : fs::directory_iterator(release_entry.path(), err_code)) {
+            const auto& profile_dir = profile_entry.path();
+            // Incomplete recordings are left as .tmp directories.
+            if (profile_dir.extension() == ".tmp" || !fs::exists(profile_dir / AUTOFDO_PROFILE_NAME, err_code)) {
+                continue;
+            }
+
+            auto profile = parse_info(utils::read_whole_file((profile_dir / INFO_NAME).string()));
+            /* clang-format off */
+            if (profile.kernel_release.empty()) { continue; }
+            /* clang-format on */
+            profile.dir           = profile_dir;
+            profile.has_propeller = fs::exists(profile_dir / PROPELLER_CC_PROFILE, err_code) && fs::exists(profile_dir / PROPELLER_LD_PROFILE, err_code);
+            profiles.emplace_back(std::move(profile));
+        }
+    }
+
+    std::ranges::sort(profiles, [](auto&& lhs, auto&& rhs) { return lhs.recorded > rhs.recorded; });
+    return profiles;
+}
+
+auto select_profile(const std::vector<Profile>& profiles, std::string_view pkgver, bool with_propeller) noexcept -> Selection {
+    const auto same_version = std::ranges::find_if(profiles, [pkgver](auto&& profile) {
+        return get_release_version(profile.kernel_release) == pkgver;
+    });
+    const auto same_series  = std::ranges::find_if(profiles, [pkgver](auto&& profile) {
+        return get_series(get_release_version(profile.kernel_release)) == get_series(pkgver);
+    });
+
+    Selection selection{};
+    if (same_version != profiles.end()) {
+        selection.profile = *same_version;
+    } else if (same_series != profiles.end()) {
+        selection.profile = *same_series;
+    } else {
+        selection.reason = fmt::format(FMT_COMPILE("no profile of {}, the build can be profiled"), get_series(pkgver));
+        return selection;
+    }
+
+    // Propeller layouts the basic blocks of exactly the profiled code.
+    selection.use_propeller = with_propeller && selection.profile->has_propeller && same_version != profiles.end();
+    selection.reason        = fmt::format(FMT_COMPILE("AutoFDO{} profile of {}"), selection.use_propeller ? " and Propeller" : "",
+        selection.profile->kernel_release);
+    return selection;
+}
+
+auto make_environment(const Selection& selection) noexcept -> std::vector<std::pair<std::string, std::string>> {
+    /* clang-format off */
+    if (!selection.profile) { return {}; }
+    /* clang-format on */
+
+    // make takes them from the environment, kbuild uses them only with the Kconfig symbols enabled.
+    std::vector<std::pair<std::string, std::string>> environment{
+        {"CLANG_AUTOFDO_PROFILE", (selection.profile->dir / AUTOFDO_PROFILE_NAME).string()},
+    };
+    if (selection.use_propeller) {
+        // kbuild appends _cc_profile.txt and _ld_profile.txt.
+        environment.emplace_back("CLANG_PROPELLER_PROFILE_PREFIX", (selection.profile->dir / PROPELLER_PREFIX_NAME).string());
+    }
+    return environment;
+}
+
+auto format_profile(const Profile& profile, std::int64_t now) noexcept -> std::string {
+    return fmt::format(FMT_COMPILE("{}{}, recorded {} ago ({})"), profile.kernel_release, profile.has_propeller ? " with Propeller" : "",
+        build_progress::format_duration(now - profile.recorded), profile.workload);
+}
+
+}  // namespace kernel_pgo
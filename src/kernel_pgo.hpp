@@ -0,0 +1,102 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef KERNEL_PGO_HPP
+#define KERNEL_PGO_HPP
+
+#include <cstdint>      // for int64_t, uint32_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <utility>      // for pair
+#include <vector>       // for vector
+
+/// Profile-guided kernel builds with clang AutoFDO and Propeller (kbuild of Linux 6.13+).
+///
+/// A build with CONFIG_AUTOFDO_CLANG (and CONFIG_PROPELLER_CLANG) is ready to be profiled,
+/// the profile is recorded with 'perf record' over a workload on the running kernel, converted
+/// with create_llvm_prof and passed to the next build through CLANG_AUTOFDO_PROFILE
+/// and CLANG_PROPELLER_PROFILE_PREFIX.
+///
+/// Layout of ~/.cache/cachyos-km/pgo:
+///   <kernel release>/<recorded>/autofdo.afdo               AutoFDO profile
+///   <kernel release>/<recorded>/propeller_{cc,ld}_profile.txt  Propeller profile, optional
+///   <kernel release>/<recorded>/info                       "<kind> <value>" lines
+///   <kernel release>/vmlinux                               unstripped vmlinux of the build, the profiles are converted against it
+namespace kernel_pgo {
+
+struct Profile {
+    // Release of the profiled kernel (uname -r), e.g "6.13.2-2-cachyos".
+    std::string kernel_release{};
+    std::int64_t recorded{};
+    std::string workload{};
+    std::filesystem::path dir{};
+    bool has_propeller{};
+};
+
+/// Profile picked for a build, the reason is shown on the Build tab.
+struct Selection {
+    std::optional<Profile> profile{};
+    bool use_propeller{};
+    std::string reason{};
+};
+
+[[nodiscard]] auto get_profiles_path() noexcept -> const std::filesystem::path&;
+/// perf and create_llvm_prof (autofdo) are needed to record a profile.
+[[nodiscard]] bool is_available() noexcept;
+
+/// Release of the running kernel.
+[[nodiscard]] auto get_running_release() noexcept -> std::string;
+/// Version part of the release, e.g "6.13.2" of "6.13.2-2-cachyos".
+[[nodiscard]] auto get_release_version(std::string_view kernel_release) noexcept -> std::string_view;
+
+/// Kconfig symbols of the profiling build, the profiles are used only by builds with them.
+[[nodiscard]] auto get_config_symbols(bool with_propeller) noexcept -> std::vector<std::string>;
+
+/// perf event sampling taken branches with branch records (LBR on Intel, BRS/LbrExtV2 on AMD),
+/// from /proc/cpuinfo. Empty if the CPU has none.
+[[nodiscard]] auto get_perf_event(std::string_view cpuinfo) noexcept -> std::string;
+
+/// Unstripped vmlinux of the kernel release, kept by its build. The one of the headers package has no debug info.
+[[nodiscard]] auto get_vmlinux_path(std::string_view kernel_release) noexcept -> std::filesystem::path;
+/// Shell command, which keeps vmlinux of the built kernel tree under its release (include/config/kernel.release).
+[[nodiscard]] auto make_keep_vmlinux_command(std::string_view kernel_dir) noexcept -> std::string;
+
+/// Shell command, which records the profile of the running kernel over the workload
+/// (or system-wide for the duration, if the workload is empty) and stores it.
+[[nodiscard]] auto make_record_command(std::string_view kernel_release, std::string_view workload, std::uint32_t duration_secs,
+    bool with_propeller, std::string_view perf_event, std::int64_t now) noexcept -> std::string;
+
+/// Parses the info file of the profile.
+[[nodiscard]] auto parse_info(std::string_view info) noexcept -> Profile;
+/// Stored profiles, the newest first.
+[[nodiscard]] auto load_profiles() noexcept -> std::vector<Profile>;
+
+/// Picks the newest profile of the same kernel version, else of the same major.minor series.
+/// AutoFDO tolerates source changes between stable releases, Propeller is used only with the same version.
+[[nodiscard]] auto select_profile(const std::vector<Profile>& profiles, std::string_view pkgver, bool with_propeller) noexcept -> Selection;
+
+/// Environment for the build with the selected profile.
+[[nodiscard]] auto make_environment(const Selection& selection) noexcept -> std::vector<std::pair<std::string, std::string>>;
+
+[[nodiscard]] auto format_profile(const Profile& profile, std::int64_t now) noexcept -> std::string;
+
+}  // namespace kernel_pgo
+
+#endif  // KERNEL_PGO_HPP
@@ -0,0 +1,261 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "kernel_roots.hpp"
+#include "build_pipeline.hpp"
+#include "kernel.hpp"
+#include "utils.hpp"
+
+#include <cstdio>  // for popen, pclose
+
+#include <array>
+#include <filesystem>
+#include <memory>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuseless-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsuggest-attribute=pure"
+#endif
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtConcurrent/QtConcurrent>
+
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#include <sys/wait.h>  // for WIFEXITED, WEXITSTATUS
+
+namespace fs = std::filesystem;
+
+namespace {
+
+auto collect_root_summary(const kernel_roots::RootSpec& spec) noexcept -> kernel_roots::RootSummary {
+    kernel_roots::RootSummary summary{.spec = spec};
+
+    if (!fs::exists(spec.dbpath)) {
+        summary.error = fmt::format(FMT_COMPILE("database path '{}' doesn't exist"), spec.dbpath);
+        return summary;
+    }
+
+    // Every root gets its own handle, alpm handles must not be shared between threads.
+    alpm_errno_t err{};
+    auto* handle = utils::parse_alpm(spec.root, spec.dbpath, &err);
+    if (handle == nullptr) {
+        summary.error = alpm_strerror(err);
+        return summary;
+    }
+
+    auto* local_db = alpm_get_localdb(handle);
+    auto kernels   = Kernel::get_kernels(handle);
+    for (auto& kernel : kernels) {
+        const auto& kernel_name    = std::string{kernel.get_name()};
+        const auto& headers_name   = fmt::format(FMT_COMPILE("{}-headers"), kernel_name);
+        const auto& decorated_ver  = kernel.version();
+        const auto& installed_ver  = kernel.installed_version();
+        const bool update_avail    = kernel.is_update_available();
+        const bool headers_present = alpm_db_get_pkg(local_db, headers_name.c_str()) != nullptr;
+
+        // version() prefixes newer/older marks, strip them for machine readable output.
+        std::string version{decorated_ver};
+        utils::remove_all(version, "∧");
+        utils::remove_all(version, "∨");
+
+        summary.kernels.emplace_back(kernel_roots::KernelEntry{
+            .name              = kernel_name,
+            .repo              = std::string{kernel.get_repo()},
+            .version           = std::move(version),
+            .installed_version = installed_ver,
+            .headers_installed = headers_present,
+            .update_available  = update_avail,
+        });
+    }
+
+    if (utils::release_alpm(handle, &err) != 0) {
+        fmt::print(stderr, "[{}] failed to release alpm handle ({})\n", spec.root, alpm_strerror(err));
+    }
+    return summary;
+}
+
+auto exec_with_status(const std::string& command, std::string& output) noexcept -> std::int32_t {
+    // NOLINTNEXTLINE
+    auto* pipe = popen(command.c_str(), "r");
+    if (pipe == nullptr) {
+        fmt::print(stderr, "popen failed! '{}'\n", command);
+        return -1;
+    }
+
+    std::array<char, 512> buffer{};
+    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
+        output += buffer.data();
+    }
+
+    const std::int32_t status = pclose(pipe);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void update_root(kernel_roots::RootSummary& summary) noexcept {
+    std::vector<std::string> packages{};
+    for (const auto& kernel : summary.kernels) {
+        /* clang-format off */
+        if (kernel.installed_version.empty() || !kernel.update_available) { continue; }
+        /* clang-format on */
+        packages.emplace_back(fmt::format(FMT_COMPILE("{}/{}"), kernel.repo, kernel.name));
+        if (kernel.headers_installed) {
+            packages.emplace_back(fmt::format(FMT_COMPILE("{}/{}-headers"), kernel.repo, kernel.name));
+        }
+    }
+    /* clang-format off */
+    if (packages.empty()) { return; }
+    /* clang-format on */
+
+    const auto& root = summary.spec.root;
+    auto pacman_conf = fmt::format(FMT_COMPILE("{}/etc/pacman.conf"), root);
+    if (root == "/" || !fs::exists(pacman_conf)) {
+        pacman_conf = "/etc/pacman.conf";
+    }
+
+    const auto& packages_str = [&] {
+        std::string result{};
+        for (const auto& package : packages) {
+            result += fmt::format(FMT_COMPILE(" {}"), build_pipeline::shell_quote(package));
+        }
+        return result;
+    }();
+    const auto& cmd = fmt::format(FMT_COMPILE("pacman --root {} --dbpath {} --config {} -S --needed --noconfirm{} 2>&1"),
+        build_pipeline::shell_quote(root), build_pipeline::shell_quote(summary.spec.dbpath), build_pipeline::shell_quote(pacman_conf), packages_str);
+
+    std::string update_log{};
+    const auto update_status = exec_with_status(cmd, update_log);
+
+    // The summary shows the versions after the update.
+    summary               = collect_root_summary(summary.spec);
+    summary.update_status = update_status;
+    summary.update_log    = std::move(update_log);
+}
+
+}  // namespace
+
+namespace kernel_roots {
+
+auto parse_root_spec(std::string_view spec) noexcept -> RootSpec {
+    RootSpec result{};
+
+    const auto delim_pos = spec.find(':');
+    result.root          = std::string{spec.substr(0, delim_pos)};
+    if (result.root.empty()) {
+        result.root = "/";
+    }
+
+    if (delim_pos != std::string_view::npos && delim_pos + 1 < spec.size()) {
+        result.dbpath = std::string{spec.substr(delim_pos + 1)};
+    } else {
+        result.dbpath = (fs::path{result.root} / "var/lib/pacman/").string();
+    }
+
+    // alpm expects the dbpath to end with slash
+    if (!result.dbpath.ends_with('/')) {
+        result.dbpath += '/';
+    }
+    return result;
+}
+
+auto collect_summaries(const std::vector<RootSpec>& roots) noexcept -> std::vector<RootSummary> {
+    return QtConcurrent::blockingMapped<std::vector<RootSummary>>(roots, collect_root_summary);
+}
+
+void update_kernels(std::vector<RootSummary>& summaries) noexcept {
+    QtConcurrent::blockingMap(summaries, [](RootSummary& summary) {
+        /* clang-format off */
+        if (!summary.error.empty()) { return; }
+        /* clang-format on */
+        update_root(summary);
+    });
+}
+
+auto summaries_to_json(const std::vector<RootSummary>& summaries) noexcept -> std::string {
+    QJsonArray roots_array{};
+    for (const auto& summary : summaries) {
+        QJsonArray kernels_array{};
+        for (const auto& kernel : summary.kernels) {
+            kernels_array.append(QJsonObject{
+                {"name", QString::fromStdString(kernel.name)},
+                {"repo", QString::fromStdString(kernel.repo)},
+                {"version", QString::fromStdString(kernel.version)},
+                {"installed_version", QString::fromStdString(kernel.installed_version)},
+                {"installed", !kernel.installed_version.empty()},
+                {"update_available", kernel.update_available},
+            });
+        }
+
+        QJsonObject root_obj{
+            {"root", QString::fromStdString(summary.spec.root)},
+            {"dbpath", QString::fromStdString(summary.spec.dbpath)},
+            {"kernels", kernels_array},
+        };
+        if (!summary.error.empty()) {
+            root_obj.insert("error", QString::fromStdString(summary.error));
+        }
+        if (!summary.update_log.empty()) {
+            root_obj.insert("update_status", summary.update_status);
+            root_obj.insert("update_log", QString::fromStdString(summary.update_log));
+        }
+        roots_array.append(root_obj);
+    }
+
+    return QJsonDocument(roots_array).toJson(QJsonDocument::Indented).toStdString();
+}
+
+auto summaries_to_table(const std::vector<RootSummary>& summaries) noexcept -> std::string {
+    std::string result{};
+    for (const auto& summary : summaries) {
+        result += fmt::format(FMT_COMPILE("{} ({})\n"), summary.spec.root, summary.spec.dbpath);
+        if (!summary.error.empty()) {
+            result += fmt::format(FMT_COMPILE("    error: {}\n"), summary.error);
+            continue;
+        }
+
+        for (const auto& kernel : summary.kernels) {
+            /* clang-format off */
+            if (kernel.installed_version.empty()) { continue; }
+            /* clang-format on */
+            result += fmt::format(FMT_COMPILE("    {}/{} {}{}\n"), kernel.repo, kernel.name, kernel.installed_version,
+                kernel.update_available ? fmt::format(FMT_COMPILE(" -> {}"), kernel.version) : std::string{});
+        }
+        if (!summary.update_log.empty()) {
+            result += fmt::format(FMT_COMPILE("    update {}\n"), (summary.update_status == 0) ? "succeeded" : "failed");
+        }
+    }
+    return result;
+}
+
+}  // namespace kernel_roots
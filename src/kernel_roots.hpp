@@ -0,0 +1,68 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef KERNEL_ROOTS_HPP
+#define KERNEL_ROOTS_HPP
+
+#include <cstdint>      // for int32_t
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+namespace kernel_roots {
+
+struct RootSpec {
+    std::string root{"/"};
+    std::string dbpath{"/var/lib/pacman/"};
+};
+
+struct KernelEntry {
+    std::string name{};
+    std::string repo{};
+    std::string version{};
+    std::string installed_version{};
+    bool headers_installed{};
+    bool update_available{};
+};
+
+struct RootSummary {
+    RootSpec spec{};
+    std::string error{};
+    std::vector<KernelEntry> kernels{};
+    std::int32_t update_status{};
+    std::string update_log{};
+};
+
+/// Parses "ROOT[:DBPATH]". DBPATH defaults to ROOT/var/lib/pacman/.
+[[nodiscard]] auto parse_root_spec(std::string_view spec) noexcept -> RootSpec;
+
+/// Opens an own alpm handle for every root and collects its kernels,
+/// each root is processed on its own worker of the global thread pool.
+[[nodiscard]] auto collect_summaries(const std::vector<RootSpec>& roots) noexcept -> std::vector<RootSummary>;
+
+/// Updates the installed kernels which have an update available in every root, in parallel,
+/// the summaries of the updated roots are collected again afterwards.
+/// Requires root privileges, because pacman is invoked directly.
+void update_kernels(std::vector<RootSummary>& summaries) noexcept;
+
+[[nodiscard]] auto summaries_to_json(const std::vector<RootSummary>& summaries) noexcept -> std::string;
+[[nodiscard]] auto summaries_to_table(const std::vector<RootSummary>& summaries) noexcept -> std::string;
+
+}  // namespace kernel_roots
+
+#endif  // KERNEL_ROOTS_HPP
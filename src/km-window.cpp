@@ -35,6 +35,7 @@
 #include <QCoreApplication>
 #include <QFutureWatcher>
 #include <QMessageBox>
+#include <QPromise>
 #include <QScreen>
 #include <QShortcut>
 #include <QTimer>
@@ -181,13 +182,19 @@ MainWindow::MainWindow(QWidget* parent)
     // Setup progress dialog
     set_progress_dialog();
 
+    // Fetch PKGBUILDs in the background, so the configure window opens instantly.
+    m_prefetch_future = QtConcurrent::run([this] {
+        return utils::prefetch_build_environment([this] { return m_prefetch_cancelled.load(std::memory_order_relaxed); });
+    });
+
     // Setup configure window
-    connect(&m_future_watcher, &QFutureWatcher<void>::finished, this, [&]() {
+    connect(&m_future_watcher, &QFutureWatcher<bool>::finished, this, [&]() {
         m_conf_progress_dialog->hide();
-        if (m_future_watcher.future().isCanceled()) {
+        const auto& future = m_future_watcher.future();
+        if (future.isCanceled()) {
             return;
         }
-        if (m_future_watcher.future().isFinished()) {
+        if (future.resultCount() > 0 && future.result()) {
             m_conf_window->show();
             return;
         }
@@ -195,7 +202,7 @@ MainWindow::MainWindow(QWidget* parent)
     });
     connect(m_conf_progress_dialog, &QProgressDialog::canceled, this, [&]() {
         fmt::print("the operation was canceled!\n");
-        // that doesn't really stop execution, it just hides the progress dialog
+        // the running git command is killed by prepare_build_environment
         m_future_watcher.cancel();
     });
 
@@ -244,6 +251,12 @@ MainWindow::MainWindow(QWidget* parent)
 }
 
 MainWindow::~MainWindow() {
+    // The window may be destroyed without being closed.
+    m_prefetch_cancelled.store(true, std::memory_order_relaxed);
+    m_future_watcher.cancel();
+    m_prefetch_future.waitForFinished();
+    m_future_watcher.waitForFinished();
+
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
     if (m_worker_th != nullptr) {
         m_worker_th->exit();
@@ -313,6 +326,13 @@ void MainWindow::build_change_list(QTreeWidgetItem* item) noexcept {
 }
 
 void MainWindow::closeEvent(QCloseEvent* event) {
+    // Cancel the background fetch, the running git command is killed right away.
+    // Both tasks capture the window, so they must finish before it's destroyed.
+    m_prefetch_cancelled.store(true, std::memory_order_relaxed);
+    m_future_watcher.cancel();
+    m_prefetch_future.waitForFinished();
+    m_future_watcher.waitForFinished();
+
     // Exit worker thread
     m_running.store(true, std::memory_order_relaxed);
     m_thread_running.store(false, std::memory_order_relaxed);
@@ -330,11 +350,13 @@ void MainWindow::on_configure() noexcept {
     m_conf_progress_dialog->setLabelText(tr("Please wait...\nWe are preparing configuration window for you\ncloning PKGBUILDs.."));
     m_conf_progress_dialog->show();
 
-    // NOTE: the future created by QtConcurrent::run is not cancelable.
     // prepare in the background, without blocking the UI
-    m_future_watcher.setFuture(QtConcurrent::run([this] {
-        utils::prepare_build_environment();
-        m_conf_window->reset_patches_data_tab();
+    m_future_watcher.setFuture(QtConcurrent::run([this](QPromise<bool>& promise) {
+        const bool is_prepared = utils::prepare_build_environment([&promise] { return promise.isCanceled(); });
+        if (is_prepared && !promise.isCanceled()) {
+            m_conf_window->reset_patches_data_tab();
+        }
+        promise.addResult(is_prepared);
     }));
 }
 
@@ -53,6 +53,7 @@
 
 #include <alpm.h>
 
+#include <QFuture>
 #include <QFutureWatcher>
 #include <QMainWindow>
 #include <QProgressBar>
@@ -121,7 +122,11 @@ class MainWindow final : public QMainWindow {
 
     QProgressDialog* m_conf_progress_dialog{nullptr};
     QProgressBar* m_conf_progress_bar{nullptr};
-    QFutureWatcher<void> m_future_watcher{};
+    QFutureWatcher<bool> m_future_watcher{};
+
+    // Background fetch of PKGBUILDs started on launch.
+    std::atomic_bool m_prefetch_cancelled{};
+    QFuture<bool> m_prefetch_future{};
 
     QThread* m_worker_th = new QThread(this);
     Work* m_worker{nullptr};
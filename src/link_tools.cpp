@@ -0,0 +1,203 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "link_tools.hpp"
+#include "utils.hpp"
+
+#include <array>
+#include <charconv>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Runs the real linker and appends "<milliseconds>\t<output name>" to $KM_LINK_LOG.
+// EPOCHREALTIME avoids forking date(1) for each of the thousands of module links.
+//
+// With LTO the code generation happens at link time (vmlinux.o and every .ko), at most
+// $KM_LTO_LINK_SLOTS such links run at once, each holds a flock on one slot file until it exits.
+// $KM_THINLTO_JOBS caps the ThinLTO backend threads of every lld invocation.
+constexpr std::string_view WRAPPER_SCRIPT = R"SCRIPT(#!/usr/bin/bash
+# Generated by cachyos-kernel-manager, limits and logs the links of the kernel build.
+__km_out=
+__km_prev=
+for __km_arg; do
+    [[ $__km_prev == -o ]] && __km_out=$__km_arg
+    __km_prev=$__km_arg
+done
+if [[ -n $KM_LTO_LINK_SLOTS && ( $__km_out == vmlinux.o || $__km_out == *.ko ) ]]; then
+    __km_locked=
+    until [[ -n $__km_locked ]]; do
+        for (( __km_slot = 0; __km_slot < KM_LTO_LINK_SLOTS; ++__km_slot )); do
+            exec {__km_fd}>>"${KM_LTO_LOCK_DIR:-/tmp}/slot$__km_slot"
+            if flock -n "$__km_fd"; then
+                __km_locked=1
+                break
+            fi
+            exec {__km_fd}>&-
+        done
+        [[ -n $__km_locked ]] || sleep 0.1
+    done
+fi
+__km_extra=()
+[[ -n $KM_THINLTO_JOBS && @LINKER@ == ld.lld ]] && __km_extra=(--thinlto-jobs="$KM_THINLTO_JOBS")
+__km_start=${EPOCHREALTIME/./}
+/usr/bin/@LINKER@ "${__km_extra[@]}" "$@"
+__km_status=$?
+__km_end=${EPOCHREALTIME/./}
+[[ -n $KM_LINK_LOG ]] && printf '%s\t%s\n' "$(( (__km_end - __km_start) / 1000 ))" "${__km_out##*/}" >> "$KM_LINK_LOG"
+exit $__km_status
+)SCRIPT";
+
+constexpr std::array WRAPPED_LINKERS{"ld", "ld.bfd", "ld.lld"};
+
+auto get_history_path() noexcept -> fs::path {
+    return link_tools::get_timings_log_path().parent_path() / "history";
+}
+
+auto parse_number(std::string_view value) noexcept -> std::uint64_t {
+    std::uint64_t result{};
+    std::from_chars(value.data(), value.data() + value.size(), result);
+    return result;
+}
+
+}  // namespace
+
+namespace link_tools {
+
+auto get_thinlto_cache_path() noexcept -> const fs::path& {
+    static const fs::path cache_path = utils::fix_path("~/.cache/cachyos-km/thinlto");
+    return cache_path;
+}
+
+auto get_host_ldflags(std::string_view linker) noexcept -> std::string {
+    /* clang-format off */
+    if (linker.empty() || linker == "default") { return {}; }
+    /* clang-format on */
+    return fmt::format(FMT_COMPILE("-fuse-ld={}"), linker);
+}
+
+bool is_linker_available(std::string_view linker) noexcept {
+    /* clang-format off */
+    if (linker.empty() || linker == "default") { return true; }
+    /* clang-format on */
+
+    std::error_code err_code{};
+    return fs::exists(fmt::format(FMT_COMPILE("/usr/bin/ld.{}"), linker), err_code);
+}
+
+auto get_wrappers_path() noexcept -> const fs::path& {
+    static const fs::path wrappers_path = utils::fix_path("~/.cache/cachyos-km/link-timings/bin");
+    return wrappers_path;
+}
+
+auto get_timings_log_path() noexcept -> const fs::path& {
+    static const fs::path log_path = utils::fix_path("~/.cache/cachyos-km/link-timings/last.log");
+    return log_path;
+}
+
+bool install_wrappers() noexcept {
+    std::error_code err_code{};
+    fs::create_directories(get_wrappers_path(), err_code);
+
+    for (auto&& linker : WRAPPED_LINKERS) {
+        const auto& wrapper_path = get_wrappers_path() / linker;
+        std::string script{WRAPPER_SCRIPT};
+        for (auto pos = script.find("@LINKER@"); pos != std::string::npos; pos = script.find("@LINKER@", pos)) {
+            script.replace(pos, 8, linker);
+        }
+        if (!utils::write_to_file(wrapper_path.string(), script)) {
+            return false;
+        }
+        fs::permissions(wrapper_path, fs::perms::owner_all | fs::perms::group_read | fs::perms::group_exec
+                | fs::perms::others_read | fs::perms::others_exec,
+            err_code);
+        if (err_code) {
+            fmt::print(stderr, "[LINK_TOOLS] failed to set permissions of '{}': {}\n", wrapper_path.string(), err_code.message());
+            return false;
+        }
+    }
+    return utils::write_to_file(get_timings_log_path().string(), {});
+}
+
+auto parse_timings_log(std::string_view log) noexcept -> LinkTimings {
+    LinkTimings timings{};
+    for (auto&& line : utils::make_multiline_view(log, '\n')) {
+        const auto tab_pos = line.find('\t');
+        /* clang-format off */
+        if (tab_pos == std::string_view::npos) { continue; }
+        /* clang-format on */
+
+        const auto duration_ms = parse_number(line.substr(0, tab_pos));
+        const auto& output     = line.substr(tab_pos + 1);
+        if (output == "vmlinux.o") {
+            timings.vmlinux_o_ms += duration_ms;
+        } else if (output == "vmlinux" || output.starts_with(".tmp_vmlinux")) {
+            timings.vmlinux_ms += duration_ms;
+        } else if (output.ends_with(".ko")) {
+            timings.modules_ms += duration_ms;
+            ++timings.modules_count;
+        } else {
+            timings.other_ms += duration_ms;
+        }
+    }
+    return timings;
+}
+
+bool append_history(const TimingsRecord& record) noexcept {
+    auto history = utils::read_whole_file(get_history_path().string());
+    history += fmt::format(FMT_COMPILE("{}\t{}\t{}\t{}\t{}\t{}\t{}\n"), record.timestamp, record.label, record.timings.vmlinux_o_ms,
+        record.timings.vmlinux_ms, record.timings.modules_ms, record.timings.modules_count, record.timings.other_ms);
+    return utils::write_to_file(get_history_path().string(), history);
+}
+
+auto read_history() noexcept -> std::vector<TimingsRecord> {
+    std::vector<TimingsRecord> records{};
+
+    const auto& history = utils::read_whole_file(get_history_path().string());
+    for (auto&& line : utils::make_multiline_view(history, '\n')) {
+        const auto& fields = utils::make_multiline_view(line, '\t');
+        /* clang-format off */
+        if (fields.size() != 7) { continue; }
+        /* clang-format on */
+
+        records.emplace_back(TimingsRecord{
+            .timestamp = static_cast<std::int64_t>(parse_number(fields[0])),
+            .label     = std::string{fields[1]},
+            .timings   = LinkTimings{
+                  .vmlinux_o_ms  = parse_number(fields[2]),
+                  .vmlinux_ms    = parse_number(fields[3]),
+                  .modules_ms    = parse_number(fields[4]),
+                  .modules_count = parse_number(fields[5]),
+                  .other_ms      = parse_number(fields[6]),
+            },
+        });
+    }
+    return records;
+}
+
+auto format_timings(const LinkTimings& timings) noexcept -> std::string {
+    static constexpr auto to_sec = [](std::uint64_t duration_ms) { return static_cast<double>(duration_ms) / 1000.0; };
+    return fmt::format(FMT_COMPILE("vmlinux.o {:.1f}s, vmlinux {:.1f}s, {} modules {:.1f}s"), to_sec(timings.vmlinux_o_ms),
+        to_sec(timings.vmlinux_ms), timings.modules_count, to_sec(timings.modules_ms));
+}
+
+}  // namespace link_tools
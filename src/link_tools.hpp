@@ -0,0 +1,76 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef LINK_TOOLS_HPP
+#define LINK_TOOLS_HPP
+
+#include <cstddef>      // for size_t
+#include <cstdint>      // for uint64_t, int64_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Link stage of the kernel build: persistent ThinLTO cache, host linker and link timings.
+namespace link_tools {
+
+/// Durations of the link stage of a single build.
+struct LinkTimings {
+    // vmlinux.o, with LTO this is where the LTO backend runs
+    std::uint64_t vmlinux_o_ms{};
+    // final vmlinux and its kallsyms passes
+    std::uint64_t vmlinux_ms{};
+    std::uint64_t modules_ms{};
+    std::size_t modules_count{};
+    std::uint64_t other_ms{};
+};
+
+struct TimingsRecord {
+    std::int64_t timestamp{};
+    // e.g "thin/lld"
+    std::string label{};
+    LinkTimings timings{};
+};
+
+/// Shared by all variants, ThinLTO cache entries are keyed by module content and options.
+/// lld prunes it with its default policy (entries unused for a week).
+[[nodiscard]] auto get_thinlto_cache_path() noexcept -> const std::filesystem::path&;
+
+/// Returns HOSTLDFLAGS for the linker ("lld", "mold"), empty for the default one.
+[[nodiscard]] auto get_host_ldflags(std::string_view linker) noexcept -> std::string;
+[[nodiscard]] bool is_linker_available(std::string_view linker) noexcept;
+
+/// Directory with ld, ld.bfd and ld.lld wrappers, which log duration of every link.
+[[nodiscard]] auto get_wrappers_path() noexcept -> const std::filesystem::path&;
+[[nodiscard]] auto get_timings_log_path() noexcept -> const std::filesystem::path&;
+/// Installs the wrappers and clears the log of the previous build.
+bool install_wrappers() noexcept;
+
+/// Parses the log written by the wrappers, "<milliseconds>\t<output name>" per line.
+[[nodiscard]] auto parse_timings_log(std::string_view log) noexcept -> LinkTimings;
+
+/// History of the link timings, to compare builds.
+bool append_history(const TimingsRecord& record) noexcept;
+[[nodiscard]] auto read_history() noexcept -> std::vector<TimingsRecord>;
+
+[[nodiscard]] auto format_timings(const LinkTimings& timings) noexcept -> std::string;
+
+}  // namespace link_tools
+
+#endif  // LINK_TOOLS_HPP
@@ -0,0 +1,58 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "local_repo.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace local_repo {
+
+auto get_default_repo_path() noexcept -> const fs::path& {
+    static const fs::path repo_path = utils::fix_path("~/.cache/cachyos-km/repo");
+    return repo_path;
+}
+
+bool is_available() noexcept {
+    std::error_code err_code{};
+    return fs::exists("/usr/bin/repo-add", err_code);
+}
+
+bool is_valid_repo_name(std::string_view repo_name) noexcept {
+    // Same characters as pacman package names, the name is used in paths and as INI section.
+    return !repo_name.empty() && repo_name.front() != '-' && repo_name.front() != '.'
+        && std::ranges::all_of(repo_name, [](char ch) {
+               return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '-' || ch == '_' || ch == '.' || ch == '+';
+           });
+}
+
+auto get_db_path(const fs::path& repo_path, std::string_view repo_name) noexcept -> fs::path {
+    return repo_path / fmt::format(FMT_COMPILE("{}.db.tar.zst"), repo_name);
+}
+
+auto make_pacman_conf_entry(const fs::path& repo_path, std::string_view repo_name) noexcept -> std::string {
+    // Packages aren't signed by the manager.
+    return fmt::format(FMT_COMPILE("[{}]\nSigLevel = Optional TrustAll\nServer = file://{}"), repo_name, repo_path.string());
+}
+
+}  // namespace local_repo
@@ -0,0 +1,48 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef LOCAL_REPO_HPP
+#define LOCAL_REPO_HPP
+
+#include <filesystem>   // for path
+#include <string>       // for string
+#include <string_view>  // for string_view
+
+/// Local pacman repository, where the built packages are published with repo-add.
+/// Once it's added to pacman.conf, other hosts install the kernels like any other repo package.
+namespace local_repo {
+
+constexpr std::string_view DEFAULT_REPO_NAME = "cachyos-km-local";
+
+[[nodiscard]] auto get_default_repo_path() noexcept -> const std::filesystem::path&;
+
+/// Checks if repo-add (pacman) is installed.
+[[nodiscard]] bool is_available() noexcept;
+
+/// Repo name is the pacman.conf section and the db file name.
+[[nodiscard]] bool is_valid_repo_name(std::string_view repo_name) noexcept;
+
+/// <repo_path>/<repo_name>.db.tar.zst, repo-add creates the .db symlink next to it.
+[[nodiscard]] auto get_db_path(const std::filesystem::path& repo_path, std::string_view repo_name) noexcept -> std::filesystem::path;
+
+/// pacman.conf section, which serves the repository over file://.
+[[nodiscard]] auto make_pacman_conf_entry(const std::filesystem::path& repo_path, std::string_view repo_name) noexcept -> std::string;
+
+}  // namespace local_repo
+
+#endif  // LOCAL_REPO_HPP
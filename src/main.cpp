@@ -16,9 +16,20 @@
 // with this program; if not, write to the Free Software Foundation, Inc.,
 // 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 
+#include "kernel_roots.hpp"
 #include "km-window.hpp"
+#include "module_db.hpp"
+
+#include <csignal>
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
 
 #include <QApplication>
+#include <QCommandLineParser>
 #include <QSharedMemory>
 #include <QTranslator>
 
@@ -105,9 +116,71 @@ void initTranslations(QTranslator& qtTranslatorBase, QTranslator& qtTranslator,
     }
 }
 
+bool is_headless_run(int argc, char** argv) noexcept {
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg{argv[i]};  // NOLINT
+        if (arg == "--root" || arg.starts_with("--root=") || arg == "--collect-modules") {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Manages kernels of many roots (e.g. chroots or container images) without GUI.
+auto run_headless(const QCoreApplication& app) noexcept -> std::int32_t {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("CachyOS kernel manager");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"root", QCoreApplication::translate("main", "Root to manage, can be specified multiple times."), "ROOT[:DBPATH]"},
+        {"json", QCoreApplication::translate("main", "Print summary of all roots as JSON.")},
+        {"update", QCoreApplication::translate("main", "Update installed kernels in all roots.")},
+        {"collect-modules", QCoreApplication::translate("main", "Merge the loaded kernel modules into the module database of localmodcfg builds.")},
+    });
+    parser.process(app);
+
+    // Run by the systemd user timer of the module collector.
+    if (parser.isSet("collect-modules")) {
+        const auto module_count = module_db::collect();
+        fmt::print("{} modules in '{}'\n", module_count, module_db::get_db_path().string());
+        return (module_count > 0) ? 0 : 1;
+    }
+
+    std::vector<kernel_roots::RootSpec> roots{};
+    for (const auto& root_spec : parser.values("root")) {
+        roots.emplace_back(kernel_roots::parse_root_spec(root_spec.toStdString()));
+    }
+
+    auto summaries = kernel_roots::collect_summaries(roots);
+    if (parser.isSet("update")) {
+        kernel_roots::update_kernels(summaries);
+    }
+
+    if (parser.isSet("json")) {
+        fmt::print("{}", kernel_roots::summaries_to_json(summaries));
+    } else {
+        fmt::print("{}", kernel_roots::summaries_to_table(summaries));
+    }
+
+    const bool has_failures = std::ranges::any_of(summaries, [](auto&& summary) {
+        return !summary.error.empty() || summary.update_status != 0;
+    });
+    return has_failures ? 1 : 0;
+}
+
 }  // namespace
 
 auto main(int argc, char** argv) -> std::int32_t {
+    // Writes into pipes of a dead coprocess (e.g PKGBUILD evaluator) must fail with EPIPE,
+    // instead of terminating the whole app.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // Headless mode doesn't touch the GUI, so we don't take the single instance lock.
+    if (is_headless_run(argc, argv)) {
+        const QCoreApplication app(argc, argv);
+        return run_headless(app);
+    }
+
     QSharedMemory sharedMemoryLock("CachyOS-KM-lock");
     if (IsInstanceAlreadyRunning(sharedMemoryLock)) {
         return -1;
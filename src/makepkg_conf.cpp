@@ -0,0 +1,88 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "makepkg_conf.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace makepkg_conf {
+
+auto format_makeflags(std::uint32_t compile_jobs) noexcept -> std::string {
+    return fmt::format(FMT_COMPILE("MAKEFLAGS=\"-j{}\"\n"), compile_jobs);
+}
+
+auto format_package_settings(const PackageSettings& settings) noexcept -> std::string {
+    std::string result{};
+    if (settings.compressor == "zstd") {
+        // Levels above 19 need --ultra and a lot of memory per thread.
+        result += fmt::format(FMT_COMPILE("COMPRESSZST=(zstd -c -T{} -{} -)\nPKGEXT='.pkg.tar.zst'\n"),
+            settings.threads, std::clamp(settings.level, 1U, 19U));
+    } else if (settings.compressor == "xz") {
+        result += fmt::format(FMT_COMPILE("COMPRESSXZ=(xz -c -z -T{} -{} -)\nPKGEXT='.pkg.tar.xz'\n"),
+            settings.threads, std::clamp(settings.level, 0U, 9U));
+    } else {
+        result += "PKGEXT='.pkg.tar'\n";
+    }
+
+    // makepkg checks OPTIONS from the end, the appended values win.
+    result += fmt::format(FMT_COMPILE("OPTIONS+=({}debug {}strip)\n"), settings.debug ? "" : "!", settings.strip ? "" : "!");
+    return result;
+}
+
+auto get_conf_dir_path() noexcept -> const fs::path& {
+    static const fs::path conf_dir_path = utils::fix_path("~/.cache/cachyos-km/makepkg");
+    return conf_dir_path;
+}
+
+auto write(std::string_view settings, const fs::path& conf_dir) noexcept -> std::optional<fs::path> {
+    // Sources what makepkg would with the default MAKEPKG_CONF, in its order:
+    // the system makepkg.conf, its .d fragments (makepkg would look for $MAKEPKG_CONF.d) and the user makepkg.conf.
+    const auto& conf_path = conf_dir / "makepkg.conf";
+    std::error_code err_code{};
+    fs::create_directories(conf_dir, err_code);
+
+    std::string conf{"# Generated by cachyos-kernel-manager for the current build.\n"
+                     "source /etc/makepkg.conf\n"
+                     "for __km_conf in /etc/makepkg.conf.d/*.conf; do\n"
+                     "    if [[ -r $__km_conf ]]; then source \"$__km_conf\"; fi\n"
+                     "done\n"
+                     "unset __km_conf\n"
+                     "if [[ -r ${XDG_CONFIG_HOME:-$HOME/.config}/pacman/makepkg.conf ]]; then\n"
+                     "    source \"${XDG_CONFIG_HOME:-$HOME/.config}/pacman/makepkg.conf\"\n"
+                     "elif [[ -r $HOME/.makepkg.conf ]]; then\n"
+                     "    source \"$HOME/.makepkg.conf\"\n"
+                     "fi\n"};
+    conf += settings;
+
+    if (!utils::write_to_file(conf_path.string(), conf)) {
+        return std::nullopt;
+    }
+    return conf_path;
+}
+
+auto get_environment(const fs::path& conf_path) noexcept -> std::vector<std::pair<std::string, std::string>> {
+    return {{"MAKEPKG_CONF", conf_path.string()}};
+}
+
+}  // namespace makepkg_conf
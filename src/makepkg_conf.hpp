@@ -0,0 +1,63 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef MAKEPKG_CONF_HPP
+#define MAKEPKG_CONF_HPP
+
+#include <cstdint>      // for uint32_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <utility>      // for pair
+#include <vector>       // for vector
+
+/// makepkg.conf of the current build, which sources the system one and overrides some settings.
+/// makepkg.conf assignments take precedence over the environment, so it's passed as MAKEPKG_CONF.
+/// makepkg skips the user makepkg.conf with a MAKEPKG_CONF of its own, the generated one sources it
+/// before the settings.
+namespace makepkg_conf {
+
+struct PackageSettings {
+    // "zstd", "xz" or "none"
+    std::string compressor{"zstd"};
+    // compressor threads, 0 for all cores
+    std::uint32_t threads{};
+    std::uint32_t level{3};
+    // debug and strip of makepkg OPTIONS, options=() of PKGBUILD still takes precedence
+    bool debug{};
+    bool strip{true};
+};
+
+[[nodiscard]] auto format_makeflags(std::uint32_t compile_jobs) noexcept -> std::string;
+
+/// Compressor command, PKGEXT and OPTIONS of the package settings.
+[[nodiscard]] auto format_package_settings(const PackageSettings& settings) noexcept -> std::string;
+
+[[nodiscard]] auto get_conf_dir_path() noexcept -> const std::filesystem::path&;
+
+/// Writes the conf directory (~/.cache/cachyos-km/makepkg by default) with the given settings (makepkg.conf lines),
+/// returns its makepkg.conf. A resumable job gets a directory of its own, later builds don't change it.
+[[nodiscard]] auto write(std::string_view settings, const std::filesystem::path& conf_dir = get_conf_dir_path()) noexcept -> std::optional<std::filesystem::path>;
+
+/// MAKEPKG_CONF of a makepkg.conf returned by write().
+[[nodiscard]] auto get_environment(const std::filesystem::path& conf_path) noexcept -> std::vector<std::pair<std::string, std::string>>;
+
+}  // namespace makepkg_conf
+
+#endif  // MAKEPKG_CONF_HPP
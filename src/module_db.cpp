@@ -0,0 +1,212 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+
+#include "module_db.hpp"
+#include "build_pipeline.hpp"
+#include "kernel_pgo.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::string_view COLLECTOR_UNIT_NAME = "cachyos-km-modules";
+
+// Modules take about 70% of the compile time of a distribution config, the rest is vmlinux.
+constexpr double MODULES_BUILD_SHARE = 0.7;
+// Used when modules.order of the running kernel is missing, e.g a custom kernel installed by hand.
+constexpr std::size_t FALLBACK_MODULE_COUNT = 6000;
+
+auto get_units_path() noexcept -> const fs::path& {
+    static const fs::path units_path = utils::fix_path("~/.config/systemd/user");
+    return units_path;
+}
+
+auto get_modprobed_db_path() noexcept -> const fs::path& {
+    static const fs::path modprobed_db_path = utils::fix_path("~/.config/modprobed.db");
+    return modprobed_db_path;
+}
+
+// Location of older versions, merged into the database and removed by the next collect.
+auto get_cache_db_path() noexcept -> const fs::path& {
+    static const fs::path cache_db_path = utils::fix_path("~/.cache/cachyos-km/modules.db");
+    return cache_db_path;
+}
+
+auto read_modules(const fs::path& modules_path) noexcept -> std::vector<std::string> {
+    std::error_code err_code{};
+    /* clang-format off */
+    if (!fs::exists(modules_path, err_code)) { return {}; }
+    /* clang-format on */
+    return module_db::parse_modules(utils::read_whole_file(modules_path.string()));
+}
+
+}  // namespace
+
+namespace module_db {
+
+auto get_db_path() noexcept -> const fs::path& {
+    // XDG_DATA_HOME must be an absolute path, otherwise it's ignored.
+    static const fs::path db_path = [] {
+        const char* data_home = std::getenv("XDG_DATA_HOME");
+        const auto& data_path = (data_home != nullptr && data_home[0] == '/') ? fs::path{data_home} : fs::path{utils::fix_path("~/.local/share")};
+        return data_path / "cachyos-km" / "modules.db";
+    }();
+    return db_path;
+}
+
+auto parse_modules(std::string_view modules_list) noexcept -> std::vector<std::string> {
+    std::vector<std::string> modules{};
+    for (auto&& line : utils::make_multiline_view(modules_list, '\n')) {
+        const auto& name = line.substr(0, line.find(' '));
+        // Header of lsmod output.
+        /* clang-format off */
+        if (name.empty() || name == "Module") { continue; }
+        /* clang-format on */
+        modules.emplace_back(name);
+    }
+    return modules;
+}
+
+auto merge(std::vector<std::string> modules, const std::vector<std::string>& other) noexcept -> std::vector<std::string> {
+    modules.insert(modules.end(), other.begin(), other.end());
+    std::ranges::sort(modules);
+    const auto& [first, last] = std::ranges::unique(modules);
+    modules.erase(first, last);
+    return modules;
+}
+
+auto read_db() noexcept -> std::vector<std::string> {
+    auto modules = read_modules(get_db_path());
+    if (const auto& cache_modules = read_modules(get_cache_db_path()); !cache_modules.empty()) {
+        modules = merge(std::move(modules), cache_modules);
+    }
+    return modules;
+}
+
+std::size_t collect() noexcept {
+    auto modules = merge(read_db(), parse_modules(utils::read_whole_file("/proc/modules")));
+
+    // Modules collected by modprobed-db before, the database is only read.
+    std::error_code err_code{};
+    if (fs::exists(get_modprobed_db_path(), err_code)) {
+        modules = merge(std::move(modules), parse_modules(utils::read_whole_file(get_modprobed_db_path().string())));
+    }
+    /* clang-format off */
+    if (modules.empty()) { return 0; }
+    /* clang-format on */
+
+    std::string db{};
+    for (const auto& module : modules) {
+        db += module;
+        db += '\n';
+    }
+
+    // A build may read the database while the collector writes it.
+    const auto& db_path  = get_db_path();
+    const auto& tmp_path = fs::path{db_path.string() + ".tmp"};
+    fs::create_directories(db_path.parent_path(), err_code);
+    if (!utils::write_to_file(tmp_path.string(), db)) {
+        fmt::print(stderr, "[MODULE_DB] failed to write '{}'\n", tmp_path.string());
+        return 0;
+    }
+    fs::rename(tmp_path, db_path, err_code);
+    if (err_code) {
+        fmt::print(stderr, "[MODULE_DB] failed to replace '{}': {}\n", db_path.string(), err_code.message());
+        return 0;
+    }
+    // Merged above.
+    fs::remove(get_cache_db_path(), err_code);
+    return modules.size();
+}
+
+auto get_total_module_count() noexcept -> std::size_t {
+    const auto& modules_order = fmt::format(FMT_COMPILE("/usr/lib/modules/{}/modules.order"), kernel_pgo::get_running_release());
+
+    std::error_code err_code{};
+    /* clang-format off */
+    if (!fs::exists(modules_order, err_code)) { return FALLBACK_MODULE_COUNT; }
+    /* clang-format on */
+    const auto& module_count = utils::make_multiline_view(utils::read_whole_file(modules_order), '\n').size();
+    return (module_count > 0) ? module_count : FALLBACK_MODULE_COUNT;
+}
+
+auto estimate_savings(std::size_t db_module_count, std::size_t total_module_count) noexcept -> double {
+    /* clang-format off */
+    if (total_module_count == 0 || db_module_count >= total_module_count) { return 0.0; }
+    /* clang-format on */
+    const auto built_share = static_cast<double>(db_module_count) / static_cast<double>(total_module_count);
+    return MODULES_BUILD_SHARE * (1.0 - built_share);
+}
+
+bool is_collector_enabled() noexcept {
+    std::error_code err_code{};
+    return fs::exists(get_units_path() / fmt::format(FMT_COMPILE("{}.timer"), COLLECTOR_UNIT_NAME), err_code);
+}
+
+bool enable_collector(std::string_view app_path) noexcept {
+    const auto& service = fmt::format(FMT_COMPILE("[Unit]\n"
+                                                  "Description=Collect kernel modules used for localmodcfg builds\n\n"
+                                                  "[Service]\n"
+                                                  "Type=oneshot\n"
+                                                  "ExecStart={} --collect-modules\n"),
+        build_pipeline::shell_quote(app_path));
+    // Persistent timers catch up the samples missed while the machine was off.
+    constexpr std::string_view timer = "[Unit]\n"
+                                       "Description=Collect kernel modules used for localmodcfg builds hourly\n\n"
+                                       "[Timer]\n"
+                                       "OnCalendar=hourly\n"
+                                       "Persistent=true\n\n"
+                                       "[Install]\n"
+                                       "WantedBy=timers.target\n";
+
+    std::error_code err_code{};
+    fs::create_directories(get_units_path(), err_code);
+    if (!utils::write_to_file((get_units_path() / fmt::format(FMT_COMPILE("{}.service"), COLLECTOR_UNIT_NAME)).string(), service)
+        || !utils::write_to_file((get_units_path() / fmt::format(FMT_COMPILE("{}.timer"), COLLECTOR_UNIT_NAME)).string(), timer)) {
+        fmt::print(stderr, "[MODULE_DB] failed to write the collector units into '{}'\n", get_units_path().string());
+        return false;
+    }
+
+    const auto& cmd = fmt::format(FMT_COMPILE("systemctl --user daemon-reload && systemctl --user enable --now '{}.timer'"), COLLECTOR_UNIT_NAME);
+    if (std::system(cmd.c_str()) != 0) {
+        fmt::print(stderr, "[MODULE_DB] failed to enable the collector timer\n");
+        return false;
+    }
+    return true;
+}
+
+bool disable_collector() noexcept {
+    const auto& cmd   = fmt::format(FMT_COMPILE("systemctl --user disable --now '{}.timer' >/dev/null 2>&1"), COLLECTOR_UNIT_NAME);
+    const auto status = std::system(cmd.c_str());
+
+    std::error_code err_code{};
+    fs::remove(get_units_path() / fmt::format(FMT_COMPILE("{}.service"), COLLECTOR_UNIT_NAME), err_code);
+    fs::remove(get_units_path() / fmt::format(FMT_COMPILE("{}.timer"), COLLECTOR_UNIT_NAME), err_code);
+    const auto reload_status = std::system("systemctl --user daemon-reload");
+    return status == 0 && reload_status == 0 && !is_collector_enabled();
+}
+
+}  // namespace module_db
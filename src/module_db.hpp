@@ -0,0 +1,62 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+
+#ifndef MODULE_DB_HPP
+#define MODULE_DB_HPP
+
+#include <cstddef>      // for size_t
+#include <filesystem>   // for path
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Database of the kernel modules used on this machine, for localmodcfg builds.
+///
+/// A single lsmod snapshot misses modules loaded only now and then (USB devices, filesystems of
+/// external drives, VPNs), so /proc/modules is sampled periodically by a systemd user timer and
+/// merged into $XDG_DATA_HOME/cachyos-km/modules.db (~/.local/share by default), the same way as modprobed-db does.
+/// It can't be collected again on demand, so it isn't kept with the caches in ~/.cache.
+/// The database has one module name per line, make localmodconfig reads it through LSMOD.
+namespace module_db {
+
+[[nodiscard]] auto get_db_path() noexcept -> const std::filesystem::path&;
+
+/// Module names of lsmod output or /proc/modules, the first word of every line.
+[[nodiscard]] auto parse_modules(std::string_view modules_list) noexcept -> std::vector<std::string>;
+/// Union of both lists, sorted and without duplicates.
+[[nodiscard]] auto merge(std::vector<std::string> modules, const std::vector<std::string>& other) noexcept -> std::vector<std::string>;
+
+[[nodiscard]] auto read_db() noexcept -> std::vector<std::string>;
+/// Merges the loaded modules (and modprobed-db database if present) into the database.
+/// Returns count of modules in the database.
+std::size_t collect() noexcept;
+
+/// Count of modules built by the distribution config, from modules.order of the running kernel.
+[[nodiscard]] auto get_total_module_count() noexcept -> std::size_t;
+/// Share of the build time localmodcfg saves, when only the modules of the database are built.
+[[nodiscard]] auto estimate_savings(std::size_t db_module_count, std::size_t total_module_count) noexcept -> double;
+
+/// The collector runs '<app_path> --collect-modules' hourly.
+[[nodiscard]] bool is_collector_enabled() noexcept;
+bool enable_collector(std::string_view app_path) noexcept;
+bool disable_collector() noexcept;
+
+}  // namespace module_db
+
+#endif  // MODULE_DB_HPP
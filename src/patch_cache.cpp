@@ -0,0 +1,197 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "patch_cache.hpp"
+#include "source_cache.hpp"
+#include "utils.hpp"
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuseless-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsuggest-attribute=pure"
+#endif
+
+#include <glib.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#include <unistd.h>  // for getpid
+
+namespace fs = std::filesystem;
+
+namespace {
+
+auto get_objects_path() noexcept -> const fs::path& {
+    static const fs::path objects_path = patch_cache::get_cache_path() / "objects";
+    return objects_path;
+}
+
+auto get_index_path(std::string_view url) noexcept -> fs::path {
+    static const fs::path index_path = patch_cache::get_cache_path() / "index";
+
+    auto* checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, url.data(), static_cast<gssize>(url.size()));
+    auto result    = index_path / checksum;
+    g_free(checksum);
+    return result;
+}
+
+auto read_curl_error(const fs::path& error_path, std::int32_t status) noexcept -> std::string {
+    // curl prints the error once per attempt, the last one is enough.
+    const auto& error_output = utils::read_whole_file(error_path.string());
+    const auto& error_lines  = utils::make_multiline_view(error_output, '\n');
+    if (error_lines.empty()) {
+        return fmt::format(FMT_COMPILE("curl exited with {}"), status);
+    }
+    return std::string{error_lines.back()};
+}
+
+}  // namespace
+
+namespace patch_cache {
+
+auto get_cache_path() noexcept -> const fs::path& {
+    static const fs::path cache_path = utils::fix_path("~/.cache/cachyos-km/patches");
+    return cache_path;
+}
+
+auto parse_patch_url(std::string_view entry) noexcept -> std::optional<std::string> {
+    std::string_view url{entry};
+    if (auto delim_pos = entry.find("::"); delim_pos != std::string_view::npos) {
+        url = entry.substr(delim_pos + 2);
+    }
+    if (!url.ends_with(".patch")) {
+        return std::nullopt;
+    }
+    if (!url.starts_with("https://") && !url.starts_with("http://") && !url.starts_with("ftp://") && !url.starts_with("file://")) {
+        return std::nullopt;
+    }
+    return std::string{url};
+}
+
+auto fetch(std::string_view url) noexcept -> FetchResult {
+    FetchResult result{.url = std::string{url}};
+
+    std::error_code err_code{};
+    fs::create_directories(get_objects_path(), err_code);
+    fs::create_directories(get_index_path(url).parent_path(), err_code);
+
+    // Unique per url, the caller doesn't fetch the same url twice at once.
+    const auto& part_name  = fmt::format(FMT_COMPILE(".{}-{}"), get_index_path(url).filename().string(), getpid());
+    const auto& part_path  = get_objects_path() / fmt::format(FMT_COMPILE("{}.part"), part_name);
+    const auto& error_path = get_objects_path() / fmt::format(FMT_COMPILE("{}.err"), part_name);
+
+    // -f turns HTTP errors (e.g 404) into failures instead of saving the error page.
+    const std::int32_t status = utils::run_cancellable({"curl", "-fsSL", "--retry", "2", "--connect-timeout", "15",
+        "--stderr", error_path.string(), "-o", part_path.string(), "--", std::string{url}});
+    if (status != 0) {
+        result.error = read_curl_error(error_path, status);
+        fs::remove(part_path, err_code);
+        fs::remove(error_path, err_code);
+        return result;
+    }
+    fs::remove(error_path, err_code);
+
+    result.digest = source_cache::compute_checksum(part_path, "sha256");
+    if (result.digest.empty()) {
+        result.error = "failed to read the downloaded file";
+        fs::remove(part_path, err_code);
+        return result;
+    }
+
+    // Same content may come from several urls, keep the first copy.
+    const auto& object_path = get_objects_path() / result.digest;
+    if (fs::exists(object_path, err_code)) {
+        fs::remove(part_path, err_code);
+    } else {
+        fs::rename(part_path, object_path, err_code);
+    }
+    if (err_code || !utils::write_to_file(get_index_path(url).string(), result.digest)) {
+        result.error  = fmt::format(FMT_COMPILE("failed to store the patch: {}"), err_code.message());
+        result.digest.clear();
+    }
+    return result;
+}
+
+auto lookup(std::string_view url) noexcept -> std::optional<fs::path> {
+    const auto& index_path = get_index_path(url);
+    const auto& digest     = utils::read_whole_file(index_path.string());
+    /* clang-format off */
+    if (digest.empty()) { return std::nullopt; }
+    /* clang-format on */
+
+    // Patches are small, verifying them costs nothing compared to a download.
+    const auto& object_path = get_objects_path() / digest;
+    std::error_code err_code{};
+    if (!fs::is_regular_file(object_path, err_code) || source_cache::compute_checksum(object_path, "sha256") != digest) {
+        fs::remove(object_path, err_code);
+        fs::remove(index_path, err_code);
+        return std::nullopt;
+    }
+    return object_path;
+}
+
+std::size_t link_into_srcdest(const std::vector<std::string>& entries, const fs::path& srcdest_path) noexcept {
+    std::size_t linked_count{};
+    for (const auto& entry : entries) {
+        const auto& url = parse_patch_url(entry);
+        /* clang-format off */
+        if (!url || url->starts_with("file://")) { continue; }
+        /* clang-format on */
+
+        // Same file name as makepkg downloads to.
+        const auto& source_entry = source_cache::parse_source_entry(entry);
+        const auto& object_path  = lookup(*url);
+        if (!source_entry || !object_path) {
+            continue;
+        }
+
+        // The patch may have changed upstream since makepkg downloaded it, the fetched content wins.
+        std::error_code err_code{};
+        const auto& dest_path = srcdest_path / source_entry->filename;
+        if (fs::exists(dest_path, err_code)) {
+            /* clang-format off */
+            if (source_cache::compute_checksum(dest_path, "sha256") == object_path->filename().string()) { continue; }
+            /* clang-format on */
+            fs::remove(dest_path, err_code);
+        }
+        fs::create_hard_link(*object_path, dest_path, err_code);
+        if (err_code) {
+            err_code.clear();
+            fs::copy_file(*object_path, dest_path, err_code);
+        }
+        if (!err_code) {
+            ++linked_count;
+        }
+    }
+    return linked_count;
+}
+
+}  // namespace patch_cache
@@ -0,0 +1,62 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef PATCH_CACHE_HPP
+#define PATCH_CACHE_HPP
+
+#include <cstddef>      // for size_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Cache of patches from the patches page, fetched as soon as they are added.
+///
+/// Layout of ~/.cache/cachyos-km/patches:
+///   objects/<sha256>     patch content, named by its checksum
+///   index/<sha256(url)>  checksum of the last fetched content of the url
+namespace patch_cache {
+
+struct FetchResult {
+    std::string url{};
+    // sha256 of the content, empty if the fetch failed.
+    std::string digest{};
+    std::string error{};
+};
+
+[[nodiscard]] auto get_cache_path() noexcept -> const std::filesystem::path&;
+
+/// Returns the url of the patch entry ("name::url" or "url"), nothing if it isn't a patch url.
+[[nodiscard]] auto parse_patch_url(std::string_view entry) noexcept -> std::optional<std::string>;
+
+/// Downloads the url with curl into the store and updates the index. Blocks, safe to call from several threads
+/// for different urls.
+[[nodiscard]] auto fetch(std::string_view url) noexcept -> FetchResult;
+
+/// Returns the stored content of the url, nothing if it isn't stored or doesn't match its checksum anymore.
+[[nodiscard]] auto lookup(std::string_view url) noexcept -> std::optional<std::filesystem::path>;
+
+/// Links stored remote patches into SRCDEST, so makepkg doesn't download them again.
+/// A file of SRCDEST with other content is replaced. Local (file://) patches are skipped,
+/// they may be edited after they were fetched. Returns count of linked patches.
+std::size_t link_into_srcdest(const std::vector<std::string>& entries, const std::filesystem::path& srcdest_path) noexcept;
+
+}  // namespace patch_cache
+
+#endif  // PATCH_CACHE_HPP
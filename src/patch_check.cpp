@@ -0,0 +1,287 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "patch_check.hpp"
+#include "patch_cache.hpp"
+#include "source_cache.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuseless-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsuggest-attribute=pure"
+#endif
+
+#include <QtConcurrent/QtConcurrent>
+
+#include <glib.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#include <unistd.h>  // for getpid
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct ResolvedPatch {
+    patch_check::PatchResult result{};
+    fs::path patch_path{};
+    std::vector<std::string> touched_files{};
+};
+
+// Runs the command, returns whether it succeeded, stdout and stderr go to output.
+bool run_with_output(const std::vector<std::string>& argv, std::string& output) noexcept {
+    std::vector<gchar*> child_argv{};
+    for (const auto& arg : argv) {
+        child_argv.push_back(const_cast<gchar*>(arg.c_str()));  // NOLINT
+    }
+    child_argv.push_back(nullptr);
+
+    gchar* child_stdout{};
+    gchar* child_stderr{};
+    gint wait_status{};
+    g_autoptr(GError) error = nullptr;
+    g_spawn_sync(nullptr, child_argv.data(), nullptr, G_SPAWN_SEARCH_PATH, nullptr, nullptr,
+        &child_stdout, &child_stderr, &wait_status, &error);
+    if (error != nullptr) {
+        output = error->message;
+        return false;
+    }
+
+    output = fmt::format(FMT_COMPILE("{}{}"), child_stdout, child_stderr);
+    g_free(child_stdout);
+    g_free(child_stderr);
+    return g_spawn_check_wait_status(wait_status, nullptr);
+}
+
+bool dry_run_patch(const fs::path& tree_path, const fs::path& patch_path, std::string& output) noexcept {
+    return run_with_output({"patch", "-d", tree_path.string(), "-Np1", "--dry-run", "-f", "-s", "-i", patch_path.string()}, output);
+}
+
+// Remote patches come from the patch cache, fetched now if the patches page didn't do it yet.
+auto resolve_patch(std::string_view entry) noexcept -> ResolvedPatch {
+    ResolvedPatch resolved{.result = {.entry = std::string{entry}}};
+
+    const auto& url = patch_cache::parse_patch_url(entry);
+    if (!url) {
+        resolved.result.error = "not a patch url";
+        return resolved;
+    }
+    if (url->starts_with("file://")) {
+        resolved.patch_path = url->substr(7);
+    } else if (auto object_path = patch_cache::lookup(*url)) {
+        resolved.patch_path = std::move(*object_path);
+    } else if (const auto& fetch_result = patch_cache::fetch(*url); !fetch_result.error.empty()) {
+        resolved.result.error = fetch_result.error;
+        return resolved;
+    } else if (auto fetched_path = patch_cache::lookup(*url)) {
+        resolved.patch_path = std::move(*fetched_path);
+    }
+
+    const auto& patch_content = utils::read_whole_file(resolved.patch_path.string());
+    if (patch_content.empty()) {
+        resolved.result.error = fmt::format(FMT_COMPILE("failed to read '{}'"), resolved.patch_path.string());
+        return resolved;
+    }
+    resolved.touched_files = patch_check::parse_touched_files(patch_content);
+    return resolved;
+}
+
+// Name of the source in $srcdir, as makepkg links it there.
+auto get_source_filename(std::string_view entry) noexcept -> std::string_view {
+    if (const auto delim_pos = entry.find("::"); delim_pos != std::string_view::npos) {
+        return entry.substr(0, delim_pos);
+    }
+    return entry.substr(entry.find_last_of('/') + 1);
+}
+
+bool has_common_file(const std::vector<std::string>& lhs, const std::vector<std::string>& rhs) noexcept {
+    return std::ranges::any_of(lhs, [&rhs](auto&& file) { return std::ranges::find(rhs, file) != rhs.end(); });
+}
+
+}  // namespace
+
+namespace patch_check {
+
+auto get_base_path() noexcept -> const fs::path& {
+    static const fs::path base_path = utils::fix_path("~/.cache/cachyos-km/verify");
+    return base_path;
+}
+
+auto make_base_key(std::string_view pkgver, const std::vector<std::string>& source_array,
+    const std::vector<std::string>& pkgbuild_patches) noexcept -> std::string {
+    auto key_src = fmt::format(FMT_COMPILE("{}\n"), pkgver);
+    for (const auto& source : source_array) {
+        if (!source.ends_with(".patch")) {
+            key_src += fmt::format(FMT_COMPILE("{}\n"), source);
+        }
+    }
+    for (const auto& patch : pkgbuild_patches) {
+        key_src += fmt::format(FMT_COMPILE("patch {}\n"), patch);
+    }
+
+    auto* checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key_src.c_str(), static_cast<gssize>(key_src.size()));
+    std::string result{checksum};
+    g_free(checksum);
+    return result;
+}
+
+auto prepare_base_tree(const fs::path& pkgbuild_dir, std::string_view options_set, std::string_view pkgbase,
+    std::string_view srcname, const std::vector<std::string>& pkgbuild_patches, std::string_view key) noexcept -> std::optional<fs::path> {
+    const auto& build_path = get_base_path() / pkgbase;
+    const auto& key_path   = get_base_path() / fmt::format(FMT_COMPILE("{}.key"), pkgbase);
+    const auto& tree_path  = build_path / "src" / srcname;
+
+    std::error_code err_code{};
+    if (utils::read_whole_file(key_path.string()) == key && fs::is_directory(tree_path, err_code)) {
+        return tree_path;
+    }
+    fs::remove(key_path, err_code);
+    fs::remove_all(build_path, err_code);
+    fs::create_directories(source_cache::get_srcdest_path(), err_code);
+
+    std::vector<std::string> argv{"env", "-C", fs::absolute(pkgbuild_dir, err_code).string(),
+        fmt::format(FMT_COMPILE("BUILDDIR={}"), get_base_path().string()),
+        fmt::format(FMT_COMPILE("SRCDEST={}"), source_cache::get_srcdest_path().string())};
+    for (auto&& option : utils::make_multiline_view(options_set, '\n')) {
+        argv.emplace_back(option);
+    }
+    // -o with --noprepare only downloads and extracts, --nodeps avoids asking for the password.
+    argv.insert(argv.end(), {"makepkg", "-o", "--noprepare", "--nodeps", "--skipchecksums", "--skippgpcheck"});
+
+    std::string output{};
+    const bool is_extracted = run_with_output(argv, output);
+    if (!is_extracted || !fs::is_directory(tree_path, err_code)) {
+        fmt::print(stderr, "[PATCH_CHECK] failed to extract the sources:\n{}\n", output);
+        fs::remove_all(build_path, err_code);
+        return std::nullopt;
+    }
+
+    // Same as prepare() does, the sources are linked into $srcdir by the extraction.
+    for (const auto& patch : pkgbuild_patches) {
+        const auto& patch_path = build_path / "src" / get_source_filename(patch);
+        if (!run_with_output({"patch", "-d", tree_path.string(), "-Np1", "-f", "-s", "-i", patch_path.string()}, output)) {
+            fmt::print(stderr, "[PATCH_CHECK] '{}' of the PKGBUILD doesn't apply:\n{}\n", patch, output);
+            fs::remove_all(build_path, err_code);
+            return std::nullopt;
+        }
+    }
+    if (!utils::write_to_file(key_path.string(), key)) {
+        return std::nullopt;
+    }
+    return tree_path;
+}
+
+auto parse_touched_files(std::string_view patch_content) noexcept -> std::vector<std::string> {
+    std::vector<std::string> touched_files{};
+    for (auto&& line : utils::make_multiline_view(patch_content, '\n')) {
+        if (!line.starts_with("--- ") && !line.starts_with("+++ ")) {
+            continue;
+        }
+
+        // "+++ b/path\tdate", the first component is stripped as with -p1.
+        auto file_path = line.substr(4);
+        file_path      = file_path.substr(0, file_path.find('\t'));
+        const auto slash_pos = file_path.find('/');
+        if (file_path == "/dev/null" || slash_pos == std::string_view::npos) {
+            continue;
+        }
+        file_path.remove_prefix(slash_pos + 1);
+        if (!file_path.empty() && std::ranges::find(touched_files, file_path) == touched_files.end()) {
+            touched_files.emplace_back(file_path);
+        }
+    }
+    return touched_files;
+}
+
+auto check_patches(const fs::path& tree_path, const std::vector<std::string>& entries) noexcept -> std::vector<PatchResult> {
+    // Every patch against the base tree, the tree isn't modified by dry runs.
+    auto resolved_patches = QtConcurrent::blockingMapped<std::vector<ResolvedPatch>>(entries, [&tree_path](const std::string& entry) {
+        auto resolved = resolve_patch(entry);
+        if (resolved.result.error.empty()) {
+            resolved.result.applies_alone = dry_run_patch(tree_path, resolved.patch_path, resolved.result.error);
+        }
+        return resolved;
+    });
+
+    // Then in order, on a copy of only the files the patches change.
+    std::error_code err_code{};
+    const auto& scratch_path = get_base_path() / fmt::format(FMT_COMPILE(".scratch-{}"), getpid());
+    fs::remove_all(scratch_path, err_code);
+    fs::create_directories(scratch_path, err_code);
+    for (const auto& resolved : resolved_patches) {
+        for (const auto& touched_file : resolved.touched_files) {
+            const auto& src_path  = tree_path / touched_file;
+            const auto& dest_path = scratch_path / touched_file;
+            if (fs::is_regular_file(src_path, err_code) && !fs::exists(dest_path, err_code)) {
+                fs::create_directories(dest_path.parent_path(), err_code);
+                fs::copy_file(src_path, dest_path, err_code);
+            }
+        }
+    }
+
+    std::vector<std::size_t> applied_indexes{};
+    for (std::size_t i = 0; i < resolved_patches.size(); ++i) {
+        auto& resolved = resolved_patches[i];
+        /* clang-format off */
+        if (!resolved.result.applies_alone) { continue; }
+        /* clang-format on */
+
+        std::string output{};
+        if (dry_run_patch(scratch_path, resolved.patch_path, output)) {
+            resolved.result.applies_in_order = run_with_output({"patch", "-d", scratch_path.string(), "-Np1", "-f", "-s", "-i", resolved.patch_path.string()}, output);
+        }
+        if (!resolved.result.applies_in_order) {
+            resolved.result.error = std::move(output);
+            for (const auto applied_index : applied_indexes) {
+                if (has_common_file(resolved.touched_files, resolved_patches[applied_index].touched_files)) {
+                    resolved.result.conflicts.emplace_back(applied_index);
+                }
+            }
+            continue;
+        }
+        applied_indexes.emplace_back(i);
+    }
+    fs::remove_all(scratch_path, err_code);
+
+    std::vector<PatchResult> results{};
+    results.reserve(resolved_patches.size());
+    for (auto& resolved : resolved_patches) {
+        results.emplace_back(std::move(resolved.result));
+    }
+    return results;
+}
+
+}  // namespace patch_check
@@ -0,0 +1,67 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef PATCH_CHECK_HPP
+#define PATCH_CHECK_HPP
+
+#include <cstddef>      // for size_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Checks the patches of the patches page before the build, with the same `patch -Np1` as prepare() uses.
+///
+/// The base tree (sources extracted by makepkg without prepare(), with the patches of the PKGBUILD applied)
+/// is kept in ~/.cache/cachyos-km/verify/<pkgbase>, until pkgver or the sources change.
+namespace patch_check {
+
+struct PatchResult {
+    std::string entry{};
+    bool applies_alone{};
+    bool applies_in_order{};
+    // Output of patch, if it doesn't apply.
+    std::string error{};
+    // Indexes of the earlier entries, which change the same files.
+    std::vector<std::size_t> conflicts{};
+};
+
+[[nodiscard]] auto get_base_path() noexcept -> const std::filesystem::path&;
+
+/// Key of the base tree: pkgver, the sources, which aren't patches, and the applied patches of the PKGBUILD.
+[[nodiscard]] auto make_base_key(std::string_view pkgver, const std::vector<std::string>& source_array,
+    const std::vector<std::string>& pkgbuild_patches) noexcept -> std::string;
+
+/// Extracts the sources with makepkg without prepare() and applies the patches of the PKGBUILD (entries
+/// of its source array) in order, unless the tree of the key is already there.
+/// The options (VAR=value lines) are passed in the environment, as for the build.
+/// Returns path of the kernel tree ($srcdir/<srcname>).
+[[nodiscard]] auto prepare_base_tree(const std::filesystem::path& pkgbuild_dir, std::string_view options_set, std::string_view pkgbase,
+    std::string_view srcname, const std::vector<std::string>& pkgbuild_patches, std::string_view key) noexcept -> std::optional<std::filesystem::path>;
+
+/// Returns the files changed by the patch, relative to the tree (-p1).
+[[nodiscard]] auto parse_touched_files(std::string_view patch_content) noexcept -> std::vector<std::string>;
+
+/// Dry-runs every entry against the base tree in parallel,
+/// then applies them in the given order on a copy of the files they change.
+[[nodiscard]] auto check_patches(const std::filesystem::path& tree_path, const std::vector<std::string>& entries) noexcept -> std::vector<PatchResult>;
+
+}  // namespace patch_check
+
+#endif  // PATCH_CHECK_HPP
@@ -0,0 +1,301 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "pkgbuild_evaluator.hpp"
+
+#include <cerrno>   // for errno
+#include <csignal>  // for kill, SIGKILL
+#include <cstring>  // for strerror
+
+#include <array>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuseless-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsuggest-attribute=pure"
+#endif
+
+#include <glib.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#include <poll.h>      // for poll
+#include <sys/wait.h>  // for waitpid
+#include <unistd.h>    // for read, write, close, setpgid
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::string_view EVAL_DONE_MARKER = "__KM_EVAL_DONE__";
+
+// PKGBUILDs only assign variables, even the largest one is evaluated in milliseconds.
+constexpr std::chrono::milliseconds EVAL_TIMEOUT{5000};
+constexpr std::chrono::milliseconds SPAWN_TIMEOUT{2000};
+
+// Helpers defined once in the coprocess.
+// - __km_load   reads the PKGBUILD into a variable, with builtin only.
+// - __km_reset  drops every variable set by the previous evaluation (options and PKGBUILD ones),
+//               otherwise defaults like ': ${_foo:=bar}' would keep the previous values.
+// - __km_eval   evaluates the cached PKGBUILD and prints the requested array, one entry per line.
+constexpr std::string_view COPROC_PRELUDE = R"(
+__km_load() { IFS= read -r -d '' __km_pkgbuild < PKGBUILD; }
+__km_reset() {
+    local __km_v
+    for __km_v in ${!_*} ${!pkg*} source b2sums sha256sums sha512sums; do
+        [[ $__km_v == _ || $__km_v == __km_* ]] || unset "$__km_v" 2>/dev/null
+    done
+}
+__km_eval() {
+    eval "$__km_pkgbuild" </dev/null >/dev/null 2>&1
+    local -n __km_array="$1"
+    printf '%s\n' "${__km_array[@]}"
+    printf '%s\n' '__KM_EVAL_DONE__'
+}
+)";
+
+}  // namespace
+
+PkgbuildEvaluator::PkgbuildEvaluator(std::string_view pkgbuild_dir) noexcept
+  : m_pkgbuild_dir(pkgbuild_dir) { }
+
+PkgbuildEvaluator::~PkgbuildEvaluator() noexcept {
+    const std::lock_guard<std::mutex> guard(m_mutex);
+    terminate();
+}
+
+bool PkgbuildEvaluator::spawn() noexcept {
+    // Sandbox the shell with bubblewrap if available:
+    // read-only view of the system, no network and it dies together with us.
+    if (m_sandbox_usable && fs::exists("/usr/bin/bwrap")) {
+        if (spawn_shell(true)) {
+            return true;
+        }
+        // bwrap exits right away, if it can't create the namespaces.
+        fmt::print(stderr, "[PKGBUILD_EVALUATOR] bwrap failed to start (are unprivileged user namespaces disabled?), "
+                           "PKGBUILDs are evaluated without sandbox\n");
+        m_sandbox_usable = false;
+    }
+    return spawn_shell(false);
+}
+
+bool PkgbuildEvaluator::spawn_shell(bool sandboxed) noexcept {
+    std::vector<const gchar*> argv{};
+    if (sandboxed) {
+        argv.insert(argv.end(), {"/usr/bin/bwrap", "--ro-bind", "/", "/", "--dev", "/dev", "--proc", "/proc",
+                                    "--tmpfs", "/tmp", "--unshare-all", "--die-with-parent", "--new-session"});
+    }
+    argv.insert(argv.end(), {"/usr/bin/bash", "--norc", "--noprofile", nullptr});
+
+    // Start with clean environment, so the user environment can't affect the evaluation.
+    const gchar* const envp[] = {"PATH=/usr/local/bin:/usr/bin:/bin", "LC_ALL=C", nullptr};
+
+    // Own process group, a stuck evaluation is killed together with the commands it runs.
+    static constexpr auto child_setup = [](gpointer) { setpgid(0, 0); };
+
+    gint child_stdin{-1};
+    gint child_stdout{-1};
+    GPid child_pid{};
+    g_autoptr(GError) error = nullptr;
+
+    // NOLINTNEXTLINE
+    g_spawn_async_with_pipes(m_pkgbuild_dir.c_str(), const_cast<gchar**>(argv.data()), const_cast<gchar**>(envp),
+        static_cast<GSpawnFlags>(G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDERR_TO_DEV_NULL), child_setup,
+        nullptr, &child_pid, &child_stdin, &child_stdout, nullptr, &error);
+    if (error != nullptr) {
+        fmt::print(stderr, "Spawning PKGBUILD evaluator failed: {}\n", error->message);
+        return false;
+    }
+
+    m_pid       = child_pid;
+    m_stdin_fd  = child_stdin;
+    m_stdout_fd = child_stdout;
+    m_read_buffer.clear();
+
+    // Force reload of the PKGBUILD into the new shell.
+    m_pkgbuild_mtime = {};
+    m_pkgbuild_size  = 0;
+
+    // Wait for the shell to answer, so a sandbox which failed to start is noticed here.
+    std::vector<std::string> lines{};
+    const auto& request = fmt::format(FMT_COMPILE("{}\nprintf '%s\\n' '{}'\n"), COPROC_PRELUDE, EVAL_DONE_MARKER);
+    if (!write_request(request) || read_reply(lines, SPAWN_TIMEOUT) != ReplyStatus::done) {
+        terminate();
+        return false;
+    }
+    return true;
+}
+
+void PkgbuildEvaluator::terminate() noexcept {
+    // Bash exits on EOF of stdin, unless it's stuck in the PKGBUILD.
+    if (m_stdin_fd != -1) {
+        close(m_stdin_fd);
+        m_stdin_fd = -1;
+    }
+    if (m_stdout_fd != -1) {
+        close(m_stdout_fd);
+        m_stdout_fd = -1;
+    }
+    if (m_pid != -1) {
+        if (m_timed_out) {
+            kill(-m_pid, SIGKILL);
+        }
+        waitpid(m_pid, nullptr, 0);
+        g_spawn_close_pid(m_pid);
+        m_pid = -1;
+    }
+    m_read_buffer.clear();
+}
+
+bool PkgbuildEvaluator::write_request(std::string_view request) noexcept {
+    while (!request.empty()) {
+        const auto written = write(m_stdin_fd, request.data(), request.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fmt::print(stderr, "[PKGBUILD_EVALUATOR] write failed: {}\n", std::strerror(errno));
+            return false;
+        }
+        request.remove_prefix(static_cast<std::size_t>(written));
+    }
+    return true;
+}
+
+auto PkgbuildEvaluator::read_reply(std::vector<std::string>& lines, std::chrono::milliseconds timeout) noexcept -> ReplyStatus {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::array<char, 4096> buffer{};
+
+    while (true) {
+        // Take every whole line, which has been read so far.
+        std::size_t line_start{};
+        for (auto line_end = m_read_buffer.find('\n'); line_end != std::string::npos; line_end = m_read_buffer.find('\n', line_start)) {
+            const std::string_view line{m_read_buffer.data() + line_start, line_end - line_start};
+            line_start = line_end + 1;
+            if (line == EVAL_DONE_MARKER) {
+                m_read_buffer.erase(0, line_start);
+                return ReplyStatus::done;
+            }
+            if (!line.empty()) {
+                lines.emplace_back(line);
+            }
+        }
+        m_read_buffer.erase(0, line_start);
+
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) {
+            m_timed_out = true;
+            return ReplyStatus::timed_out;
+        }
+
+        pollfd poll_fd{.fd = m_stdout_fd, .events = POLLIN, .revents = 0};
+        const auto poll_status = poll(&poll_fd, 1, static_cast<std::int32_t>(remaining.count()));
+        if (poll_status < 0 && errno != EINTR) {
+            fmt::print(stderr, "[PKGBUILD_EVALUATOR] poll failed: {}\n", std::strerror(errno));
+            return ReplyStatus::closed;
+        }
+        /* clang-format off */
+        if (poll_status <= 0) { continue; }
+        /* clang-format on */
+
+        const auto read_bytes = read(m_stdout_fd, buffer.data(), buffer.size());
+        if (read_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read_bytes <= 0) {
+            return ReplyStatus::closed;
+        }
+        m_read_buffer.append(buffer.data(), static_cast<std::size_t>(read_bytes));
+    }
+}
+
+auto PkgbuildEvaluator::evaluate(std::string_view options_set, std::string_view array_name) noexcept -> std::optional<std::vector<std::string>> {
+    if (m_pid == -1 && !spawn()) {
+        return std::nullopt;
+    }
+
+    std::string request{};
+
+    // Reload PKGBUILD only if it has changed on disk (e.g after git pull).
+    std::error_code err_code{};
+    const auto& pkgbuild_path = fs::path{m_pkgbuild_dir} / "PKGBUILD";
+    const auto pkgbuild_mtime = fs::last_write_time(pkgbuild_path, err_code);
+    const auto pkgbuild_size  = fs::file_size(pkgbuild_path, err_code);
+    if (err_code) {
+        fmt::print(stderr, "[PKGBUILD_EVALUATOR] '{}' stat failed: {}\n", pkgbuild_path.string(), err_code.message());
+        return std::nullopt;
+    }
+    if (pkgbuild_mtime != m_pkgbuild_mtime || pkgbuild_size != m_pkgbuild_size) {
+        request += "__km_load\n";
+        m_pkgbuild_mtime = pkgbuild_mtime;
+        m_pkgbuild_size  = pkgbuild_size;
+    }
+
+    request += "__km_reset\n";
+    request += options_set;
+    if (!options_set.ends_with('\n')) {
+        request += '\n';
+    }
+    request += fmt::format(FMT_COMPILE("__km_eval {}\n"), array_name);
+
+    std::vector<std::string> lines{};
+    if (!write_request(request) || read_reply(lines, EVAL_TIMEOUT) != ReplyStatus::done) {
+        return std::nullopt;
+    }
+    return lines;
+}
+
+auto PkgbuildEvaluator::array(std::string_view options_set, std::string_view array_name) noexcept -> std::vector<std::string> {
+    const std::lock_guard<std::mutex> guard(m_mutex);
+
+    // Restart the coprocess once, if it died in the meantime.
+    // A PKGBUILD which timed out would just time out again.
+    m_timed_out = false;
+    for (int attempt = 0; attempt < 2 && !m_timed_out; ++attempt) {
+        if (auto&& result = evaluate(options_set, array_name)) {
+            return std::move(*result);
+        }
+        terminate();
+    }
+
+    if (m_timed_out) {
+        fmt::print(stderr, "Evaluation of {} array of '{}/PKGBUILD' timed out after {}s\n", array_name, m_pkgbuild_dir,
+            std::chrono::duration_cast<std::chrono::seconds>(EVAL_TIMEOUT).count());
+        m_timed_out = false;
+    } else {
+        fmt::print(stderr, "Failed to evaluate {} array of '{}/PKGBUILD'\n", array_name, m_pkgbuild_dir);
+    }
+    return {};
+}
+
+auto PkgbuildEvaluator::source_array(std::string_view options_set) noexcept -> std::vector<std::string> {
+    return array(options_set, "source");
+}
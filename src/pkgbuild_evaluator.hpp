@@ -0,0 +1,80 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef PKGBUILD_EVALUATOR_HPP
+#define PKGBUILD_EVALUATOR_HPP
+
+#include <chrono>       // for milliseconds
+#include <cstdint>      // for int32_t, uintmax_t
+#include <filesystem>   // for file_time_type
+#include <mutex>        // for mutex
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Long-lived bash coprocess, which evaluates a single PKGBUILD.
+///
+/// The PKGBUILD is read into the shell only once (and again when it changes on disk),
+/// every request only resets the PKGBUILD variables, applies the option assignments
+/// and evaluates the cached PKGBUILD text, without writing any file or spawning a new shell.
+/// A request which doesn't finish in time (e.g PKGBUILD loops or reads stdin) kills the coprocess.
+class PkgbuildEvaluator final {
+ public:
+    explicit PkgbuildEvaluator(std::string_view pkgbuild_dir) noexcept;
+    ~PkgbuildEvaluator() noexcept;
+
+    PkgbuildEvaluator(const PkgbuildEvaluator&)            = delete;
+    PkgbuildEvaluator& operator=(const PkgbuildEvaluator&) = delete;
+
+    /// Returns ${array_name[@]} of the PKGBUILD with the options (VAR=value lines) set.
+    [[nodiscard]] auto array(std::string_view options_set, std::string_view array_name) noexcept -> std::vector<std::string>;
+    /// Returns ${source[@]} of the PKGBUILD with the options (VAR=value lines) set.
+    [[nodiscard]] auto source_array(std::string_view options_set) noexcept -> std::vector<std::string>;
+
+ private:
+    enum class ReplyStatus {
+        done,
+        closed,
+        timed_out,
+    };
+
+    bool spawn() noexcept;
+    bool spawn_shell(bool sandboxed) noexcept;
+    void terminate() noexcept;
+    bool write_request(std::string_view request) noexcept;
+    auto read_reply(std::vector<std::string>& lines, std::chrono::milliseconds timeout) noexcept -> ReplyStatus;
+    auto evaluate(std::string_view options_set, std::string_view array_name) noexcept -> std::optional<std::vector<std::string>>;
+
+    std::mutex m_mutex{};
+    std::string m_pkgbuild_dir{};
+    std::filesystem::file_time_type m_pkgbuild_mtime{};
+    std::uintmax_t m_pkgbuild_size{};
+
+    // Cleared once bwrap fails to start, e.g with unprivileged user namespaces disabled.
+    bool m_sandbox_usable{true};
+    bool m_timed_out{};
+
+    std::int32_t m_pid{-1};
+    std::int32_t m_stdin_fd{-1};
+    std::int32_t m_stdout_fd{-1};
+    // Output read from the coprocess, which doesn't form a whole line yet.
+    std::string m_read_buffer{};
+};
+
+#endif  // PKGBUILD_EVALUATOR_HPP
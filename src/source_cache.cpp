@@ -0,0 +1,266 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "source_cache.hpp"
+#include "utils.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuseless-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsuggest-attribute=pure"
+#endif
+
+#include <glib.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Objects which weren't used by any build for that long are dropped.
+constexpr auto OBJECT_MAX_AGE = std::chrono::days(30);
+
+auto get_manifest_path() noexcept -> fs::path {
+    return source_cache::get_srcdest_path() / ".manifest";
+}
+
+auto compute_glib_checksum(const fs::path& file_path, GChecksumType checksum_type) noexcept -> std::string {
+    auto* file = std::fopen(file_path.c_str(), "rb");
+    if (file == nullptr) {
+        return {};
+    }
+
+    auto* checksum = g_checksum_new(checksum_type);
+    std::array<guchar, 65536> buffer{};
+    std::size_t read_bytes{};
+    while ((read_bytes = std::fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+        g_checksum_update(checksum, buffer.data(), static_cast<gssize>(read_bytes));
+    }
+    std::fclose(file);
+
+    std::string result{g_checksum_get_string(checksum)};
+    g_checksum_free(checksum);
+    return result;
+}
+
+void prune_objects() noexcept {
+    std::error_code err_code{};
+    const auto& now = fs::file_time_type::clock::now();
+    for (const auto& object : fs::directory_iterator(source_cache::get_objects_path(), err_code)) {
+        const auto last_use = object.last_write_time(err_code);
+        if (!err_code && (now - last_use) > OBJECT_MAX_AGE) {
+            fs::remove(object.path(), err_code);
+        }
+    }
+}
+
+}  // namespace
+
+namespace source_cache {
+
+auto parse_source_entry(std::string_view entry) noexcept -> std::optional<SourceEntry> {
+    std::string_view filename{entry};
+    std::string_view url{entry};
+    if (auto delim_pos = entry.find("::"); delim_pos != std::string_view::npos) {
+        filename = entry.substr(0, delim_pos);
+        url      = entry.substr(delim_pos + 2);
+    }
+
+    // Only plain downloads end up in SRCDEST.
+    // VCS sources (e.g git+https) are cloned by makepkg, file:// may change without changing URL.
+    const auto proto_pos = url.find("://");
+    if (proto_pos == std::string_view::npos) {
+        return std::nullopt;
+    }
+    const auto& proto = url.substr(0, proto_pos);
+    if (proto != "https" && proto != "http" && proto != "ftp") {
+        return std::nullopt;
+    }
+
+    // Same as get_filename() of makepkg: only the last path component is kept.
+    if (auto slash_pos = filename.rfind('/'); slash_pos != std::string_view::npos) {
+        filename.remove_prefix(slash_pos + 1);
+    }
+    if (filename.empty()) {
+        return std::nullopt;
+    }
+
+    return SourceEntry{.filename = std::string{filename}, .url = std::string{url}};
+}
+
+auto make_entries(const std::vector<std::string>& source_array, std::string_view algo,
+    const std::vector<std::string>& checksums) noexcept -> std::vector<SourceEntry> {
+    std::vector<SourceEntry> entries{};
+    for (std::size_t i = 0; i < source_array.size(); ++i) {
+        auto entry = parse_source_entry(source_array[i]);
+        /* clang-format off */
+        if (!entry) { continue; }
+        /* clang-format on */
+
+        if (checksums.size() == source_array.size() && checksums[i] != "SKIP") {
+            entry->checksum = fmt::format(FMT_COMPILE("{}-{}"), algo, checksums[i]);
+        }
+        entries.emplace_back(std::move(*entry));
+    }
+    return entries;
+}
+
+auto get_cache_path() noexcept -> const fs::path& {
+    static const fs::path cache_path = utils::fix_path("~/.cache/cachyos-km/sources");
+    return cache_path;
+}
+
+auto get_objects_path() noexcept -> const fs::path& {
+    static const fs::path objects_path = get_cache_path() / "objects";
+    return objects_path;
+}
+
+auto get_srcdest_path() noexcept -> const fs::path& {
+    static const fs::path srcdest_path = get_cache_path() / "srcdest";
+    return srcdest_path;
+}
+
+auto compute_checksum(const fs::path& file_path, std::string_view algo) noexcept -> std::string {
+    if (algo == "sha256") {
+        return compute_glib_checksum(file_path, G_CHECKSUM_SHA256);
+    } else if (algo == "sha512") {
+        return compute_glib_checksum(file_path, G_CHECKSUM_SHA512);
+    } else if (algo == "b2") {
+        // GLib doesn't implement BLAKE2
+        const auto& output = utils::exec(fmt::format(FMT_COMPILE("b2sum -- '{}' 2>/dev/null"), file_path.string()));
+        return output.substr(0, output.find(' '));
+    }
+    return {};
+}
+
+auto lookup_object(std::string_view checksum) noexcept -> std::optional<fs::path> {
+    /* clang-format off */
+    if (checksum.empty()) { return std::nullopt; }
+    /* clang-format on */
+
+    std::error_code err_code{};
+    auto object_path = get_objects_path() / checksum;
+    if (!fs::is_regular_file(object_path, err_code)) {
+        return std::nullopt;
+    }
+    return object_path;
+}
+
+void import_downloads() noexcept {
+    const auto& manifest = utils::read_whole_file(get_manifest_path().string());
+    /* clang-format off */
+    if (manifest.empty()) { return; }
+    /* clang-format on */
+
+    std::error_code err_code{};
+    fs::create_directories(get_objects_path(), err_code);
+
+    for (auto&& line : utils::make_multiline_view(manifest, '\n')) {
+        // "<algo>-<digest> <filename>"
+        const auto space_pos = line.find(' ');
+        const auto algo_pos  = line.find('-');
+        if (space_pos == std::string_view::npos || algo_pos == std::string_view::npos || algo_pos > space_pos) {
+            continue;
+        }
+        const auto& checksum = line.substr(0, space_pos);
+        const auto& algo     = line.substr(0, algo_pos);
+        const auto& digest   = checksum.substr(algo_pos + 1);
+        const auto& src_path = get_srcdest_path() / line.substr(space_pos + 1);
+
+        // Skip missing entries, and entries which were linked from the store.
+        if (!fs::is_regular_file(fs::symlink_status(src_path, err_code)) || fs::hard_link_count(src_path, err_code) > 1) {
+            continue;
+        }
+
+        const auto& object_path = get_objects_path() / checksum;
+        if (fs::exists(object_path, err_code) || compute_checksum(src_path, algo) != digest) {
+            continue;
+        }
+        fs::rename(src_path, object_path, err_code);
+        if (err_code) {
+            fmt::print(stderr, "[SOURCE_CACHE] failed to import '{}': {}\n", src_path.string(), err_code.message());
+        }
+    }
+}
+
+std::size_t prepare_srcdest(const std::vector<SourceEntry>& entries) noexcept {
+    const auto& srcdest_path = get_srcdest_path();
+
+    std::error_code err_code{};
+    fs::create_directories(srcdest_path, err_code);
+    fs::create_directories(get_objects_path(), err_code);
+
+    import_downloads();
+    prune_objects();
+
+    // Drop files of the previous build. Directories are kept, makepkg keeps VCS clones there.
+    for (const auto& dir_entry : fs::directory_iterator(srcdest_path, err_code)) {
+        if (dir_entry.is_regular_file(err_code) || dir_entry.is_symlink(err_code)) {
+            fs::remove(dir_entry.path(), err_code);
+        }
+    }
+
+    std::size_t reused_count{};
+    std::string manifest{};
+    for (const auto& entry : entries) {
+        /* clang-format off */
+        if (entry.checksum.empty()) { continue; }
+        /* clang-format on */
+        manifest += fmt::format(FMT_COMPILE("{} {}\n"), entry.checksum, entry.filename);
+
+        const auto& object_path = lookup_object(entry.checksum);
+        if (!object_path) {
+            continue;
+        }
+
+        const auto& dest_path = srcdest_path / entry.filename;
+        fs::create_hard_link(*object_path, dest_path, err_code);
+        if (err_code) {
+            err_code.clear();
+            fs::copy_file(*object_path, dest_path, err_code);
+        }
+        if (!err_code) {
+            // Mark object as used.
+            fs::last_write_time(*object_path, fs::file_time_type::clock::now(), err_code);
+            ++reused_count;
+        }
+    }
+
+    utils::write_to_file(get_manifest_path().string(), manifest);
+    return reused_count;
+}
+
+}  // namespace source_cache
@@ -0,0 +1,71 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef SOURCE_CACHE_HPP
+#define SOURCE_CACHE_HPP
+
+#include <cstddef>      // for size_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Persistent cache of downloaded sources, which lives outside of the PKGBUILDs checkout.
+///
+/// Layout of ~/.cache/cachyos-km/sources:
+///   objects/<algo>-<digest>  verified source files, named by their checksum
+///   srcdest/                 SRCDEST of the current build, hardlinks into objects/
+///   srcdest/.manifest        checksums expected by the current build
+namespace source_cache {
+
+struct SourceEntry {
+    std::string filename{};
+    std::string url{};
+    // "<algo>-<digest>" as declared by PKGBUILD, empty if unknown or SKIP.
+    std::string checksum{};
+};
+
+/// Parses makepkg source entry ("name::url" or "url").
+/// Returns nothing for local files and VCS sources, they aren't downloaded into SRCDEST.
+[[nodiscard]] auto parse_source_entry(std::string_view entry) noexcept -> std::optional<SourceEntry>;
+
+/// Pairs the source array with the checksums array of the given algo (e.g "b2", "sha256").
+[[nodiscard]] auto make_entries(const std::vector<std::string>& source_array, std::string_view algo,
+    const std::vector<std::string>& checksums) noexcept -> std::vector<SourceEntry>;
+
+[[nodiscard]] auto get_cache_path() noexcept -> const std::filesystem::path&;
+[[nodiscard]] auto get_objects_path() noexcept -> const std::filesystem::path&;
+[[nodiscard]] auto get_srcdest_path() noexcept -> const std::filesystem::path&;
+
+/// Computes checksum of the file as hex string. Supported algos: b2, sha256, sha512.
+[[nodiscard]] auto compute_checksum(const std::filesystem::path& file_path, std::string_view algo) noexcept -> std::string;
+
+/// Returns path of the object in the store, if present.
+[[nodiscard]] auto lookup_object(std::string_view checksum) noexcept -> std::optional<std::filesystem::path>;
+
+/// Moves downloads of the previous build, which match the expected checksum, into the store.
+void import_downloads() noexcept;
+
+/// Prepares SRCDEST for the build, every entry already present in the store is linked into it.
+/// Returns count of reused entries.
+std::size_t prepare_srcdest(const std::vector<SourceEntry>& entries) noexcept;
+
+}  // namespace source_cache
+
+#endif  // SOURCE_CACHE_HPP
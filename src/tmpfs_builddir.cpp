@@ -0,0 +1,170 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "tmpfs_builddir.hpp"
+#include "build_pipeline.hpp"
+
+#include <array>
+#include <random>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#include <fcntl.h>        // for open
+#include <linux/magic.h>  // for TMPFS_MAGIC
+#include <sys/file.h>     // for flock
+#include <sys/stat.h>     // for lstat
+#include <sys/vfs.h>      // for statfs
+#include <unistd.h>       // for getuid, close
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::uint64_t GIB_IN_KIB = 1024 * 1024;
+// Below that the kernel starts reclaiming, tmpfs pages can go only to swap.
+constexpr std::uint64_t LOW_MEMORY = 1 * GIB_IN_KIB;
+
+constexpr std::array TMPFS_CANDIDATES{"/tmp", "/dev/shm"};
+// The build holds it on the build directory, see make_create_command.
+constexpr std::int32_t LOCK_FD = 8;
+
+constexpr auto to_gib(std::uint64_t kib) noexcept -> double {
+    return static_cast<double>(kib) / static_cast<double>(GIB_IN_KIB);
+}
+
+bool is_tmpfs(const fs::path& path) noexcept {
+    struct statfs fs_info { };
+    if (statfs(path.c_str(), &fs_info) != 0) {
+        return false;
+    }
+    return static_cast<unsigned long>(fs_info.f_type) == TMPFS_MAGIC;
+}
+
+auto get_builddir_prefix() noexcept -> std::string {
+    return fmt::format(FMT_COMPILE("cachyos-km-{}-"), getuid());
+}
+
+// /tmp is shared with other users, the directory gets an unpredictable name like with mkdtemp.
+auto make_builddir_path(const fs::path& tmpfs_path) noexcept -> std::string {
+    static constexpr std::string_view NAME_CHARS = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+    std::random_device random_device{};
+    std::uniform_int_distribution<std::size_t> distribution{0, NAME_CHARS.size() - 1};
+    std::string suffix(12, '\0');
+    for (auto& name_char : suffix) {
+        name_char = NAME_CHARS[distribution(random_device)];
+    }
+    return (tmpfs_path / fmt::format(FMT_COMPILE("{}{}"), get_builddir_prefix(), suffix)).string();
+}
+
+bool is_private_dir(const fs::path& dir_path) noexcept {
+    struct stat dir_stat { };
+    return lstat(dir_path.c_str(), &dir_stat) == 0 && S_ISDIR(dir_stat.st_mode) && dir_stat.st_uid == getuid() && (dir_stat.st_mode & 077) == 0;
+}
+
+}  // namespace
+
+namespace tmpfs_builddir {
+
+auto find_tmpfs() noexcept -> std::optional<fs::path> {
+    std::optional<fs::path> result{};
+    std::uint64_t result_free_space{};
+    for (const auto* candidate : TMPFS_CANDIDATES) {
+        /* clang-format off */
+        if (!is_tmpfs(candidate)) { continue; }
+        /* clang-format on */
+        const auto free_space = get_free_space(candidate);
+        if (!result || free_space > result_free_space) {
+            result            = candidate;
+            result_free_space = free_space;
+        }
+    }
+    return result;
+}
+
+auto get_free_space(const fs::path& path) noexcept -> std::uint64_t {
+    struct statfs fs_info { };
+    if (statfs(path.c_str(), &fs_info) != 0) {
+        return 0;
+    }
+    return fs_info.f_bavail * static_cast<std::uint64_t>(fs_info.f_bsize) / 1024;
+}
+
+auto decide(const build_resources::SystemResources& resources, std::uint64_t builddir_kib, std::uint64_t build_mem_kib) noexcept -> Decision {
+    const auto& tmpfs_path = find_tmpfs();
+    if (!tmpfs_path) {
+        return Decision{.reason = "no tmpfs mounted, building on disk"};
+    }
+
+    const auto needed_mem = builddir_kib + build_mem_kib;
+    if (needed_mem > resources.mem_available_kib) {
+        return Decision{.reason = fmt::format(FMT_COMPILE("needs ~{:.0f} GiB, {:.0f} GiB available, building on disk"),
+                            to_gib(needed_mem), to_gib(resources.mem_available_kib))};
+    }
+    if (const auto free_space = get_free_space(*tmpfs_path); builddir_kib > free_space) {
+        return Decision{.reason = fmt::format(FMT_COMPILE("{} has only {:.0f} GiB free, building on disk"), tmpfs_path->string(), to_gib(free_space))};
+    }
+
+    auto builddir = make_builddir_path(*tmpfs_path);
+    auto reason   = fmt::format(FMT_COMPILE("building in {}, needs ~{:.0f} GiB of {:.0f} GiB available"), builddir, to_gib(needed_mem),
+        to_gib(resources.mem_available_kib));
+    return Decision{.builddir = std::move(builddir), .reason = std::move(reason)};
+}
+
+auto make_create_command(std::string_view builddir) noexcept -> std::string {
+    // mkdir doesn't follow a planted symlink and fails on an existing name.
+    // remove_stale may have removed the directory before it got locked, then it's gone.
+    const auto& dir = build_pipeline::shell_quote(builddir);
+    return fmt::format(FMT_COMPILE("mkdir -m 700 -- {0} && exec {1}<{0} && flock -n {1} && test -d {0}"), dir, LOCK_FD);
+}
+
+void remove_stale() noexcept {
+    const auto& prefix = get_builddir_prefix();
+    for (const auto* candidate : TMPFS_CANDIDATES) {
+        std::error_code err_code{};
+        for (const auto& dir_entry : fs::directory_iterator(candidate, err_code)) {
+            const auto& dir_path = dir_entry.path();
+            /* clang-format off */
+            if (!dir_path.filename().string().starts_with(prefix) || !is_private_dir(dir_path)) { continue; }
+            /* clang-format on */
+
+            const std::int32_t dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            /* clang-format off */
+            if (dir_fd == -1) { continue; }
+            /* clang-format on */
+            // Held by a running build. The lock is kept during the removal, a new build can't lock it meanwhile.
+            if (flock(dir_fd, LOCK_EX | LOCK_NB) == 0) {
+                fs::remove_all(dir_path, err_code);
+                fmt::print(stderr, "Removed stale build directory '{}'\n", dir_path.string());
+            }
+            close(dir_fd);
+        }
+    }
+}
+
+auto check_memory() noexcept -> std::optional<std::string> {
+    const auto& resources = build_resources::read_system_resources();
+    if (resources.mem_available_kib >= LOW_MEMORY) {
+        return std::nullopt;
+    }
+    return fmt::format(FMT_COMPILE("only {:.1f} GiB of memory available, the build directory in tmpfs may be swapped out"),
+        to_gib(resources.mem_available_kib));
+}
+
+}  // namespace tmpfs_builddir
@@ -0,0 +1,61 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef TMPFS_BUILDDIR_HPP
+#define TMPFS_BUILDDIR_HPP
+
+#include "build_resources.hpp"
+
+#include <cstdint>      // for uint64_t
+#include <filesystem>   // for path
+#include <optional>     // for optional
+#include <string>       // for string
+#include <string_view>  // for string_view
+
+/// Build directory in memory: BUILDDIR of makepkg on a tmpfs, if it fits next to the build itself.
+/// Objects are written and read back only from memory, which matters on slow disks and network homes.
+namespace tmpfs_builddir {
+
+struct Decision {
+    // BUILDDIR on the tmpfs, empty to build on disk. It doesn't exist yet, the build command creates it.
+    std::string builddir{};
+    std::string reason{};
+};
+
+/// Mounted tmpfs (/tmp or /dev/shm) with the most free space, nothing if there is none.
+[[nodiscard]] auto find_tmpfs() noexcept -> std::optional<std::filesystem::path>;
+/// Free space of the filesystem in KiB.
+[[nodiscard]] auto get_free_space(const std::filesystem::path& path) noexcept -> std::uint64_t;
+
+/// Decides where to build. Memory of the tmpfs can't be reclaimed without swap,
+/// so the estimated build directory and the memory of the build itself must fit into the available memory.
+/// The build directory on the tmpfs gets an unpredictable name, a cancelled build leaves nothing behind.
+[[nodiscard]] auto decide(const build_resources::SystemResources& resources, std::uint64_t builddir_kib, std::uint64_t build_mem_kib) noexcept -> Decision;
+
+/// Shell command, which creates the build directory private to the user (it fails if the name is taken)
+/// and holds a lock on it until the shell exits.
+[[nodiscard]] auto make_create_command(std::string_view builddir) noexcept -> std::string;
+/// Removes build directories of the user left by builds killed together with their shell, those nothing holds a lock on.
+void remove_stale() noexcept;
+
+/// Returns a warning once the available memory is low enough for the kernel to start swapping.
+[[nodiscard]] auto check_memory() noexcept -> std::optional<std::string>;
+
+}  // namespace tmpfs_builddir
+
+#endif  // TMPFS_BUILDDIR_HPP
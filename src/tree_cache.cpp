@@ -0,0 +1,122 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "tree_cache.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+#include <fmt/compile.h>
+#include <fmt/core.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuseless-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsuggest-attribute=pure"
+#endif
+
+#include <glib.h>
+
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace fs = std::filesystem;
+
+namespace tree_cache {
+
+auto get_trees_path() noexcept -> const fs::path& {
+    static const fs::path trees_path = utils::fix_path("~/.cache/cachyos-km/trees");
+    return trees_path;
+}
+
+bool is_reusable(std::string_view options_set) noexcept {
+    static constexpr std::array non_reproducible_options{
+        "_makenconfig=", "_makemenuconfig=", "_makexconfig=", "_makegconfig=", "_localmodcfg="};
+
+    return std::ranges::none_of(non_reproducible_options, [options_set](auto&& option) {
+        return options_set.starts_with(option) || options_set.find(fmt::format(FMT_COMPILE("\n{}"), option)) != std::string_view::npos;
+    });
+}
+
+auto format_local_patches(const std::vector<std::string>& patches) noexcept -> std::string {
+    std::string result{};
+    for (const auto& patch : patches) {
+        if (patch.starts_with("file://")) {
+            result += fmt::format(FMT_COMPILE("{}#{}\n"), patch, utils::git_blob_id(std::string_view{patch}.substr(7)));
+        }
+    }
+    return result;
+}
+
+auto compute_key(std::string_view pkgbuild_path, std::string_view options_set,
+    const std::vector<std::string>& patches) noexcept -> std::string {
+    const auto& key_src = fmt::format(FMT_COMPILE("{}\n{}{}"), utils::git_blob_id(pkgbuild_path), options_set, format_local_patches(patches));
+
+    auto* checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key_src.c_str(), static_cast<gssize>(key_src.size()));
+    std::string result{checksum};
+    g_free(checksum);
+    return result;
+}
+
+auto get_snapshot_path(std::string_view key) noexcept -> fs::path {
+    return get_trees_path() / key;
+}
+
+bool has_snapshot(std::string_view key) noexcept {
+    std::error_code err_code{};
+    return !key.empty() && fs::is_directory(get_snapshot_path(key), err_code);
+}
+
+void touch_snapshot(std::string_view key) noexcept {
+    std::error_code err_code{};
+    fs::last_write_time(get_snapshot_path(key), fs::file_time_type::clock::now(), err_code);
+}
+
+void prune_snapshots(std::size_t keep_count, std::string_view keep_key) noexcept {
+    std::error_code err_code{};
+    std::vector<std::pair<fs::file_time_type, fs::path>> snapshots{};
+    for (const auto& dir_entry : fs::directory_iterator(get_trees_path(), err_code)) {
+        if (dir_entry.path().filename() == keep_key) {
+            continue;
+        }
+        snapshots.emplace_back(dir_entry.last_write_time(err_code), dir_entry.path());
+    }
+    /* clang-format off */
+    if (snapshots.size() <= keep_count) { return; }
+    /* clang-format on */
+
+    // newest first
+    std::ranges::sort(snapshots, std::ranges::greater{}, &std::pair<fs::file_time_type, fs::path>::first);
+    for (std::size_t i = keep_count; i < snapshots.size(); ++i) {
+        fs::remove_all(snapshots[i].second, err_code);
+    }
+}
+
+}  // namespace tree_cache
@@ -0,0 +1,58 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef TREE_CACHE_HPP
+#define TREE_CACHE_HPP
+
+#include <cstddef>      // for size_t
+#include <filesystem>   // for path
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+/// Snapshots of extracted and patched source trees ($srcdir after prepare()),
+/// stored in ~/.cache/cachyos-km/trees/<key>.
+namespace tree_cache {
+
+[[nodiscard]] auto get_trees_path() noexcept -> const std::filesystem::path&;
+
+/// Returns false if prepare() result doesn't depend only on PKGBUILD and options,
+/// e.g with interactive config tools or localmodcfg.
+[[nodiscard]] bool is_reusable(std::string_view options_set) noexcept;
+
+/// Content of the local (file://) patches, they may be edited in place while their path in PKGBUILD stays the same.
+/// "<patch>#<blob id>" lines.
+[[nodiscard]] auto format_local_patches(const std::vector<std::string>& patches) noexcept -> std::string;
+
+/// Key of the tree produced by prepare(): PKGBUILD (version, sources, order of patches, name),
+/// the option set and the content of the local patches.
+[[nodiscard]] auto compute_key(std::string_view pkgbuild_path, std::string_view options_set,
+    const std::vector<std::string>& patches) noexcept -> std::string;
+
+[[nodiscard]] auto get_snapshot_path(std::string_view key) noexcept -> std::filesystem::path;
+[[nodiscard]] bool has_snapshot(std::string_view key) noexcept;
+
+/// Marks the snapshot as recently used.
+void touch_snapshot(std::string_view key) noexcept;
+
+/// Keeps only keep_count most recently used snapshots, and the one with keep_key.
+void prune_snapshots(std::size_t keep_count, std::string_view keep_key) noexcept;
+
+}  // namespace tree_cache
+
+#endif  // TREE_CACHE_HPP
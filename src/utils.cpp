@@ -20,10 +20,13 @@
 #include "ini.hpp"
 
 #include <cerrno>   // for errno
+#include <csignal>  // for kill, SIGTERM
 #include <cstdio>   // for fopen, fclose, fread, fseek, ftell, SEEK_END, SEEK_SET
-#include <cstdlib>  // for system
+#include <cstdlib>  // for getenv
 
 #include <filesystem>
+#include <mutex>
+#include <thread>
 
 #include <fmt/core.h>
 
@@ -51,6 +54,9 @@
 #pragma GCC diagnostic pop
 #endif
 
+#include <sys/wait.h>  // for waitpid
+#include <unistd.h>    // for setpgid
+
 namespace fs = std::filesystem;
 
 namespace utils {
@@ -141,13 +147,35 @@ std::string fix_path(std::string&& path) noexcept {
     return std::move(path);
 }
 
+auto git_blob_id(const std::string_view& filepath) noexcept -> std::string {
+    const auto& file_content = utils::read_whole_file(filepath);
+
+    auto blob = fmt::format("blob {}", file_content.size());
+    blob.push_back('\0');
+    blob += file_content;
+
+    auto* checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1, reinterpret_cast<const guchar*>(blob.data()), blob.size());
+    std::string result{checksum};
+    g_free(checksum);
+    return result;
+}
+
 alpm_handle_t* parse_alpm(std::string_view root, std::string_view dbpath, alpm_errno_t* err) noexcept {
     // Initialize alpm.
     alpm_handle_t* alpm_handle = alpm_initialize(root.data(), dbpath.data(), err);
+    /* clang-format off */
+    if (alpm_handle == nullptr) { return nullptr; }
+    /* clang-format on */
 
     // Parse pacman config.
-    static constexpr auto pacman_conf_path = "/etc/pacman.conf";
-    static constexpr auto ignored_repo     = "testing";
+    // Prefer the config of the target root (e.g. chroot or container image),
+    // and fallback to the host one.
+    static constexpr auto ignored_repo = "testing";
+
+    std::string pacman_conf_path = fmt::format("{}/etc/pacman.conf", root);
+    if (root == "/" || !fs::exists(pacman_conf_path)) {
+        pacman_conf_path = "/etc/pacman.conf";
+    }
 
     const mINI::INIFile file(pacman_conf_path);
     // next, create a structure that will hold data
@@ -175,32 +203,158 @@ std::int32_t release_alpm(alpm_handle_t* handle, alpm_errno_t* err) noexcept {
     return ret;
 }
 
-void prepare_build_environment() noexcept {
-    static const fs::path app_path       = utils::fix_path("~/.cache/cachyos-km");
-    static const fs::path pkgbuilds_path = utils::fix_path("~/.cache/cachyos-km/pkgbuilds");
-    if (!fs::exists(app_path)) {
-        fs::create_directories(app_path);
+std::int32_t run_cancellable(const std::vector<std::string>& argv, const cancel_predicate_t& is_cancelled) noexcept {
+    std::vector<gchar*> child_argv{};
+    for (const auto& arg : argv) {
+        child_argv.push_back(const_cast<gchar*>(arg.c_str()));  // NOLINT
+    }
+    child_argv.push_back(nullptr);
+
+    // Put the child into its own process group, so we can kill it with all of its children
+    // (e.g git-remote-https).
+    static constexpr auto child_setup = [](gpointer) { setpgid(0, 0); };
+
+    GPid child_pid{};
+    g_autoptr(GError) error = nullptr;
+    g_spawn_async(nullptr, child_argv.data(), nullptr,
+        static_cast<GSpawnFlags>(G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH),
+        child_setup, nullptr, &child_pid, &error);
+    if (error != nullptr) {
+        fmt::print(stderr, "Spawning '{}' failed: {}\n", argv[0], error->message);
+        return -1;
+    }
+
+    std::int32_t status{};
+    while (waitpid(child_pid, &status, WNOHANG) == 0) {
+        if (is_cancelled && is_cancelled()) {
+            kill(-child_pid, SIGTERM);
+            waitpid(child_pid, &status, 0);
+            g_spawn_close_pid(child_pid);
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    g_spawn_close_pid(child_pid);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+bool fetch_git_repo(std::string_view repo_path, std::string_view url, std::string_view branch,
+    std::chrono::seconds max_fetch_age, const cancel_predicate_t& is_cancelled) noexcept {
+    const fs::path repo_dir{repo_path};
+    const auto& fetch_stamp = repo_dir / ".git" / "cachyos-km-fetch";
+    const auto& repo_str    = repo_dir.string();
+
+    if (!fs::exists(repo_dir)) {
+        const std::int32_t clone_status = run_cancellable({"git", "clone", "--depth=1", "--single-branch",
+                                                              "--branch", std::string{branch}, std::string{url}, repo_str},
+            is_cancelled);
+        if (clone_status != 0) {
+            return false;
+        }
+        return utils::write_to_file(fetch_stamp.string(), "");
+    }
+
+    // Skip fetch if the last one is recent enough.
+    std::error_code err_code{};
+    const auto last_fetch_time = fs::last_write_time(fetch_stamp, err_code);
+    if (!err_code && (fs::file_time_type::clock::now() - last_fetch_time) < max_fetch_age) {
+        return true;
+    }
+
+    const std::int32_t fetch_status = run_cancellable({"git", "-C", repo_str, "fetch", "--depth=1", "origin", std::string{branch}}, is_cancelled);
+    if (fetch_status != 0) {
+        return false;
+    }
+    return utils::write_to_file(fetch_stamp.string(), "");
+}
+
+namespace {
+
+// Syncs of the PKGBUILDs repo must not run concurrently (e.g background prefetch and configure).
+std::timed_mutex g_pkgbuilds_mutex{};  // NOLINT
+
+constexpr auto PKGBUILDS_BRANCH          = "master";
+constexpr auto PKGBUILDS_MAX_FETCH_AGE   = std::chrono::minutes(10);
+constexpr auto PKGBUILDS_DEFAULT_URL     = "https://github.com/cachyos/linux-cachyos.git";
+constexpr auto PKGBUILDS_URL_ENVIRONMENT = "CACHYOS_KM_PKGBUILDS_URL";
+
+auto get_pkgbuilds_url() noexcept -> std::string_view {
+    // Allows to point the manager to a mirror, or to a local bare repo.
+    const char* url_override = std::getenv(PKGBUILDS_URL_ENVIRONMENT);  // NOLINT
+    return (url_override != nullptr) ? url_override : PKGBUILDS_DEFAULT_URL;
+}
+
+auto lock_pkgbuilds(const cancel_predicate_t& is_cancelled) noexcept -> std::unique_lock<std::timed_mutex> {
+    std::unique_lock<std::timed_mutex> lock(g_pkgbuilds_mutex, std::defer_lock);
+    while (!lock.try_lock_for(std::chrono::milliseconds(100))) {
+        if (is_cancelled && is_cancelled()) {
+            break;
+        }
     }
+    return lock;
+}
 
-    fs::current_path(app_path);
+auto get_pkgbuilds_path() noexcept -> const fs::path& {
+    static const fs::path pkgbuilds_path = utils::fix_path("~/.cache/cachyos-km/pkgbuilds");
+    return pkgbuilds_path;
+}
+
+bool sync_pkgbuilds(const cancel_predicate_t& is_cancelled) noexcept {
+    static const fs::path app_path = utils::fix_path("~/.cache/cachyos-km");
+    const auto& pkgbuilds_path     = get_pkgbuilds_path();
+
+    std::error_code err_code{};
+    fs::create_directories(app_path, err_code);
 
     // Check if folder exits, but .git doesn't.
     if (fs::exists(pkgbuilds_path) && !fs::exists(pkgbuilds_path / ".git")) {
-        fs::remove_all(pkgbuilds_path);
+        fs::remove_all(pkgbuilds_path, err_code);
     }
 
-    std::int32_t cmd_status{};
-    if (!fs::exists(pkgbuilds_path)) {
-        cmd_status = std::system("git clone https://github.com/cachyos/linux-cachyos.git pkgbuilds");
+    const bool is_fetched = fetch_git_repo(pkgbuilds_path.string(), get_pkgbuilds_url(), PKGBUILDS_BRANCH, PKGBUILDS_MAX_FETCH_AGE, is_cancelled);
+
+    // Failed fetch of the existing clone is not fatal, e.g we are offline.
+    if (!is_fetched && fs::exists(pkgbuilds_path / ".git") && !(is_cancelled && is_cancelled())) {
+        fmt::print(stderr, "Failed to fetch PKGBUILDs, using local copy\n");
+        return true;
     }
+    return is_fetched;
+}
 
-    fs::current_path(pkgbuilds_path);
-    cmd_status += std::system("git checkout --force master");
-    cmd_status += std::system("git clean -fd");
-    cmd_status += std::system("git pull");
+}  // namespace
+
+bool prefetch_build_environment(const cancel_predicate_t& is_cancelled) noexcept {
+    auto lock = lock_pkgbuilds(is_cancelled);
+    /* clang-format off */
+    if (!lock.owns_lock()) { return false; }
+    /* clang-format on */
+
+    return sync_pkgbuilds(is_cancelled);
+}
+
+bool prepare_build_environment(const cancel_predicate_t& is_cancelled) noexcept {
+    auto lock = lock_pkgbuilds(is_cancelled);
+    /* clang-format off */
+    if (!lock.owns_lock()) { return false; }
+    if (!sync_pkgbuilds(is_cancelled)) { return false; }
+    /* clang-format on */
+
+    const auto& pkgbuilds_str = get_pkgbuilds_path().string();
+    const auto& remote_branch = fmt::format("origin/{}", PKGBUILDS_BRANCH);
+
+    // Drop changes made by the previous build (e.g modified PKGBUILD).
+    std::int32_t cmd_status{};
+    cmd_status += run_cancellable({"git", "-C", pkgbuilds_str, "checkout", "--force", PKGBUILDS_BRANCH}, is_cancelled);
+    cmd_status += run_cancellable({"git", "-C", pkgbuilds_str, "reset", "--hard", remote_branch}, is_cancelled);
+    cmd_status += run_cancellable({"git", "-C", pkgbuilds_str, "clean", "-fd"}, is_cancelled);
     if (cmd_status != 0) {
-        std::perror("prepare_build_environment");
+        fmt::print(stderr, "prepare_build_environment: failed to reset PKGBUILDs\n");
+        return false;
     }
+
+    fs::current_path(get_pkgbuilds_path());
+    return true;
 }
 
 void restore_clean_environment(std::vector<std::string>& previously_set_options, std::string_view all_set_values) noexcept {
@@ -19,6 +19,8 @@
 #ifndef UTILS_HPP
 #define UTILS_HPP
 
+#include <chrono>       // for seconds
+#include <functional>   // for function
 #include <span>         // for span
 #include <string>       // for string
 #include <string_view>  // for string_view
@@ -61,6 +63,8 @@ namespace utils {
 bool write_to_file(const std::string_view& filepath, const std::string_view& data) noexcept;
 std::string exec(const std::string_view& command) noexcept;
 [[nodiscard]] std::string fix_path(std::string&& path) noexcept;
+// Returns the same id as `git hash-object` would, without spawning git.
+[[nodiscard]] auto git_blob_id(const std::string_view& filepath) noexcept -> std::string;
 
 alpm_handle_t* parse_alpm(std::string_view root, std::string_view dbpath, alpm_errno_t* err) noexcept;
 std::int32_t release_alpm(alpm_handle_t* handle, alpm_errno_t* err) noexcept;
@@ -68,7 +72,22 @@ std::int32_t release_alpm(alpm_handle_t* handle, alpm_errno_t* err) noexcept;
 // Runs a command in a terminal, escalates using pkexec if escalate is true
 int runCmdTerminal(QString cmd, bool escalate) noexcept;
 
-void prepare_build_environment() noexcept;
+using cancel_predicate_t = std::function<bool()>;
+
+// Runs the command (without shell) and waits for it to finish.
+// The whole process group of the command is killed, as soon as is_cancelled returns true.
+// Returns the exit code, or -1 if it failed to start, was killed or cancelled.
+std::int32_t run_cancellable(const std::vector<std::string>& argv, const cancel_predicate_t& is_cancelled = {}) noexcept;
+
+// Shallow clones the repository, or fetches it if the last fetch is older than max_fetch_age.
+// Doesn't touch the working tree of already existing clone.
+bool fetch_git_repo(std::string_view repo_path, std::string_view url, std::string_view branch,
+    std::chrono::seconds max_fetch_age, const cancel_predicate_t& is_cancelled = {}) noexcept;
+
+// Fetches PKGBUILDs in the background, without changing the working tree.
+bool prefetch_build_environment(const cancel_predicate_t& is_cancelled = {}) noexcept;
+// Syncs PKGBUILDs, resets the working tree and enters the PKGBUILDs directory.
+bool prepare_build_environment(const cancel_predicate_t& is_cancelled = {}) noexcept;
 void restore_clean_environment(std::vector<std::string>& previously_set_options, std::string_view all_set_values) noexcept;
 
 inline constexpr std::size_t replace_all(std::string& inout, std::string_view what, std::string_view with) noexcept {
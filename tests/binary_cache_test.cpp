@@ -0,0 +1,127 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "binary_cache.hpp"
+#include "build_pipeline.hpp"
+#include "utils.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <tuple>
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Runs the command with bash, like the terminal helper does.
+auto run_bash(std::string_view command) -> int {
+    return std::system(fmt::format("bash -c {} >/dev/null 2>&1", build_pipeline::shell_quote(command)).c_str());
+}
+
+// Creates a signing key without passphrase in the keyring.
+void create_key(const fs::path& gnupg_home, std::string_view user_id) {
+    fs::create_directories(gnupg_home);
+    fs::permissions(gnupg_home, fs::perms::owner_all);
+    REQUIRE(std::system(fmt::format("GNUPGHOME='{}' gpg --batch --passphrase '' --quick-gen-key '{}' ed25519 sign never >/dev/null 2>&1",
+                            gnupg_home.string(), user_id)
+                            .c_str())
+        == 0);
+}
+
+// Publishes the package of a finished build, as the build command does.
+void publish(const fs::path& entry_path, const fs::path& package_path) {
+    REQUIRE(run_bash(fmt::format("__km_pkgs=({}); {}", build_pipeline::shell_quote(package_path.string()),
+                binary_cache::make_publish_command(entry_path.string())))
+        == 0);
+}
+
+// Fetches the stored build and writes the fetched package paths into the list file.
+auto fetch(const fs::path& entry_path, const fs::path& list_path) -> int {
+    return run_bash(fmt::format("{} && printf '%s\\n' \"${{__km_pkgs[@]}}\" > {}", binary_cache::make_fetch_command(entry_path.string()),
+        build_pipeline::shell_quote(list_path.string())));
+}
+
+}  // namespace
+
+// A local directory stands in for the shared store, the keys live in a keyring of the test HOME.
+TEST_CASE("stored builds are installed only with a trusted signature", "[binary_cache]") {
+    const fs::path home_path{std::getenv("HOME")};  // NOLINT
+    const auto& gnupg_home       = home_path / "gnupg";
+    const auto& other_gnupg_home = home_path / "other-gnupg";
+    // Every section starts from scratch, agents of the removed keyrings must not be reused.
+    for (const auto& keyring_path : {gnupg_home, other_gnupg_home}) {
+        std::ignore = std::system(fmt::format("GNUPGHOME='{}' gpgconf --kill gpg-agent >/dev/null 2>&1", keyring_path.string()).c_str());
+    }
+    fs::remove_all(home_path);
+    fs::create_directories(home_path);
+
+    REQUIRE(setenv("GNUPGHOME", gnupg_home.c_str(), 1) == 0);
+    create_key(gnupg_home, "builder <builder@localhost>");
+
+    const auto& store_path   = home_path / "store";
+    const auto& package_path = home_path / "linux-cachyos-6.9.1-1-x86_64.pkg.tar.zst";
+    const auto& list_path    = home_path / "fetched";
+    REQUIRE(utils::write_to_file(package_path.string(), "package\n"));
+
+    const std::string fingerprint{"0123456789abcdef"};
+    const auto& entry_path = binary_cache::get_entry_path(store_path, fingerprint);
+    publish(entry_path, package_path);
+    REQUIRE(fs::exists(entry_path / "SHA256SUMS.sig"));
+
+    SECTION("signed build is found and fetched") {
+        const auto& packages = binary_cache::lookup_packages(store_path, fingerprint);
+        REQUIRE(packages.size() == 1);
+        CHECK(packages[0].filename() == package_path.filename());
+
+        REQUIRE(fetch(entry_path, list_path) == 0);
+        const auto& fetched_path = utils::read_whole_file(list_path.string());
+        CHECK(fetched_path.ends_with("/linux-cachyos-6.9.1-1-x86_64.pkg.tar.zst\n"));
+        CHECK_FALSE(fetched_path.starts_with(entry_path.string()));
+    }
+
+    SECTION("unsigned entry isn't used") {
+        fs::remove(entry_path / "SHA256SUMS.sig");
+        CHECK(binary_cache::lookup_packages(store_path, fingerprint).empty());
+    }
+
+    SECTION("modified package is refused") {
+        REQUIRE(utils::write_to_file((entry_path / package_path.filename()).string(), "modified\n"));
+        CHECK(fetch(entry_path, list_path) != 0);
+    }
+
+    SECTION("entry copied to another fingerprint is refused") {
+        const auto& other_path = binary_cache::get_entry_path(store_path, "fedcba9876543210");
+        fs::copy(entry_path, other_path);
+        CHECK(binary_cache::lookup_packages(store_path, "fedcba9876543210").empty());
+        CHECK(fetch(other_path, list_path) != 0);
+    }
+
+    SECTION("signature of an untrusted key is refused") {
+        // The key of another machine is known, but nobody has certified it.
+        create_key(other_gnupg_home, "other <other@localhost>");
+        REQUIRE(std::system(fmt::format("GNUPGHOME='{}' gpg --batch --export | gpg --batch --import >/dev/null 2>&1", other_gnupg_home.string()).c_str()) == 0);
+        REQUIRE(std::system(fmt::format("GNUPGHOME='{0}' gpg --batch --yes --detach-sign '{1}/SHA256SUMS' >/dev/null 2>&1", other_gnupg_home.string(), entry_path.string()).c_str()) == 0);
+        // A miss, the options are built again instead of failing to install.
+        CHECK(binary_cache::lookup_packages(store_path, fingerprint).empty());
+        CHECK(fetch(entry_path, list_path) != 0);
+    }
+}
@@ -0,0 +1,114 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "build_pipeline.hpp"
+#include "utils.hpp"
+
+#include <array>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+auto run_bash(std::string_view command) -> int {
+    return std::system(fmt::format("bash -c {} >/dev/null 2>&1", build_pipeline::shell_quote(command)).c_str());
+}
+
+void write_file(const fs::path& file_path, std::string_view content) {
+    fs::create_directories(file_path.parent_path());
+    REQUIRE(utils::write_to_file(file_path.string(), content));
+}
+
+}  // namespace
+
+TEST_CASE("incremental sync", "[build_pipeline]")
+{
+    const auto& home        = fs::temp_directory_path() / "cachyos-km-sync-test";
+    const auto& srcdir      = home / "prepared" / "src";
+    const auto& work_srcdir = home / "builds" / "linux-cachyos" / "src";
+    const auto& files_path  = (home / "builds" / "linux-cachyos.files").string();
+    const auto& sync        = [&] { return run_bash(build_pipeline::make_sync_command(srcdir.string(), work_srcdir.string(), files_path)); };
+    if (run_bash("command -v rsync") != 0) {
+        SKIP("rsync is not installed");
+    }
+    fs::remove_all(home);
+
+    // Prepared tree of the first build, a patch adds drivers/extra.c.
+    write_file(srcdir / "linux-6.13" / "Makefile", "all:\n");
+    write_file(srcdir / "linux-6.13" / "scripts" / "basic" / "fixdep.c", "int main() {}\n");
+    write_file(srcdir / "linux-6.13" / "drivers" / "core.c", "int core;\n");
+    write_file(srcdir / "linux-6.13" / "drivers" / "extra.c", "int extra;\n");
+    write_file(srcdir / "linux-6.13" / ".config", "CONFIG_A=y\n");
+    fs::create_directories(work_srcdir);
+    REQUIRE(sync() == 0);
+    CHECK(fs::exists(work_srcdir / "linux-6.13" / "drivers" / "extra.c"));
+    CHECK(fs::exists(files_path));
+
+    // kbuild output of the first build, none of it is in the prepared tree.
+    const auto& kernel_dir = work_srcdir / "linux-6.13";
+    const std::array build_outputs{
+        kernel_dir / "scripts" / "basic" / "fixdep",
+        kernel_dir / "scripts" / "mod" / "modpost",
+        kernel_dir / "include" / "generated" / "autoconf.h",
+        kernel_dir / "include" / "config" / "auto.conf",
+        kernel_dir / "arch" / "x86" / "include" / "generated" / "asm" / "syscalls_64.h",
+        kernel_dir / "drivers" / "core.o",
+        kernel_dir / "drivers" / ".core.o.cmd",
+        kernel_dir / "modules.builtin",
+        kernel_dir / ".tmp_vmlinux.kallsyms1.S",
+        kernel_dir / "certs" / "signing_key.pem",
+    };
+    for (const auto& output : build_outputs) {
+        write_file(output, "built\n");
+    }
+    const auto fixdep_mtime = fs::last_write_time(kernel_dir / "scripts" / "basic" / "fixdep");
+    const auto core_mtime   = fs::last_write_time(kernel_dir / "drivers" / "core.c");
+
+    SECTION("second sync keeps the build outputs")
+    {
+        // The patch is dropped, another option changes .config.
+        fs::remove(srcdir / "linux-6.13" / "drivers" / "extra.c");
+        write_file(srcdir / "linux-6.13" / ".config", "CONFIG_A=y\nCONFIG_B=y\n");
+        REQUIRE(sync() == 0);
+
+        for (const auto& output : build_outputs) {
+            CHECK(fs::exists(output));
+        }
+        CHECK(fs::last_write_time(kernel_dir / "scripts" / "basic" / "fixdep") == fixdep_mtime);
+        CHECK(fs::last_write_time(kernel_dir / "drivers" / "core.c") == core_mtime);
+        CHECK(!fs::exists(kernel_dir / "drivers" / "extra.c"));
+        CHECK(utils::read_whole_file((kernel_dir / ".config").string()) == "CONFIG_A=y\nCONFIG_B=y\n");
+    }
+    SECTION("without the list of the previous sync nothing is deleted")
+    {
+        fs::remove(files_path);
+        fs::remove(srcdir / "linux-6.13" / "drivers" / "extra.c");
+        REQUIRE(sync() == 0);
+
+        CHECK(fs::exists(kernel_dir / "drivers" / "extra.c"));
+        CHECK(fs::exists(kernel_dir / "scripts" / "basic" / "fixdep"));
+        CHECK(fs::exists(files_path));
+    }
+    fs::remove_all(home);
+}
@@ -0,0 +1,129 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "distributed_compile.hpp"
+
+#include <string_view>
+
+#include <catch2/catch_test_macros.hpp>
+
+namespace {
+
+// ~/.distcc/hosts of a build box: a LAN helper, an ssh one, distccd on this machine and zeroconf.
+constexpr std::string_view HOSTS_FILE = R"(# distcc hosts
+--randomize --localslots=4
+localhost/2
+192.168.1.10/8,lzo
+@builder.lan/16,cpp,lzo  # ssh
+127.0.0.1:3632/6
+192.168.1.11
++zeroconf
+)";
+
+// DISTCC_LOG of a kernel build, distcc writes the summary lines between its debug output.
+constexpr std::string_view DISTCC_LOG = R"(distcc[4101] (dcc_pick_host_from_list) using host 192.168.1.10/8,lzo
+distcc[4101] compile kernel/fork.c on 192.168.1.10/8,lzo completed ok
+distcc[4102] compile kernel/exit.c on 192.168.1.10/8,lzo completed ok
+distcc[4103] compile mm/slub.c on @builder.lan/16,cpp,lzo completed ok
+distcc[4104] compile init/main.c on localhost completed ok
+distcc[4105] compile fs/namei.c on 127.0.0.1:3632/6 completed ok
+distcc[4106] compile fs/dcache.c on 192.168.1.11 completed ok
+distcc[4107] (dcc_build_somewhere) Warning: failed to distribute, running locally instead
+distcc[4108] (dcc_build_somewhere) Warning: failed to distribute, running locally instead
+distcc[4109] (dcc_compile_remote) ERROR: compile net/core/dev.c on 192.168.1.11 failed
+distcc[4110] compile kernel/fork.c on 192.168.1.10/8,lzo completed ok with warnings
+)";
+
+}  // namespace
+
+TEST_CASE("distributed compile hosts", "[distributed_compile]")
+{
+    SECTION("hosts file")
+    {
+        const auto& hosts = distributed_compile::parse_hosts(HOSTS_FILE);
+        REQUIRE(hosts.size() == 6);
+
+        CHECK(hosts[0].name == "localhost");
+        CHECK(hosts[0].slots == 2);
+        CHECK(hosts[0].is_local);
+        CHECK(hosts[1].name == "192.168.1.10");
+        CHECK(hosts[1].slots == 8);
+        CHECK(!hosts[1].is_local);
+        CHECK(hosts[2].name == "@builder.lan");
+        CHECK(hosts[2].slots == 16);
+        CHECK(hosts[5].is_zeroconf);
+
+        // The remote default, distcc doesn't limit an unlisted host to the local one.
+        CHECK(hosts[4].name == "192.168.1.11");
+        CHECK(hosts[4].slots == 4);
+
+        CHECK(distributed_compile::count_remote_slots(hosts) == 8 + 16 + 4);
+        CHECK(distributed_compile::format_hosts(hosts) == "localhost/2, 192.168.1.10/8, @builder.lan/16, 127.0.0.1:3632/6, 192.168.1.11/4, zeroconf (28 remote slots)");
+    }
+    SECTION("distccd on localhost")
+    {
+        // Goes through distccd, but the jobs still take cores of this machine.
+        const auto& hosts = distributed_compile::parse_hosts("127.0.0.1/4 127.0.0.2 [::1]:3632/8 localhost:3632/3");
+        REQUIRE(hosts.size() == 4);
+        for (const auto& host : hosts) {
+            CHECK(host.is_local);
+        }
+        CHECK(hosts[0].slots == 4);
+        CHECK(hosts[1].slots == 4);
+        CHECK(hosts[2].slots == 8);
+        CHECK(hosts[3].slots == 3);
+        CHECK(distributed_compile::count_remote_slots(hosts) == 0);
+    }
+    SECTION("host names which only look local")
+    {
+        const auto& hosts = distributed_compile::parse_hosts("localhost.lan/8 10.127.0.1/6");
+        REQUIRE(hosts.size() == 2);
+        CHECK(!hosts[0].is_local);
+        CHECK(!hosts[1].is_local);
+        CHECK(distributed_compile::count_remote_slots(hosts) == 14);
+    }
+    SECTION("empty list")
+    {
+        CHECK(distributed_compile::parse_hosts("# no hosts\n--randomize\n").empty());
+        CHECK(distributed_compile::format_hosts({}) == "no hosts");
+    }
+}
+
+TEST_CASE("distributed compile log", "[distributed_compile]")
+{
+    SECTION("captured log")
+    {
+        const auto& counts = distributed_compile::parse_log(DISTCC_LOG);
+
+        // localhost and distccd on 127.0.0.1 compiled here, the failed and the non ok lines aren't counted.
+        REQUIRE(counts.remote_jobs.size() == 3);
+        CHECK(counts.remote_jobs.at("192.168.1.10") == 2);
+        CHECK(counts.remote_jobs.at("@builder.lan") == 1);
+        CHECK(counts.remote_jobs.at("192.168.1.11") == 1);
+        CHECK(!counts.remote_jobs.contains("localhost"));
+        CHECK(!counts.remote_jobs.contains("127.0.0.1:3632"));
+        CHECK(counts.fallback_jobs == 2);
+    }
+    SECTION("job counts")
+    {
+        const auto& counts = distributed_compile::parse_log(DISTCC_LOG);
+        CHECK(distributed_compile::format_job_counts(counts, 10)
+            == "4 remote (192.168.1.10 2, 192.168.1.11 1, @builder.lan 1), 6 local, 2 failed to distribute");
+        CHECK(distributed_compile::format_job_counts(distributed_compile::parse_log(""), 0) == "0 remote");
+    }
+}
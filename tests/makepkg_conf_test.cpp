@@ -0,0 +1,105 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "makepkg_conf.hpp"
+#include "build_pipeline.hpp"
+#include "utils.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Sources the conf like makepkg does and prints the variables, one per line.
+auto source_conf(const fs::path& conf_path, std::string_view environment) -> std::string {
+    const auto& script = fmt::format("source {} && printf '%s\\n' \"$MAKEFLAGS\" \"$PKGEXT\" \"$PACKAGER\" \"${{COMPRESSZST[*]}}\" \"${{OPTIONS[*]: -2}}\"",
+        build_pipeline::shell_quote(conf_path.string()));
+    std::unique_ptr<FILE, decltype(&pclose)> pipe{popen(fmt::format("{} bash -c {} 2>/dev/null", environment, build_pipeline::shell_quote(script)).c_str(), "r"), pclose};
+    REQUIRE(pipe != nullptr);
+
+    std::string output{};
+    char buffer[256]{};
+    while (fgets(buffer, sizeof(buffer), pipe.get()) != nullptr) {
+        output += buffer;
+    }
+    return output;
+}
+
+}  // namespace
+
+TEST_CASE("makepkg conf", "[makepkg_conf]")
+{
+    const auto& home     = fs::temp_directory_path() / "cachyos-km-makepkg-conf-test";
+    const auto& conf_dir = home / "conf";
+    const auto& home_env = fmt::format("HOME={}", build_pipeline::shell_quote(home.string()));
+    const auto& settings = makepkg_conf::format_package_settings({.compressor = "zstd", .threads = 2, .level = 7, .debug = false, .strip = true})
+        + makepkg_conf::format_makeflags(12);
+    fs::remove_all(home);
+    fs::create_directories(home);
+
+    SECTION("environment")
+    {
+        const auto& conf_path = makepkg_conf::write(settings, conf_dir);
+        REQUIRE(conf_path);
+        CHECK(*conf_path == conf_dir / "makepkg.conf");
+
+        // makepkg reads only MAKEPKG_CONF then, the generated conf sources the user one itself.
+        const auto& environment = makepkg_conf::get_environment(*conf_path);
+        REQUIRE(environment.size() == 1);
+        CHECK(environment[0].first == "MAKEPKG_CONF");
+        CHECK(environment[0].second == conf_path->string());
+    }
+    SECTION("settings are set")
+    {
+        const auto& conf_path = makepkg_conf::write(settings, conf_dir);
+        REQUIRE(conf_path);
+        CHECK(source_conf(*conf_path, fmt::format("env -u XDG_CONFIG_HOME {}", home_env)) == "-j12\n.pkg.tar.zst\n\nzstd -c -T2 -7 -\n!debug strip\n");
+    }
+    SECTION("user conf is sourced before the settings")
+    {
+        fs::create_directories(home / ".config" / "pacman");
+        REQUIRE(utils::write_to_file((home / ".config" / "pacman" / "makepkg.conf").string(), "MAKEFLAGS=\"-j1\"\nPACKAGER=\"Config <config@example.org>\"\n"));
+        REQUIRE(utils::write_to_file((home / ".makepkg.conf").string(), "PACKAGER=\"Home <home@example.org>\"\n"));
+
+        const auto& conf_path = makepkg_conf::write(settings, conf_dir);
+        REQUIRE(conf_path);
+        CHECK(source_conf(*conf_path, fmt::format("env -u XDG_CONFIG_HOME {}", home_env)) == "-j12\n.pkg.tar.zst\nConfig <config@example.org>\nzstd -c -T2 -7 -\n!debug strip\n");
+
+        // ~/.makepkg.conf is read only without the XDG one, like makepkg does.
+        fs::remove_all(home / ".config");
+        CHECK(source_conf(*conf_path, fmt::format("env -u XDG_CONFIG_HOME {}", home_env)) == "-j12\n.pkg.tar.zst\nHome <home@example.org>\nzstd -c -T2 -7 -\n!debug strip\n");
+    }
+    SECTION("user conf of XDG_CONFIG_HOME")
+    {
+        fs::create_directories(home / "xdg" / "pacman");
+        REQUIRE(utils::write_to_file((home / "xdg" / "pacman" / "makepkg.conf").string(), "PACKAGER=\"Xdg <xdg@example.org>\"\nPKGEXT='.pkg.tar.xz'\n"));
+
+        const auto& conf_path = makepkg_conf::write(settings, conf_dir);
+        REQUIRE(conf_path);
+        CHECK(source_conf(*conf_path, fmt::format("env {} XDG_CONFIG_HOME={}", home_env, build_pipeline::shell_quote((home / "xdg").string())))
+            == "-j12\n.pkg.tar.zst\nXdg <xdg@example.org>\nzstd -c -T2 -7 -\n!debug strip\n");
+    }
+    fs::remove_all(home);
+}
@@ -0,0 +1,162 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "patch_cache.hpp"
+#include "utils.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/core.h>
+
+#include <arpa/inet.h>   // for htonl
+#include <netinet/in.h>  // for sockaddr_in
+#include <sys/socket.h>  // for socket, accept
+#include <unistd.h>      // for close
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Serves the same body for every request on a port of localhost, like a patch hosted upstream.
+class HttpServer {
+ public:
+    HttpServer() {
+        m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{.sin_family = AF_INET, .sin_port = 0, .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)}, .sin_zero = {}};
+        socklen_t address_len = sizeof(address);
+        REQUIRE(bind(m_listen_fd, reinterpret_cast<sockaddr*>(&address), address_len) == 0);
+        REQUIRE(listen(m_listen_fd, 4) == 0);
+        REQUIRE(getsockname(m_listen_fd, reinterpret_cast<sockaddr*>(&address), &address_len) == 0);
+        m_port   = ntohs(address.sin_port);
+        m_thread = std::thread([this] { serve(); });
+    }
+    ~HttpServer() {
+        // Wakes up the blocked accept.
+        shutdown(m_listen_fd, SHUT_RDWR);
+        m_thread.join();
+        close(m_listen_fd);
+    }
+    HttpServer(const HttpServer&)            = delete;
+    HttpServer& operator=(const HttpServer&) = delete;
+
+    void set_body(std::string body) {
+        const std::lock_guard lock{m_mutex};
+        m_body = std::move(body);
+    }
+
+    [[nodiscard]] auto get_url(std::string_view path) const -> std::string {
+        return fmt::format("http://127.0.0.1:{}/{}", m_port, path);
+    }
+
+ private:
+    void serve() {
+        while (true) {
+            const int client_fd = accept(m_listen_fd, nullptr, nullptr);
+            if (client_fd < 0) {
+                return;
+            }
+            // The request is read only to be polite, every path has the same body.
+            std::array<char, 4096> request{};
+            std::ignore = read(client_fd, request.data(), request.size());
+
+            std::string response{};
+            {
+                const std::lock_guard lock{m_mutex};
+                response = fmt::format("HTTP/1.0 200 OK\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}", m_body.size(), m_body);
+            }
+            std::ignore = write(client_fd, response.data(), response.size());
+            close(client_fd);
+        }
+    }
+
+    int m_listen_fd{-1};
+    std::uint16_t m_port{};
+    std::thread m_thread{};
+    std::mutex m_mutex{};
+    std::string m_body{};
+};
+
+}  // namespace
+
+// HOME is set by ctest, the patches are stored in its ~/.cache/cachyos-km/patches.
+TEST_CASE("fetched patches are linked into SRCDEST", "[patch_cache]") {
+    const fs::path home_path{std::getenv("HOME")};  // NOLINT
+    fs::remove_all(home_path);
+    fs::create_directories(home_path);
+
+    const auto& srcdest_path = home_path / "srcdest";
+    fs::create_directories(srcdest_path);
+
+    HttpServer server{};
+    server.set_body("first\n");
+    const auto& url = server.get_url("fix.patch");
+
+    SECTION("local patch is fetched, but never linked") {
+        const auto& patch_path = home_path / "local.patch";
+        REQUIRE(utils::write_to_file(patch_path.string(), "local\n"));
+        const auto& local_url = fmt::format("file://{}", patch_path.string());
+
+        const auto& result = patch_cache::fetch(local_url);
+        REQUIRE(result.error.empty());
+        const auto& object_path = patch_cache::lookup(local_url);
+        REQUIRE(object_path);
+        CHECK(utils::read_whole_file(object_path->string()) == "local\n");
+
+        CHECK(patch_cache::link_into_srcdest({local_url}, srcdest_path) == 0);
+        CHECK_FALSE(fs::exists(srcdest_path / "local.patch"));
+    }
+
+    SECTION("remote patch is linked under the name makepkg uses") {
+        REQUIRE(patch_cache::fetch(url).error.empty());
+        CHECK(patch_cache::link_into_srcdest({url, fmt::format("renamed.patch::{}", url)}, srcdest_path) == 2);
+        CHECK(utils::read_whole_file((srcdest_path / "fix.patch").string()) == "first\n");
+        CHECK(utils::read_whole_file((srcdest_path / "renamed.patch").string()) == "first\n");
+
+        // Already in place.
+        CHECK(patch_cache::link_into_srcdest({url}, srcdest_path) == 0);
+    }
+
+    SECTION("stale download in SRCDEST is replaced") {
+        // Downloaded by makepkg of an earlier build.
+        REQUIRE(utils::write_to_file((srcdest_path / "fix.patch").string(), "old\n"));
+        REQUIRE(patch_cache::fetch(url).error.empty());
+        REQUIRE(patch_cache::link_into_srcdest({url}, srcdest_path) == 1);
+        CHECK(utils::read_whole_file((srcdest_path / "fix.patch").string()) == "first\n");
+
+        server.set_body("second\n");
+        REQUIRE(patch_cache::fetch(url).error.empty());
+        CHECK(patch_cache::link_into_srcdest({url}, srcdest_path) == 1);
+        CHECK(utils::read_whole_file((srcdest_path / "fix.patch").string()) == "second\n");
+    }
+
+    SECTION("failed fetch keeps the stored patch") {
+        REQUIRE(patch_cache::fetch(url).error.empty());
+        const auto& missing = patch_cache::fetch("http://127.0.0.1:1/fix.patch");
+        CHECK_FALSE(missing.error.empty());
+        CHECK(missing.digest.empty());
+        CHECK(patch_cache::lookup(url));
+    }
+}
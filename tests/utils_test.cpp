@@ -0,0 +1,122 @@
+// Copyright (C) 2022-2024 Vladislav Nepogodin
+//
+// This file is part of CachyOS kernel manager.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+
+#include "utils.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/core.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Runs a git command, failing the test if it fails.
+void git(const fs::path& repo_path, std::string_view args) {
+    const auto& cmd = fmt::format("git -C '{}' -c user.name=test -c user.email=test@localhost {} >/dev/null 2>&1", repo_path.string(), args);
+    REQUIRE(std::system(cmd.c_str()) == 0);
+}
+
+// Commits the PKGBUILD into the working copy of the upstream and pushes it.
+void push_pkgbuild(const fs::path& work_path, std::string_view content) {
+    REQUIRE(utils::write_to_file((work_path / "PKGBUILD").string(), content));
+    git(work_path, "add PKGBUILD");
+    git(work_path, fmt::format("commit -q -m '{}'", content));
+    git(work_path, "push -q origin master");
+}
+
+// Makes the next sync fetch, instead of using the recent fetch.
+void expire_fetch(const fs::path& pkgbuilds_path) {
+    fs::last_write_time(pkgbuilds_path / ".git" / "cachyos-km-fetch", fs::file_time_type::clock::now() - std::chrono::hours(1));
+}
+
+}  // namespace
+
+// HOME is set by ctest, the PKGBUILDs are cloned from a local bare repo instead of GitHub.
+TEST_CASE("PKGBUILDs are synced from CACHYOS_KM_PKGBUILDS_URL", "[utils]") {
+    const fs::path home_path{std::getenv("HOME")};  // NOLINT
+    // Every section starts from scratch, the previous one left us in the PKGBUILDs directory.
+    fs::current_path(home_path.parent_path());
+    fs::remove_all(home_path);
+    fs::create_directories(home_path);
+
+    const auto& upstream_path = home_path / "upstream.git";
+    const auto& work_path     = home_path / "upstream-work";
+    REQUIRE(std::system(fmt::format("git init -q --bare -b master '{}'", upstream_path.string()).c_str()) == 0);
+    REQUIRE(std::system(fmt::format("git clone -q '{}' '{}' 2>/dev/null", upstream_path.string(), work_path.string()).c_str()) == 0);
+    git(work_path, "symbolic-ref HEAD refs/heads/master");
+    push_pkgbuild(work_path, "pkgver=1\n");
+    push_pkgbuild(work_path, "pkgver=2\n");
+
+    REQUIRE(setenv("CACHYOS_KM_PKGBUILDS_URL", fmt::format("file://{}", upstream_path.string()).c_str(), 1) == 0);
+    const auto& pkgbuilds_path = home_path / ".cache/cachyos-km/pkgbuilds";
+    const auto& pkgbuild_path  = (pkgbuilds_path / "PKGBUILD").string();
+
+    SECTION("shallow clone, entered by the build") {
+        REQUIRE(utils::prepare_build_environment());
+        CHECK(utils::read_whole_file(pkgbuild_path) == "pkgver=2\n");
+        CHECK(fs::current_path() == pkgbuilds_path);
+        CHECK(utils::exec(fmt::format("git -C '{}' rev-list --count HEAD", pkgbuilds_path.string())) == "1");
+    }
+
+    SECTION("changes of the previous build are dropped") {
+        REQUIRE(utils::prepare_build_environment());
+        REQUIRE(utils::write_to_file(pkgbuild_path, "pkgver=modified\n"));
+        REQUIRE(utils::write_to_file((pkgbuilds_path / "leftover.patch").string(), "patch\n"));
+
+        REQUIRE(utils::prepare_build_environment());
+        CHECK(utils::read_whole_file(pkgbuild_path) == "pkgver=2\n");
+        CHECK_FALSE(fs::exists(pkgbuilds_path / "leftover.patch"));
+    }
+
+    SECTION("recent fetch is reused, prefetch keeps the working tree") {
+        REQUIRE(utils::prepare_build_environment());
+        push_pkgbuild(work_path, "pkgver=3\n");
+
+        REQUIRE(utils::prepare_build_environment());
+        CHECK(utils::read_whole_file(pkgbuild_path) == "pkgver=2\n");
+
+        expire_fetch(pkgbuilds_path);
+        REQUIRE(utils::prefetch_build_environment());
+        CHECK(utils::read_whole_file(pkgbuild_path) == "pkgver=2\n");
+
+        REQUIRE(utils::prepare_build_environment());
+        CHECK(utils::read_whole_file(pkgbuild_path) == "pkgver=3\n");
+    }
+
+    SECTION("failed fetch falls back to the local copy") {
+        REQUIRE(utils::prepare_build_environment());
+        fs::remove_all(upstream_path);
+        expire_fetch(pkgbuilds_path);
+
+        REQUIRE(utils::prepare_build_environment());
+        CHECK(utils::read_whole_file(pkgbuild_path) == "pkgver=2\n");
+    }
+
+    SECTION("cancelled clone fails") {
+        const auto& clone_path = home_path / "cancelled";
+        CHECK_FALSE(utils::fetch_git_repo(clone_path.string(), fmt::format("file://{}", upstream_path.string()), "master",
+            std::chrono::minutes(10), [] { return true; }));
+        CHECK_FALSE(fs::exists(clone_path / ".git" / "cachyos-km-fetch"));
+    }
+}